@@ -28,6 +28,47 @@ ApplicationWindow {
         }
     }
 
+    FolderDialog {
+        id: zarrFolderDialog
+        onAccepted: {
+            var point = Qt.vector3d(parseInt(pointX.text), parseInt(pointY.text), parseInt(pointZ.text))
+            // Chunk size, data type and level are read from the Zarr metadata.
+            volumeTextureData.loadAsync(selectedFolder, -1, -1, -1, "", point, -1, "C")
+            spinner.running = true
+        }
+    }
+
+    ScrollOverview {
+        id: scrollOverview
+        source: zarrStore(scrollCombo.currentText).url
+        order: zarrStore(scrollCombo.currentText).order
+        active: !volumesPane.hidden
+    }
+
+    SurfaceSampler {
+        id: surfaceSampler
+        onSampleSucceeded: (outputFolder, width, height, layers) => console.log("Sampled", layers, "layers of", width, "x", height, "to", outputFolder)
+        onSampleFailed: (outputFolder, error) => console.warn(error)
+    }
+
+    FileDialog {
+        id: meshDialog
+        nameFilters: ["Meshes (*.obj *.ply)"]
+        onAccepted: {
+            var store = zarrStore(scrollCombo.currentText)
+            surfaceSampler.source = store.url
+            surfaceSampler.level = store.level
+            surfaceSampler.mesh = selectedFile
+            surfaceSampler.layers = parseInt(sampleLayers.text)
+            sampleFolderDialog.open()
+        }
+    }
+
+    FolderDialog {
+        id: sampleFolderDialog
+        onAccepted: surfaceSampler.sampleAsync(selectedFolder)
+    }
+
     function clamp(number, min, max) {
         return Math.max(min, Math.min(number, max))
     }
@@ -59,6 +100,28 @@ ApplicationWindow {
         spinner.running = true
     }
 
+    function zarrStore(name) {
+        var url = ""
+        var level = -1 // unused.
+        var order = "C"
+        if (name == "Scroll1A") {
+            url = "https://dl.ash2txt.org/full-scrolls/Scroll1/PHercParis4.volpkg/volumes_zarr_standardized/54keV_7.91um_Scroll1A.zarr"
+            level = 0
+        } else if (name == "Scroll5") {
+            url = "https://dl.ash2txt.org/full-scrolls/Scroll5/PHerc172.volpkg/volumes_zarr_standardized/53keV_7.91um_Scroll5.zarr/"
+            level = 0
+        } else if (name == "Scroll1A - Fiber") {
+            url = "https://dl.ash2txt.org/community-uploads/bruniss/Fiber-and-Surface-Models/Predictions/s1/mask-2ext-surface_erode_evenmore_ome.zarr/"
+            level = 0
+        } else if (name == "Scroll1A - Boundary") {
+            url = "https://dl.ash2txt.org/other/dev/meshes/boundaries.zarr/"
+        } else if (name == "Scroll1A - Ink") {
+            url = "https://dl.ash2txt.org/community-uploads/ryan/3d_predictions_scroll1.zarr/"
+            order = "yxz"
+        }
+        return { "url": url, "level": level, "order": order }
+    }
+
     function getColormapSource(currentIndex) {
         switch (currentIndex) {
         case 0:
@@ -106,9 +169,10 @@ ApplicationWindow {
 
     Connections {
         target: volumeTextureData
-        function onLoadSucceeded(source, width, height, depth, dataType, localFocusPoint, globalFocusPoint) {
+        function onLoadSucceeded(source, width, height, depth, dataType, localFocusPoint, globalFocusPoint, textureSpacing) {
+            // Downsampled textures cover textureSpacing source voxels per texel.
             var spacing = SpacingMap.get(String(source)).times(
-                        Qt.vector3d(width, height, depth).normalized())
+                        Qt.vector3d(width, height, depth).times(textureSpacing).normalized())
             let maxSide = Math.max(Math.max(spacing.x, spacing.y), spacing.z)
             spacing = spacing.times(1 / maxSide)
 
@@ -173,6 +237,7 @@ ApplicationWindow {
             source: "#Cube"
             visible: true
             materials: CustomMaterial {
+                id: volumeMaterial
                 shadingMode: CustomMaterial.Unshaded
                 vertexShader: "shaders/alpha_blending.vert"
                 fragmentShader: "shaders/alpha_blending.frag"
@@ -187,6 +252,13 @@ ApplicationWindow {
                             width: parseInt(dataWidth.text)
                             height: parseInt(dataHeight.text)
                             depth: parseInt(dataDepth.text)
+                            regionChunks: regionCombo.currentIndex + 1
+                            sliceMin: loadSliceBox.checked ? volumeMaterial.sliceMin : Qt.vector3d(0, 0, 0)
+                            sliceMax: loadSliceBox.checked ? volumeMaterial.sliceMax : Qt.vector3d(1, 1, 1)
+                            gradientsEnabled: shadedBox.checked
+                            filter: ["none", "median", "gaussian", "unsharp", "contrast"][filterCombo.currentIndex]
+                            filterRadius: filterRadiusCombo.currentIndex + 1
+                            filterAmount: filterAmountSlider.value
                         }
                         minFilter: Texture.Nearest
                         mipFilter: Texture.None
@@ -198,6 +270,17 @@ ApplicationWindow {
                 }
                 //! [volume-texture]
 
+                property TextureInput gradient: TextureInput {
+                    texture: Texture {
+                        textureData: volumeTextureData.gradientTexture
+                        minFilter: Texture.Nearest
+                        mipFilter: Texture.None
+                        magFilter: Texture.Nearest
+                        tilingModeHorizontal: Texture.ClampToEdge
+                        tilingModeVertical: Texture.ClampToEdge
+                    }
+                }
+
                 property TextureInput colormap: TextureInput {
                     enabled: true
                     texture: Texture {
@@ -206,12 +289,36 @@ ApplicationWindow {
                         source: getColormapSource(colormapCombo.currentIndex)
                     }
                 }
+
+                property TextureInput transferTable: TextureInput {
+                    texture: Texture {
+                        textureData: TransferFunctionTable {
+                            colormap: Qt.resolvedUrl(getColormapSource(colormapCombo.currentIndex))
+                            stepAlpha: volumeMaterial.stepAlpha
+                            tMin: volumeMaterial.tMin
+                            tMax: volumeMaterial.tMax
+                            multipliedAlpha: volumeMaterial.multipliedAlpha
+                            // Opacity is given per step of the default length, one voxel.
+                            stepRatio: volumeMaterial.stepLength * cubeModel.maxSide
+                        }
+                        minFilter: Texture.Linear
+                        mipFilter: Texture.None
+                        magFilter: Texture.Linear
+                        tilingModeHorizontal: Texture.ClampToEdge
+                        tilingModeVertical: Texture.ClampToEdge
+                    }
+                }
+                property bool preintegrated: preintegratedBox.checked
                 property real stepLength: Math.max(0.0001, parseFloat(
                                                        stepLengthText.text,
                                                        1 / cubeModel.maxSide))
                 property real minSide: 1 / cubeModel.minSide
                 property real stepAlpha: stepAlphaSlider.value
                 property bool multipliedAlpha: multipliedAlphaBox.checked
+                property bool shaded: shadedBox.checked && volumeTextureData.gradientsReady
+                property real shadingStrength: 0.8
+                property int overlayChannels: volumeTextureData.channels - 1
+                property real overlayOpacity: overlayOpacitySlider.value
 
                 property real tMin: tSlider.first.value
                 property real tMax: tSlider.second.value
@@ -229,6 +336,8 @@ ApplicationWindow {
                                                 ySliceWidthSlider.value,
                                                 zSliceSlider.value,
                                                 zSliceWidthSlider.value)
+                property vector3d occupiedMin: volumeTextureData.occupiedMin
+                property vector3d occupiedMax: volumeTextureData.occupiedMax
 
                 sourceBlend: CustomMaterial.SrcAlpha
                 destinationBlend: CustomMaterial.OneMinusSrcAlpha
@@ -404,16 +513,19 @@ ApplicationWindow {
                 }
             }
 
-            InstanceList {
+            AnnotationInstancing {
                 id: boxInstancing
-                instances: []
+                color: "cyan"
+                // Markers outside the slice box of the loaded chunks are hidden.
+                cullMin: volumeMaterial.sliceMin.times(100).minus(Qt.vector3d(50, 50, 50))
+                cullMax: volumeMaterial.sliceMax.times(100).minus(Qt.vector3d(50, 50, 50))
             }
             Model {
                 id: box
                 instancing: boxInstancing
                 geometry: LineBoxGeometry {}
-                materials: PrincipledMaterial { 
-                    baseColor: "cyan" 
+                materials: PrincipledMaterial {
+                    baseColor: "white" // Tinted per instance.
                     lighting: PrincipledMaterial.NoLighting
                 }
                 pickable: true
@@ -676,31 +788,94 @@ ApplicationWindow {
                 model: [qsTr("Scroll1A"), qsTr("Scroll5"), qsTr("Scroll1A - Fiber"), qsTr("Scroll1A - Ink"), qsTr("Scroll1A - Boundary")]
             }
 
+            Label {
+                text: qsTr("Overview:") + (scrollOverview.running ? " " + Math.round(scrollOverview.progress * 100) + "%" : "")
+            }
+
+            Row {
+                spacing: 5
+                Repeater {
+                    // The horizontal and vertical axis of each projection.
+                    model: ["xy", "xz", "yz"]
+                    delegate: Image {
+                        id: overviewImage
+                        required property string modelData
+                        width: 120
+                        height: 120
+                        fillMode: Image.PreserveAspectFit
+                        cache: false
+                        source: scrollOverview[modelData + "Image"]
+
+                        function axisValue(point, axis) {
+                            return axis === "x" ? point.x : (axis === "y" ? point.y : point.z)
+                        }
+
+                        // The focus point in the projection.
+                        Rectangle {
+                            property vector3d focus: Qt.vector3d(parseInt(pointX.text), parseInt(pointY.text), parseInt(pointZ.text))
+                            visible: overviewImage.status === Image.Ready && scrollOverview.shape.x > 0
+                            width: 5
+                            height: 5
+                            radius: 2.5
+                            color: "#dc322f"
+                            x: (overviewImage.width - overviewImage.paintedWidth) / 2 - width / 2
+                               + overviewImage.paintedWidth * overviewImage.axisValue(focus, overviewImage.modelData[0]) / overviewImage.axisValue(scrollOverview.shape, overviewImage.modelData[0])
+                            y: (overviewImage.height - overviewImage.paintedHeight) / 2 - height / 2
+                               + overviewImage.paintedHeight * overviewImage.axisValue(focus, overviewImage.modelData[1]) / overviewImage.axisValue(scrollOverview.shape, overviewImage.modelData[1])
+                        }
+
+                        // Clicking moves the focus point along the projection's two axes.
+                        MouseArea {
+                            anchors.fill: parent
+                            enabled: scrollOverview.shape.x > 0
+                            onClicked: (mouse) => {
+                                // The image is letterboxed, map the click into its painted area.
+                                var u = (mouse.x - (overviewImage.width - overviewImage.paintedWidth) / 2) / overviewImage.paintedWidth
+                                var v = (mouse.y - (overviewImage.height - overviewImage.paintedHeight) / 2) / overviewImage.paintedHeight
+                                if (u < 0 || u > 1 || v < 0 || v > 1)
+                                    return
+                                var fields = { "x": pointX, "y": pointY, "z": pointZ }
+                                var horizontal = overviewImage.modelData[0]
+                                var vertical = overviewImage.modelData[1]
+                                fields[horizontal].text = Math.floor(u * overviewImage.axisValue(scrollOverview.shape, horizontal))
+                                fields[vertical].text = Math.floor(v * overviewImage.axisValue(scrollOverview.shape, vertical))
+                            }
+                        }
+                    }
+                }
+            }
+
+            Label {
+                text: qsTr("Overlay Zarr Volume:")
+            }
+
+            ComboBox {
+                id: overlayCombo
+                model: [qsTr("None"), qsTr("Scroll1A - Fiber"), qsTr("Scroll1A - Ink"), qsTr("Scroll1A - Boundary")]
+            }
+
+            Label {
+                text: qsTr("Chunks per axis:")
+            }
+
+            ComboBox {
+                id: regionCombo
+                model: ["1", "2", "3", "4"]
+            }
+
             Button {
                 text: qsTr("Load Volume...")
                 onClicked: {
-                        var url = ""
+                        var store = zarrStore(scrollCombo.currentText)
                         var chunkSize = -1 // Read from Zarr metadata.
                         var dataType = "" // Read from Zarr metadata.
-                        var level = -1 // unused.
-                        var order = "C"
-                        if (scrollCombo.currentText == "Scroll1A") {
-                            url = "https://dl.ash2txt.org/full-scrolls/Scroll1/PHercParis4.volpkg/volumes_zarr_standardized/54keV_7.91um_Scroll1A.zarr"
-                            level = 0
-                        } else if (scrollCombo.currentText == "Scroll5") {
-                            url = "https://dl.ash2txt.org/full-scrolls/Scroll5/PHerc172.volpkg/volumes_zarr_standardized/53keV_7.91um_Scroll5.zarr/"
-                            level = 0
-                        } else if (scrollCombo.currentText == "Scroll1A - Fiber") {
-                            url = "https://dl.ash2txt.org/community-uploads/bruniss/Fiber-and-Surface-Models/Predictions/s1/mask-2ext-surface_erode_evenmore_ome.zarr/"
-                            level = 0
-                        } else if (scrollCombo.currentText == "Scroll1A - Boundary") {
-                            url = "https://dl.ash2txt.org/other/dev/meshes/boundaries.zarr/"
-                        } else if (scrollCombo.currentText == "Scroll1A - Ink") {
-                            url = "https://dl.ash2txt.org/community-uploads/ryan/3d_predictions_scroll1.zarr/"
-                            order = "yxz"
-                        }
                         var point = Qt.vector3d(parseInt(pointX.text), parseInt(pointY.text), parseInt(pointZ.text))
-                        volumeTextureData.loadAsync(url, chunkSize, chunkSize, chunkSize, dataType, point, level, order)
+                        if (overlayCombo.currentIndex > 0) {
+                            var overlay = zarrStore(overlayCombo.currentText)
+                            volumeTextureData.loadOverlayAsync(store.url, [overlay.url], point, store.level, store.order, [overlay.level], [overlay.order])
+                        } else {
+                            volumeTextureData.loadAsync(store.url, chunkSize, chunkSize, chunkSize, dataType, point, store.level, store.order)
+                        }
                         spinner.running = true
                 }
             }
@@ -748,6 +923,43 @@ ApplicationWindow {
                 text: qsTr("Open file...")
                 onClicked: fileDialog.open()
             }
+
+            Button {
+                text: qsTr("Open Zarr directory...")
+                onClicked: zarrFolderDialog.open()
+            }
+
+            Label {
+                text: qsTr("Sample Surface of Zarr Volume:")
+            }
+
+            Row {
+                spacing: 5
+
+                Label {
+                    text: qsTr("Layers:")
+                    anchors.verticalCenter: parent.verticalCenter
+                }
+
+                TextField {
+                    id: sampleLayers
+                    text: "65"
+                    validator: IntValidator {
+                        bottom: 1
+                        top: 999
+                    }
+                }
+
+                Button {
+                    text: surfaceSampler.running ? qsTr("Cancel") : qsTr("Open mesh...")
+                    onClicked: surfaceSampler.running ? surfaceSampler.cancel() : meshDialog.open()
+                }
+            }
+
+            ProgressBar {
+                visible: surfaceSampler.running
+                value: surfaceSampler.progress
+            }
         }
     }
 
@@ -870,26 +1082,32 @@ ApplicationWindow {
 
                         TableView.onCommit: {
                             display = text
-                            var instance = boxTable.getRow(row).instance
+                            var position = boxInstancing.position(row)
+                            var scale = boxInstancing.scale(row)
+                            var rotation = boxInstancing.eulerRotation(row)
                             if (column == 0) { // position
-                                instance.position.x = parseFloat(text)
+                                position.x = parseFloat(text)
                             } else if (column == 1) {
-                                instance.position.y = parseFloat(text)
+                                position.y = parseFloat(text)
                             } else if (column == 2) {
-                                instance.position.z = parseFloat(text)
+                                position.z = parseFloat(text)
                             } else if (column == 3) {
-                                instance.scale.x = parseFloat(text)
+                                scale.x = parseFloat(text)
                             } else if (column == 4) {
-                                instance.scale.y = parseFloat(text)
+                                scale.y = parseFloat(text)
                             } else if (column == 5) {
-                                instance.scale.z = parseFloat(text)
+                                scale.z = parseFloat(text)
                             } else if (column == 6) {
-                                instance.eulerRotation.x = parseFloat(text)
+                                rotation.x = parseFloat(text)
                             } else if (column == 7) {
-                                instance.eulerRotation.y = parseFloat(text)
+                                rotation.y = parseFloat(text)
                             } else if (column == 8) {
-                                instance.eulerRotation.z = parseFloat(text)
+                                rotation.z = parseFloat(text)
                             }
+                            // Only the edited marker's entry is rewritten.
+                            boxInstancing.setPosition(row, position)
+                            boxInstancing.setScale(row, scale)
+                            boxInstancing.setEulerRotation(row, rotation)
                         }
                     }
                 }
@@ -950,12 +1168,48 @@ ApplicationWindow {
                 second.value: 1
             }
 
+            Canvas {
+                id: histogramCanvas
+                width: tSlider.width
+                height: 40
+
+                onPaint: {
+                    var ctx = getContext("2d")
+                    ctx.reset()
+                    var bins = volumeTextureData.histogram
+                    if (bins.length === 0)
+                        return
+                    var binWidth = width / bins.length
+                    ctx.fillStyle = Universal.foreground
+                    for (var i = 0; i < bins.length; i++) {
+                        var barHeight = bins[i] * height
+                        ctx.fillRect(i * binWidth, height - barHeight, Math.max(1, binWidth), barHeight)
+                    }
+                }
+
+                Connections {
+                    target: volumeTextureData
+                    function onHistogramChanged() {
+                        histogramCanvas.requestPaint()
+                    }
+                }
+            }
+
             Image {
                 width: tSlider.width
                 height: 20
                 source: getColormapSource(colormapCombo.currentIndex)
             }
 
+            Button {
+                text: qsTr("Auto contrast")
+                onClicked: {
+                    // Clip the darkest and brightest 1% of the non-empty voxels.
+                    tSlider.setValues(volumeTextureData.histogramPercentile(0.01),
+                                      volumeTextureData.histogramPercentile(0.99))
+                }
+            }
+
             Label {
                 text: qsTr("Colormap:")
             }
@@ -965,6 +1219,19 @@ ApplicationWindow {
                 model: [qsTr("Black White"), qsTr("Cool Warm"), qsTr("Plasma"), qsTr("Viridis"), qsTr("Rainbow"), qsTr("Gnuplot")]
             }
 
+            Label {
+                text: qsTr("Overlay opacity:")
+                visible: volumeTextureData.channels > 1
+            }
+
+            Slider {
+                id: overlayOpacitySlider
+                visible: volumeTextureData.channels > 1
+                from: 0
+                value: 0.8
+                to: 1
+            }
+
             Label {
                 text: qsTr("Step alpha:")
             }
@@ -997,6 +1264,51 @@ ApplicationWindow {
                 checked: true
             }
 
+            CheckBox {
+                id: shadedBox
+                text: qsTr("Shaded")
+                checked: false
+            }
+
+            CheckBox {
+                id: preintegratedBox
+                text: qsTr("Preintegrated")
+                checked: false
+            }
+
+            Label {
+                text: qsTr("Filter:")
+            }
+
+            ComboBox {
+                id: filterCombo
+                model: [qsTr("None"), qsTr("Median"), qsTr("Gaussian"), qsTr("Unsharp"), qsTr("Local Contrast")]
+            }
+
+            Label {
+                visible: filterCombo.currentIndex > 0
+                text: qsTr("Filter radius:")
+            }
+
+            ComboBox {
+                id: filterRadiusCombo
+                visible: filterCombo.currentIndex > 0
+                model: ["1", "2", "3"]
+            }
+
+            Label {
+                visible: filterCombo.currentIndex > 2
+                text: qsTr("Filter amount:")
+            }
+
+            Slider {
+                id: filterAmountSlider
+                visible: filterCombo.currentIndex > 2
+                from: 0
+                value: 1
+                to: 3
+            }
+
             CheckBox {
                 id: drawBoundingBox
                 text: qsTr("Draw Bounding Box")
@@ -1021,6 +1333,12 @@ ApplicationWindow {
                 checked: false
             }
 
+            CheckBox {
+                id: loadSliceBox
+                text: qsTr("Load slice box only")
+                checked: false
+            }
+
             // X plane
             Label {
                 text: qsTr("X plane slice (position, width):")
@@ -1154,6 +1472,38 @@ ApplicationWindow {
                 id: dataTypeComboBox
                 model: ["uint8", "uint16", "int16", "float32", "float64"]
             }
+
+            Label {
+                text: qsTr("Memory: %1 / %2 MiB").arg((MemoryBudget.used / 1048576).toFixed(0)).arg((MemoryBudget.budget / 1048576).toFixed(0))
+            }
+
+            Label {
+                // Bytes held per stage of the load path.
+                text: {
+                    let lines = []
+                    const usage = MemoryBudget.usage
+                    for (const category in usage)
+                        lines.push(category + ": " + (usage[category] / 1048576).toFixed(1) + " MiB")
+                    return lines.join("\n")
+                }
+                font.pointSize: 8
+            }
+
+            Grid {
+                horizontalItemAlignment: Grid.AlignHCenter
+                verticalItemAlignment: Grid.AlignVCenter
+                spacing: 5
+                Label {
+                    text: qsTr("Budget (MiB):")
+                }
+
+                TextField {
+                    text: (MemoryBudget.budget / 1048576).toFixed(0)
+                    width: 100
+                    validator: IntValidator { bottom: 64 }
+                    onEditingFinished: MemoryBudget.budget = parseInt(text) * 1048576
+                }
+            }
         }
     }
     //! [settings]
@@ -1170,32 +1520,24 @@ ApplicationWindow {
                 if (measureModeSelect.checked) {
                     
                 } else if (measureModeAdd.checked) {
-                    //var instance = Qt.createComponent("QtQuick3D", "InstanceListEntry", Component.Asynchronous, boxInstancing) This method does not work ???
-                    var instance = Qt.createQmlObject(`
-                        import QtQuick3D
-
-                        InstanceListEntry {
-                        }
-                        `,
-                        boxInstancing
-                    )
-                    instance.position = result.scenePosition
-                    instance.scale = Qt.vector3d(10, 10, 10)
-                    boxInstancing.instances.push(instance)
+                    // Markers live in the volume's coordinates, like the box model that draws them.
+                    var index = boxInstancing.add(cubeModel.mapPositionFromScene(result.scenePosition), Qt.vector3d(10, 10, 10))
+                    var position = boxInstancing.position(index)
+                    var scale = boxInstancing.scale(index)
+                    var rotation = boxInstancing.eulerRotation(index)
                     boxTable.appendRow({
-                        "instance": instance,
-                        "positionX": instance.position.x.toFixed(3),
-                        "positionY": instance.position.y.toFixed(3),
-                        "positionZ": instance.position.z.toFixed(3),
-                        "scaleX": instance.scale.x.toFixed(3),
-                        "scaleY": instance.scale.y.toFixed(3),
-                        "scaleZ": instance.scale.z.toFixed(3),
-                        "rotationX": instance.eulerRotation.x.toFixed(3),
-                        "rotationY": instance.eulerRotation.y.toFixed(3),
-                        "rotationZ": instance.eulerRotation.z.toFixed(3)
+                        "positionX": position.x.toFixed(3),
+                        "positionY": position.y.toFixed(3),
+                        "positionZ": position.z.toFixed(3),
+                        "scaleX": scale.x.toFixed(3),
+                        "scaleY": scale.y.toFixed(3),
+                        "scaleZ": scale.z.toFixed(3),
+                        "rotationX": rotation.x.toFixed(3),
+                        "rotationY": rotation.y.toFixed(3),
+                        "rotationZ": rotation.z.toFixed(3)
                     })
-                } else if (measureModeRemove.checked) {
-                    pickedObject.instancing.instances.splice(result.instanceIndex, 1)
+                } else if (measureModeRemove.checked && pickedObject === box) {
+                    boxInstancing.remove(result.instanceIndex)
                     boxTable.removeRow(result.instanceIndex)
                 }
             }
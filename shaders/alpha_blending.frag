@@ -27,10 +27,16 @@ void MAIN()
     // The camera position (eye) in model space
     const vec3 ray_origin_model = (inverse(MODEL_MATRIX) * vec4(CAMERA_POSITION, 1)).xyz;
 
+    // Chunks outside the occupied box are empty, only march through the part of the slice box inside it
+    const vec3 box_min = max(sliceMin, occupiedMin);
+    const vec3 box_max = min(sliceMax, occupiedMax);
+    if (any(greaterThan(box_min, box_max)))
+        return; // Nothing but empty chunks
+
     // Get the ray intersection with the sliced box
     float t_0, t_1;
-    const vec3 top_sliced = vec3(100)*sliceMax - vec3(50);
-    const vec3 bottom_sliced = vec3(100)*sliceMin - vec3(50);
+    const vec3 top_sliced = vec3(100)*box_max - vec3(50);
+    const vec3 bottom_sliced = vec3(100)*box_min - vec3(50);
     if (!ray_box_intersection(ray_origin_model, ray_direction_model, bottom_sliced, top_sliced, t_0, t_1))
         return; // No ray intersection with sliced box, nothing to render
 
@@ -45,18 +51,48 @@ void MAIN()
     vec3 step_vector = stepLength * ray / ray_length;
 
     vec3 position = ray_start;
+    float previous_val = textureLod(volume, position, 0).r; // Front of the first segment
 
     // Ray march until reaching the end of the volume, or color saturation
     while (ray_length > 0) {
         ray_length -= stepLength;
         position += step_vector;
 
-        float val = textureLod(volume, position, 0).r;
-        if (val == 0 || val < tMin || val > tMax)
-            continue;
+        // The density is in r, overlay stores are packed into g, b and a.
+        const vec4 voxel = textureLod(volume, position, 0);
+        const float val = voxel.r;
+        const vec3 overlay = vec3(overlayChannels > 0 ? voxel.g : 0.0,
+                                  overlayChannels > 1 ? voxel.b : 0.0,
+                                  overlayChannels > 2 ? voxel.a : 0.0);
+        const float overlayVal = max(overlay.r, max(overlay.g, overlay.b));
+        vec4 val_color;
+        if (preintegrated) {
+            // One lookup integrates every density between the previous sample and this one
+            val_color = textureLod(transferTable, vec2(previous_val, val) * (255.0 / 256.0) + 0.5 / 256.0, 0);
+            previous_val = val;
+            if (val_color.a == 0 && overlayVal == 0)
+                continue;
+            if (overlayVal > 0)
+                val_color.a = max(val_color.a, (multipliedAlpha ? overlayVal : 1.0) * stepAlpha);
+        } else {
+            if ((val == 0 || val < tMin || val > tMax) && overlayVal == 0)
+                continue;
 
-        const float alpha = multipliedAlpha ? val * stepAlpha : stepAlpha;
-        vec4 val_color = vec4(textureLod(colormap, vec2(val, 0.5), 0).rgb, alpha);
+            const float alpha = multipliedAlpha ? max(val, overlayVal) * stepAlpha : stepAlpha;
+            val_color = vec4(textureLod(colormap, vec2(val, 0.5), 0).rgb, alpha);
+        }
+        // Diffuse shading from the precomputed gradients, lit from the camera
+        if (shaded) {
+            const vec4 gradient_voxel = textureLod(gradient, position, 0);
+            if (gradient_voxel.a > 0) {
+                const vec3 normal = normalize(gradient_voxel.rgb * 2.0 - 1.0);
+                const float diffuse = abs(dot(normal, normalize(ray_direction_model)));
+                val_color.rgb *= mix(1.0, diffuse, shadingStrength * gradient_voxel.a);
+            }
+        }
+        // Tint each overlay channel with a fixed colour: red, green and blue.
+        if (overlayVal > 0)
+            val_color.rgb = mix(val_color.rgb, overlay / overlayVal, overlayOpacity * overlayVal);
         // Opacity correction
         val_color.a = 1.0 - pow(max(0.0, 1.0 - val_color.a), 1.0);
         FRAGCOLOR.rgb += (1.0 - FRAGCOLOR.a) * val_color.a * val_color.rgb;
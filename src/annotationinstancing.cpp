@@ -0,0 +1,186 @@
+#include <src/annotationinstancing.h>
+
+#include <limits>
+
+AnnotationInstancing::AnnotationInstancing(QQuick3DObject *parent)
+    : QQuick3DInstancing(parent)
+    , m_cullMin(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max())
+    , m_cullMax(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max())
+{
+}
+
+int AnnotationInstancing::count() const
+{
+    return int(m_markers.size());
+}
+
+QColor AnnotationInstancing::color() const
+{
+    return m_color;
+}
+
+void AnnotationInstancing::setColor(const QColor &newColor)
+{
+    if (m_color == newColor)
+        return;
+    m_color = newColor;
+    markRangeDirty(0, m_markers.size());
+    emit colorChanged();
+}
+
+QVector3D AnnotationInstancing::cullMin() const
+{
+    return m_cullMin;
+}
+
+void AnnotationInstancing::setCullMin(const QVector3D &newCullMin)
+{
+    setCullBox(newCullMin, m_cullMax);
+}
+
+QVector3D AnnotationInstancing::cullMax() const
+{
+    return m_cullMax;
+}
+
+void AnnotationInstancing::setCullMax(const QVector3D &newCullMax)
+{
+    setCullBox(m_cullMin, newCullMax);
+}
+
+void AnnotationInstancing::setCullBox(const QVector3D &newCullMin, const QVector3D &newCullMax)
+{
+    if (m_cullMin == newCullMin && m_cullMax == newCullMax)
+        return;
+
+    // Only markers that cross the edge of the box change.
+    qsizetype begin = m_markers.size();
+    qsizetype end = 0;
+    for (qsizetype i = 0; i < m_markers.size(); i++) {
+        const QVector3D &position = m_markers[i].position;
+        if (isInside(position, m_cullMin, m_cullMax) != isInside(position, newCullMin, newCullMax)) {
+            begin = qMin(begin, i);
+            end = i + 1;
+        }
+    }
+    m_cullMin = newCullMin;
+    m_cullMax = newCullMax;
+    markRangeDirty(begin, end);
+    emit cullBoxChanged();
+}
+
+int AnnotationInstancing::add(const QVector3D &position, const QVector3D &scale, const QVector3D &eulerRotation)
+{
+    m_markers.append({ position, scale, eulerRotation });
+    markRangeDirty(m_markers.size() - 1, m_markers.size());
+    emit countChanged();
+    return int(m_markers.size() - 1);
+}
+
+void AnnotationInstancing::remove(int index)
+{
+    if (index < 0 || index >= m_markers.size())
+        return;
+    m_markers.remove(index);
+    markRangeDirty(index, m_markers.size());
+    emit countChanged();
+}
+
+void AnnotationInstancing::clear()
+{
+    if (m_markers.isEmpty())
+        return;
+    m_markers.clear();
+    markRangeDirty(0, 0);
+    emit countChanged();
+}
+
+QVector3D AnnotationInstancing::position(int index) const
+{
+    return m_markers.value(index).position;
+}
+
+void AnnotationInstancing::setPosition(int index, const QVector3D &position)
+{
+    if (index < 0 || index >= m_markers.size() || m_markers[index].position == position)
+        return;
+    m_markers[index].position = position;
+    markRangeDirty(index, index + 1);
+}
+
+QVector3D AnnotationInstancing::scale(int index) const
+{
+    return m_markers.value(index).scale;
+}
+
+void AnnotationInstancing::setScale(int index, const QVector3D &scale)
+{
+    if (index < 0 || index >= m_markers.size() || m_markers[index].scale == scale)
+        return;
+    m_markers[index].scale = scale;
+    markRangeDirty(index, index + 1);
+}
+
+QVector3D AnnotationInstancing::eulerRotation(int index) const
+{
+    return m_markers.value(index).eulerRotation;
+}
+
+void AnnotationInstancing::setEulerRotation(int index, const QVector3D &eulerRotation)
+{
+    if (index < 0 || index >= m_markers.size() || m_markers[index].eulerRotation == eulerRotation)
+        return;
+    m_markers[index].eulerRotation = eulerRotation;
+    markRangeDirty(index, index + 1);
+}
+
+bool AnnotationInstancing::isInside(const QVector3D &position, const QVector3D &min, const QVector3D &max) const
+{
+    return position.x() >= min.x() && position.y() >= min.y() && position.z() >= min.z()
+            && position.x() <= max.x() && position.y() <= max.y() && position.z() <= max.z();
+}
+
+void AnnotationInstancing::markRangeDirty(qsizetype begin, qsizetype end)
+{
+    if (m_dirtyBegin < m_dirtyEnd) {
+        begin = qMin(begin, m_dirtyBegin);
+        end = qMax(end, m_dirtyEnd);
+    }
+    m_dirtyBegin = begin;
+    m_dirtyEnd = end;
+    markDirty(); // Also needed when only the count shrinks.
+}
+
+QByteArray AnnotationInstancing::getInstanceBuffer(int *instanceCount)
+{
+    constexpr qsizetype kEntrySize = sizeof(InstanceTableEntry);
+
+    // Update the spare table, which the renderer let go of with the previous
+    // request, so data() does not detach. It missed the entries changed since
+    // it was last handed out, the others are kept as they are.
+    qsizetype begin = m_dirtyBegin;
+    qsizetype end = m_dirtyEnd;
+    if (m_staleBegin < m_staleEnd) {
+        begin = begin < end ? qMin(begin, m_staleBegin) : m_staleBegin;
+        end = qMax(end, m_staleEnd);
+    }
+
+    QByteArray &buffer = m_buffers[1 - m_current];
+    buffer.resize(m_markers.size() * kEntrySize);
+    auto entries = reinterpret_cast<InstanceTableEntry *>(buffer.data());
+    const QVector3D culled(0, 0, 0);
+    for (qsizetype i = begin; i < qMin(end, m_markers.size()); i++) {
+        const Marker &marker = m_markers[i];
+        const bool inside = isInside(marker.position, m_cullMin, m_cullMax);
+        entries[i] = calculateTableEntry(marker.position, inside ? marker.scale : culled, marker.eulerRotation, m_color);
+    }
+    m_staleBegin = m_dirtyBegin;
+    m_staleEnd = m_dirtyEnd;
+    m_dirtyBegin = 0;
+    m_dirtyEnd = 0;
+    m_current = 1 - m_current;
+
+    if (instanceCount)
+        *instanceCount = int(m_markers.size());
+    return buffer;
+}
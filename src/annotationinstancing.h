@@ -0,0 +1,85 @@
+#ifndef ANNOTATIONINSTANCING_H
+#define ANNOTATIONINSTANCING_H
+
+#include <QColor>
+#include <QQuick3DInstancing>
+#include <QVector3D>
+
+// Markers drawn as instances of one geometry, all in a single instance
+// table. Adding, moving or removing markers rewrites only the range of
+// entries that changed. Markers outside the cull box are written with zero
+// scale, so they cost no fragments.
+class AnnotationInstancing : public QQuick3DInstancing
+{
+    Q_OBJECT
+    QML_ELEMENT
+    Q_PROPERTY(int count READ count NOTIFY countChanged FINAL)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged FINAL)
+    Q_PROPERTY(QVector3D cullMin READ cullMin WRITE setCullMin NOTIFY cullBoxChanged FINAL)
+    Q_PROPERTY(QVector3D cullMax READ cullMax WRITE setCullMax NOTIFY cullBoxChanged FINAL)
+
+public:
+    explicit AnnotationInstancing(QQuick3DObject *parent = nullptr);
+
+    int count() const;
+
+    QColor color() const;
+    void setColor(const QColor &newColor);
+
+    // Markers are only drawn inside this box, in the coordinates of the model.
+    QVector3D cullMin() const;
+    void setCullMin(const QVector3D &newCullMin);
+    QVector3D cullMax() const;
+    void setCullMax(const QVector3D &newCullMax);
+
+    // Returns the index of the new marker, the last one.
+    Q_INVOKABLE int add(const QVector3D &position, const QVector3D &scale = QVector3D(1, 1, 1), const QVector3D &eulerRotation = QVector3D());
+    // Markers after `index` move down by one, like rows of a table.
+    Q_INVOKABLE void remove(int index);
+    Q_INVOKABLE void clear();
+
+    Q_INVOKABLE QVector3D position(int index) const;
+    Q_INVOKABLE void setPosition(int index, const QVector3D &position);
+    Q_INVOKABLE QVector3D scale(int index) const;
+    Q_INVOKABLE void setScale(int index, const QVector3D &scale);
+    Q_INVOKABLE QVector3D eulerRotation(int index) const;
+    Q_INVOKABLE void setEulerRotation(int index, const QVector3D &eulerRotation);
+
+signals:
+    void countChanged();
+    void colorChanged();
+    void cullBoxChanged();
+
+protected:
+    QByteArray getInstanceBuffer(int *instanceCount) override;
+
+private:
+    struct Marker
+    {
+        QVector3D position;
+        QVector3D scale;
+        QVector3D eulerRotation;
+    };
+
+    bool isInside(const QVector3D &position, const QVector3D &min, const QVector3D &max) const;
+    // Entries [begin, end) are rewritten on the next buffer request.
+    void markRangeDirty(qsizetype begin, qsizetype end);
+    void setCullBox(const QVector3D &newCullMin, const QVector3D &newCullMax);
+
+    QList<Marker> m_markers;
+    QColor m_color = Qt::cyan;
+    QVector3D m_cullMin;
+    QVector3D m_cullMax;
+
+    // Two instance tables, one entry per marker, handed out in turn. The last
+    // one handed out is shared with the renderer, writing to it would copy it.
+    QByteArray m_buffers[2];
+    int m_current = 0;
+    qsizetype m_dirtyBegin = 0;
+    qsizetype m_dirtyEnd = 0;
+    // Entries the spare table missed while the other one was handed out.
+    qsizetype m_staleBegin = 0;
+    qsizetype m_staleEnd = 0;
+};
+
+#endif // ANNOTATIONINSTANCING_H
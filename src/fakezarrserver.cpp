@@ -0,0 +1,339 @@
+#include <src/fakezarrserver.h>
+
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <blosc2.h>
+
+static constexpr int kPumpIntervalMs = 10;
+
+// Rings around the z axis like the wraps of a scroll, with a little noise
+// so chunks do not compress better than real ones.
+static float syntheticValue(qsizetype z, qsizetype y, qsizetype x, qsizetype height, qsizetype width)
+{
+    const float radius = std::hypot(x - width / 2.0f, y - height / 2.0f);
+    const float ring = 0.5f + 0.4f * std::sin(radius * 0.35f + z * 0.02f);
+    const quint32 hash = quint32(x * 73856093u) ^ quint32(y * 19349663u) ^ quint32(z * 83492791u);
+    const float noise = ((hash >> 8) & 0xff) / 255.0f - 0.5f;
+    return qBound(0.0f, ring + 0.05f * noise, 1.0f);
+}
+
+template<typename T>
+static T fromUnit(float value)
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return T(value);
+    else
+        return T(value * std::numeric_limits<T>::max() + 0.5f);
+}
+
+template<typename T>
+static QByteArray generateChunk(const FakeZarrServer::Array &array, int chunkZ, int chunkY, int chunkX)
+{
+    const auto [depth, height, width] = array.chunks;
+    const auto [shapeDepth, shapeHeight, shapeWidth] = array.shape;
+    Q_UNUSED(shapeDepth);
+    QByteArray chunk(qsizetype(depth) * height * width * sizeof(T), Qt::Uninitialized);
+    T *values = reinterpret_cast<T *>(chunk.data());
+    for (qsizetype z = 0; z < depth; z++) {
+        for (qsizetype y = 0; y < height; y++) {
+            for (qsizetype x = 0; x < width; x++) {
+                qsizetype index = x + width * (y + height * z);
+                if (array.order == "F")
+                    index = z + depth * (y + height * x);
+                else if (array.order == "yxz")
+                    index = z + depth * (x + width * y);
+                values[index] = fromUnit<T>(syntheticValue(qsizetype(chunkZ) * depth + z, qsizetype(chunkY) * height + y,
+                                                           qsizetype(chunkX) * width + x, shapeHeight, shapeWidth));
+            }
+        }
+    }
+    return chunk;
+}
+
+static QByteArray compressChunk(const QByteArray &chunk, int typeSize)
+{
+    blosc2_cparams cparams = BLOSC2_CPARAMS_DEFAULTS;
+    cparams.compcode = BLOSC_LZ4;
+    cparams.clevel = 5;
+    cparams.typesize = typeSize;
+    cparams.nthreads = 1;
+    blosc2_context *context = blosc2_create_cctx(cparams);
+    QByteArray compressed(chunk.size() + BLOSC2_MAX_OVERHEAD, Qt::Uninitialized);
+    const int size = blosc2_compress_ctx(context, chunk.constData(), chunk.size(), compressed.data(), compressed.size());
+    blosc2_free_ctx(context);
+    if (size <= 0) {
+        qWarning() << "Blosc2 compression error. Error code:" << size;
+        return QByteArray(); // Empty.
+    }
+    compressed.truncate(size);
+    return compressed;
+}
+
+static QByteArray statusText(int status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 404: return "Not Found";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+FakeZarrServer::FakeZarrServer(QObject *parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+    , m_pumpTimer(this)
+{
+    connect(m_server, &QTcpServer::newConnection, this, &FakeZarrServer::handleConnection);
+    connect(&m_pumpTimer, &QTimer::timeout, this, &FakeZarrServer::pump);
+    m_pumpTimer.setInterval(kPumpIntervalMs);
+    m_pumpTimer.setTimerType(Qt::PreciseTimer);
+}
+
+FakeZarrServer::~FakeZarrServer()
+{
+}
+
+void FakeZarrServer::addArray(const Array &array)
+{
+    const bool compressed = array.compressed;
+    const QJsonObject compressor {
+        { "id", "blosc" },
+        { "cname", "lz4" },
+        { "clevel", 5 },
+        { "shuffle", 1 },
+        { "blocksize", 0 },
+    };
+    const auto [depth, height, width] = array.shape;
+    const auto [chunkDepth, chunkHeight, chunkWidth] = array.chunks;
+    const QJsonObject metadata {
+        { "zarr_format", 2 },
+        { "shape", QJsonArray { depth, height, width } },
+        { "chunks", QJsonArray { chunkDepth, chunkHeight, chunkWidth } },
+        { "dtype", array.dtype },
+        { "order", array.order == "F" ? "F" : "C" }, // "yxz" is the viewer's, not the spec's.
+        { "fill_value", 0 },
+        { "filters", QJsonValue::Null },
+        { "dimension_separator", "." },
+        { "compressor", compressed ? QJsonValue(compressor) : QJsonValue::Null },
+    };
+
+    Store store;
+    store.metadata = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+
+    StorageZarr zarr(url(array));
+    zarr.setMetadata(store.metadata);
+    zarr.setOrder(array.order);
+
+    const int chunksZ = (depth + chunkDepth - 1) / chunkDepth;
+    const int chunksY = (height + chunkHeight - 1) / chunkHeight;
+    const int chunksX = (width + chunkWidth - 1) / chunkWidth;
+    std::vector<QByteArray> chunks(qsizetype(chunksZ) * chunksY * chunksX);
+    visitDataType(zarr.getDataTypeName(), [&](auto value) {
+        using T = decltype(value);
+#pragma omp parallel for schedule(dynamic)
+        for (qsizetype i = 0; i < qsizetype(chunks.size()); i++) {
+            const int z = i / (chunksY * chunksX);
+            const int y = i / chunksX % chunksY;
+            const int x = i % chunksX;
+            const QByteArray chunk = generateChunk<T>(array, z, y, x);
+            chunks[i] = compressed ? compressChunk(chunk, sizeof(T)) : chunk;
+        }
+    });
+
+    qint64 storedBytes = 0;
+    for (qsizetype i = 0; i < qsizetype(chunks.size()); i++) {
+        const int z = i / (chunksY * chunksX);
+        const int y = i / chunksX % chunksY;
+        const int x = i % chunksX;
+        // Keys as the loader builds them, "yxz" stores swap the coordinates.
+        const QString key = zarr.getChunkUrl(-1, z, y, x).fileName();
+        store.chunks.insert(key, chunks[i]);
+        storedBytes += chunks[i].size();
+    }
+    m_stores.insert(array.name + ".zarr", store);
+    qDebug() << "Fake Zarr store" << array.name << ":" << chunks.size() << "chunks," << storedBytes / 1024 << "KiB";
+}
+
+void FakeZarrServer::setConditions(const Conditions &conditions)
+{
+    m_conditions = conditions;
+    m_random.seed(conditions.seed);
+    m_chunkRequests.clear();
+}
+
+bool FakeZarrServer::listen()
+{
+    if (!m_server->listen(QHostAddress::LocalHost)) {
+        qWarning() << "Fake Zarr server could not listen:" << m_server->errorString();
+        return false;
+    }
+    m_port = m_server->serverPort();
+    return true;
+}
+
+QUrl FakeZarrServer::url(const Array &array, const QString &prefix) const
+{
+    QUrl url;
+    url.setScheme("http");
+    url.setHost("127.0.0.1");
+    url.setPort(m_port);
+    url.setPath(QString("%1/%2.zarr").arg(prefix.isEmpty() ? QString() : "/" + prefix, array.name));
+    return url;
+}
+
+void FakeZarrServer::handleConnection()
+{
+    while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+        m_connections.insert(socket, Connection());
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket] { handleRequest(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket] {
+            m_connections.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+void FakeZarrServer::handleRequest(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end())
+        return;
+    it->request += socket->readAll();
+    if (it->busy)
+        return; // Handled once the reply in flight is written.
+    const qsizetype headerEnd = it->request.indexOf("\r\n\r\n");
+    if (headerEnd < 0)
+        return; // Wait for the rest of the header.
+    const QByteArray header = it->request.left(headerEnd);
+    it->request.remove(0, headerEnd + 4); // GET requests have no body.
+    it->busy = true;
+    m_requestCount++;
+
+    const QList<QByteArray> lines = header.split('\n');
+    const QString path = QUrl::fromPercentEncoding(lines.value(0).split(' ').value(1));
+    qint64 begin = -1;
+    qint64 end = -1;
+    for (const QByteArray &line : lines) {
+        if (!line.toLower().startsWith("range:"))
+            continue;
+        // "Range: bytes=begin-end", the end is inclusive and may be left out.
+        const QList<QByteArray> range = line.mid(line.indexOf('=') + 1).trimmed().split('-');
+        begin = range.value(0).toLongLong();
+        end = range.value(1).isEmpty() ? -1 : range.value(1).toLongLong();
+    }
+
+    int status = 404;
+    QByteArray body;
+    int latencyMs = m_conditions.latencyMs;
+    const QStringList parts = path.split('/', Qt::SkipEmptyParts);
+    for (qsizetype i = 0; i < parts.size(); i++) {
+        auto store = m_stores.constFind(parts[i]);
+        if (store == m_stores.constEnd())
+            continue;
+        const QString key = parts.mid(i + 1).join('/');
+        if (key == ".zarray") {
+            status = 200;
+            body = store->metadata;
+        } else if (auto chunk = store->chunks.constFind(key); chunk != store->chunks.constEnd()) {
+            // Counted by path, so a chunk under a new prefix starts over.
+            const int request = m_chunkRequests[path]++;
+            if (request < m_conditions.stalledRequests)
+                return; // Busy until the client gives up and disconnects.
+            if (request < m_conditions.slowRequests)
+                latencyMs += m_conditions.slowLatencyMs;
+            if (m_random.generateDouble() < m_conditions.errorRate) {
+                status = 503;
+                m_failedCount++;
+            } else {
+                status = 200;
+                body = chunk.value();
+            }
+        }
+        break;
+    }
+
+    QTimer::singleShot(latencyMs, socket, [this, socket, status, body, begin, end] {
+        reply(socket, status, body, begin, end);
+    });
+}
+
+void FakeZarrServer::reply(QTcpSocket *socket, int status, const QByteArray &body, qint64 begin, qint64 end)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end())
+        return;
+
+    QByteArray content = body;
+    QByteArray contentRange;
+    if (status == 200 && begin >= 0 && begin < body.size()) {
+        end = end < 0 ? body.size() - 1 : qMin(end, qint64(body.size()) - 1);
+        status = 206;
+        content = body.mid(begin, end - begin + 1);
+        contentRange = "Content-Range: bytes " + QByteArray::number(begin) + '-' + QByteArray::number(end) + '/'
+                + QByteArray::number(body.size()) + "\r\n";
+    }
+
+    it->reply = "HTTP/1.1 " + QByteArray::number(status) + ' ' + statusText(status) + "\r\n"
+            + "Content-Type: application/octet-stream\r\n"
+            + "Content-Length: " + QByteArray::number(content.size()) + "\r\n"
+            + contentRange
+            + "Connection: keep-alive\r\n\r\n"
+            + content;
+
+    if (m_conditions.bytesPerSecond <= 0) {
+        socket->write(it->reply);
+        it->reply.clear();
+        finishReply(socket);
+    } else if (!m_pumpTimer.isActive()) {
+        m_pumped.start();
+        m_pumpTimer.start();
+    }
+}
+
+void FakeZarrServer::finishReply(QTcpSocket *socket)
+{
+    auto it = m_connections.find(socket);
+    if (it == m_connections.end())
+        return;
+    it->busy = false;
+    if (!it->request.isEmpty())
+        handleRequest(socket); // The client sent the next request early.
+}
+
+// Hand out the bandwidth since the last call evenly among the replies being written.
+void FakeZarrServer::pump()
+{
+    QList<QTcpSocket *> sending;
+    for (auto it = m_connections.cbegin(); it != m_connections.cend(); ++it) {
+        if (!it->reply.isEmpty())
+            sending.append(it.key());
+    }
+    if (sending.isEmpty()) {
+        m_pumpTimer.stop();
+        return;
+    }
+
+    const qint64 budget = m_conditions.bytesPerSecond * m_pumped.nsecsElapsed() / 1000000000;
+    m_pumped.restart();
+    const qint64 share = qMax<qint64>(1, budget / sending.size());
+    for (QTcpSocket *socket : sending) {
+        QByteArray &pending = m_connections[socket].reply;
+        const qint64 bytes = qMin<qint64>(share, pending.size());
+        socket->write(pending.constData(), bytes);
+        pending.remove(0, bytes);
+        if (pending.isEmpty())
+            finishReply(socket);
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef FAKEZARRSERVER_H
+#define FAKEZARRSERVER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QRandomGenerator>
+#include <QTimer>
+#include <QUrl>
+
+#include <atomic>
+
+#include <src/storagezarr.h>
+
+class QTcpServer;
+class QTcpSocket;
+
+// Zarr v2 stores served over HTTP from memory, to measure loads without
+// network access. The arrays hold synthetic data and their chunks are
+// compressed up front. Replies can be delayed, throttled, failed and stalled
+// like those of a remote store.
+class FakeZarrServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Array
+    {
+        QString name; // Served as "<name>.zarr".
+        triplet<int> shape; // z, y, x
+        triplet<int> chunks; // z, y, x
+        QString dtype = "|u1";
+        QString order = "C"; // "C", "F" or "yxz".
+        bool compressed = true; // Blosc with LZ4, otherwise raw chunks.
+    };
+
+    struct Conditions
+    {
+        int latencyMs = 0; // Added before every reply.
+        qint64 bytesPerSecond = 0; // Shared by all replies, 0 is unlimited.
+        qreal errorRate = 0; // Fraction of chunk requests answered with 503.
+        int stalledRequests = 0; // The first requests for every chunk are never answered.
+        int slowRequests = 0; // The first requests for every chunk wait slowLatencyMs more.
+        int slowLatencyMs = 0;
+        quint32 seed = 1;
+    };
+
+    explicit FakeZarrServer(QObject *parent = nullptr);
+    ~FakeZarrServer();
+
+    void addArray(const Array &array);
+    void setConditions(const Conditions &conditions);
+
+    // Listen on a free port of the loopback interface. Call from the thread
+    // the server lives in.
+    bool listen();
+
+    // A store is found under any path prefix, so every load can use a URL
+    // that no session has cached yet.
+    QUrl url(const Array &array, const QString &prefix = QString()) const;
+
+    qint64 requestCount() const { return m_requestCount; }
+    qint64 failedCount() const { return m_failedCount; }
+
+private:
+    struct Store
+    {
+        QByteArray metadata;
+        QHash<QString, QByteArray> chunks; // By chunk key.
+    };
+
+    struct Connection
+    {
+        QByteArray request; // Received bytes not handled yet.
+        QByteArray reply; // Bytes not written yet.
+        bool busy = false; // A reply is delayed or being written.
+    };
+
+    void handleConnection();
+    void handleRequest(QTcpSocket *socket);
+    void reply(QTcpSocket *socket, int status, const QByteArray &body, qint64 begin = -1, qint64 end = -1);
+    void finishReply(QTcpSocket *socket);
+    void pump();
+
+    QTcpServer *m_server;
+    quint16 m_port = 0;
+    QHash<QString, Store> m_stores; // By store name, "<name>.zarr".
+    QHash<QTcpSocket *, Connection> m_connections;
+
+    Conditions m_conditions;
+    QRandomGenerator m_random;
+    QHash<QString, int> m_chunkRequests; // By path, since the conditions were set.
+    QTimer m_pumpTimer;
+    QElapsedTimer m_pumped; // Time since bandwidth was last handed out.
+
+    std::atomic<qint64> m_requestCount = 0; // Read from other threads.
+    std::atomic<qint64> m_failedCount = 0;
+};
+
+#endif // FAKEZARRSERVER_H
@@ -8,6 +8,9 @@
 
 LineBoxGeometry::LineBoxGeometry()
 {
+    setStride(sizeof(QVector3D));
+    setPrimitiveType(QQuick3DGeometry::PrimitiveType::Lines);
+    addAttribute(QQuick3DGeometry::Attribute::PositionSemantic, 0, QQuick3DGeometry::Attribute::F32Type);
     updateData();
 }
 
@@ -15,8 +18,11 @@ void LineBoxGeometry::updateData()
 {
     constexpr int kStride = sizeof(QVector3D);
 
-    QByteArray vertexData(24 * kStride, Qt::Initialization::Uninitialized);
-    QVector3D* p = reinterpret_cast<QVector3D*>(vertexData.data());
+    // The vertex count is fixed. The geometry shares the buffer it was given,
+    // so writing to it copies it first, which is cheap at 24 vertices.
+    if (m_vertexData.size() != 24 * kStride)
+        m_vertexData.resize(24 * kStride);
+    QVector3D* p = reinterpret_cast<QVector3D*>(m_vertexData.data());
 
     std::array<QVector3D, 8> pts;
     pts[0] = QVector3D(-m_size, -m_size, -m_size);
@@ -79,17 +85,14 @@ void LineBoxGeometry::updateData()
     *p = pts[7];
     p++;
 
-    setVertexData(vertexData);
-    setStride(kStride);
+    setVertexData(m_vertexData);
     setBounds(QVector3D(-m_size, -m_size, -m_size), QVector3D(+m_size, +m_size, +m_size));
-
-    setPrimitiveType(QQuick3DGeometry::PrimitiveType::Lines);
-
-    addAttribute(QQuick3DGeometry::Attribute::PositionSemantic, 0, QQuick3DGeometry::Attribute::F32Type);
 }
 
 void LineBoxGeometry::setSize(float size)
 {
+    if (m_size == size)
+        return;
     m_size = size;
     updateData();
     update();
@@ -25,6 +25,7 @@ private:
     void updateData();
 
     float m_size = 1.0;
+    QByteArray m_vertexData;
 };
 
 #endif
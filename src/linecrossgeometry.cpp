@@ -6,6 +6,9 @@
 
 LineCrossGeometry::LineCrossGeometry()
 {
+    setStride(sizeof(QVector3D));
+    setPrimitiveType(QQuick3DGeometry::PrimitiveType::Lines);
+    addAttribute(QQuick3DGeometry::Attribute::PositionSemantic, 0, QQuick3DGeometry::Attribute::F32Type);
     updateData();
 }
 
@@ -13,8 +16,11 @@ void LineCrossGeometry::updateData()
 {
     constexpr int kStride = sizeof(QVector3D);
 
-    QByteArray vertexData(6 * kStride, Qt::Initialization::Uninitialized);
-    QVector3D* p = reinterpret_cast<QVector3D*>(vertexData.data());
+    // The vertex count is fixed. The geometry shares the buffer it was given,
+    // so writing to it copies it first, which is cheap at 6 vertices.
+    if (m_vertexData.size() != 6 * kStride)
+        m_vertexData.resize(6 * kStride);
+    QVector3D* p = reinterpret_cast<QVector3D*>(m_vertexData.data());
 
     float halfSize = m_size / 2.0f;
 
@@ -38,17 +44,14 @@ void LineCrossGeometry::updateData()
     p++;
     *p = pts[5];
 
-    setVertexData(vertexData);
-    setStride(kStride);
+    setVertexData(m_vertexData);
     setBounds(QVector3D(-halfSize, -halfSize, -halfSize), QVector3D(halfSize, halfSize, halfSize));
-
-    setPrimitiveType(QQuick3DGeometry::PrimitiveType::Lines);
-
-    addAttribute(QQuick3DGeometry::Attribute::PositionSemantic, 0, QQuick3DGeometry::Attribute::F32Type);
 }
 
 void LineCrossGeometry::setSize(float size)
 {
+    if (m_size == size)
+        return;
     m_size = size;
     updateData();
     update();
@@ -57,6 +60,8 @@ void LineCrossGeometry::setSize(float size)
 
 void LineCrossGeometry::setCenter(QVector3D center)
 {
+    if (m_center == center)
+        return;
     m_center = center;
     updateData();
     update();
@@ -30,6 +30,7 @@ private:
 
     float m_size = 100.0;
     QVector3D m_center = QVector3D(0, 0, 0);
+    QByteArray m_vertexData;
 };
 
 #endif
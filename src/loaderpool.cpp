@@ -0,0 +1,126 @@
+#include <QThread>
+
+#include <src/loaderpool.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static std::atomic_int s_runningTasks = 0;
+
+// Run a task with its OpenMP teams capped to its share of the cores.
+static void runShared(const std::function<void()> &function)
+{
+#ifdef _OPENMP
+    const int previous = omp_get_max_threads(); // Of the thread running it, a waiting thread may run a task inline.
+    const int running = ++s_runningTasks;
+    omp_set_num_threads(qMax(1, QThread::idealThreadCount() / running));
+    function();
+    --s_runningTasks;
+    omp_set_num_threads(previous);
+#else
+    function();
+#endif
+}
+
+QThreadPool *LoaderPool::instance()
+{
+    static QThreadPool pool;
+    static const bool initialized = [] {
+        pool.setObjectName("LoaderPool");
+        pool.setMaxThreadCount(QThread::idealThreadCount());
+        pool.setExpiryTimeout(-1); // Never retire threads, loads come in bursts.
+        return true;
+    }();
+    Q_UNUSED(initialized);
+    return &pool;
+}
+
+void LoaderPool::start(Priority priority, std::function<void()> task)
+{
+    instance()->start(std::move(task), priority);
+}
+
+LoaderTaskGroup::LoaderTaskGroup(LoaderPool::Priority priority)
+    : m_state(std::make_shared<State>()), m_priority(priority)
+{
+}
+
+LoaderTaskGroup::~LoaderTaskGroup()
+{
+    wait();
+}
+
+void LoaderTaskGroup::run(std::function<void()> function)
+{
+    auto task = std::make_shared<Task>();
+    task->function = std::move(function);
+    {
+        QMutexLocker locker(&m_state->mutex);
+        m_state->pending++;
+        m_state->tasks.append(task);
+    }
+    LoaderPool::start(m_priority, [state = m_state, task] { runTask(state, task); });
+}
+
+void LoaderTaskGroup::wait()
+{
+    QList<std::shared_ptr<Task>> tasks;
+    {
+        QMutexLocker locker(&m_state->mutex);
+        tasks = m_state->tasks;
+    }
+
+    // Help out with the tasks that are still queued, then wait for the ones already running.
+    for (const auto &task : tasks)
+        runTask(m_state, task);
+
+    QMutexLocker locker(&m_state->mutex);
+    while (m_state->pending > 0)
+        m_state->finished.wait(&m_state->mutex);
+}
+
+bool LoaderTaskGroup::runOne()
+{
+    QList<std::shared_ptr<Task>> tasks;
+    {
+        QMutexLocker locker(&m_state->mutex);
+        tasks = m_state->tasks;
+    }
+    for (const auto &task : tasks) {
+        if (runTask(m_state, task))
+            return true;
+    }
+    return false;
+}
+
+void LoaderTaskGroup::cancel()
+{
+    QMutexLocker locker(&m_state->mutex);
+    const QList<std::shared_ptr<Task>> tasks = m_state->tasks;
+    for (const auto &task : tasks) {
+        if (task->claimed.exchange(true))
+            continue; // Running, it removes itself.
+        task->function = nullptr;
+        m_state->tasks.removeOne(task);
+        m_state->pending--;
+    }
+    while (m_state->pending > 0)
+        m_state->finished.wait(&m_state->mutex);
+}
+
+// Returns false when the task was already claimed by another thread.
+bool LoaderTaskGroup::runTask(const std::shared_ptr<State> &state, const std::shared_ptr<Task> &task)
+{
+    if (task->claimed.exchange(true))
+        return false; // Already run by the pool or a waiting thread.
+
+    runShared(task->function);
+    task->function = nullptr; // Release captures as soon as possible.
+
+    QMutexLocker locker(&state->mutex);
+    state->tasks.removeOne(task);
+    if (--state->pending == 0)
+        state->finished.wakeAll();
+    return true;
+}
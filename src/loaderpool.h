@@ -0,0 +1,74 @@
+#ifndef LOADERPOOL_H
+#define LOADERPOOL_H
+
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Process-wide thread pool that runs all volume loading work. It is created
+// once, sized to the machine and keeps its threads alive between loads.
+// OpenMP regions inside its tasks share the cores with the other tasks
+// running when they start, instead of each starting a team of every core.
+class LoaderPool
+{
+public:
+    // Queued tasks with a higher priority are started first.
+    enum Priority {
+        Prefetch = 0,
+        Refinement = 1,
+        Interactive = 2,
+    };
+
+    static QThreadPool *instance();
+    static void start(Priority priority, std::function<void()> task);
+};
+
+// A set of pool tasks that can be waited on. A thread waiting on the group
+// runs the tasks no pool thread has picked up yet instead of blocking, so
+// a pool task can split its work into a group and wait without starving
+// the pool.
+class LoaderTaskGroup
+{
+public:
+    explicit LoaderTaskGroup(LoaderPool::Priority priority = LoaderPool::Interactive);
+    ~LoaderTaskGroup();
+
+    LoaderTaskGroup(const LoaderTaskGroup &) = delete;
+    LoaderTaskGroup &operator=(const LoaderTaskGroup &) = delete;
+
+    void run(std::function<void()> task);
+    // Block until every task started so far has finished.
+    void wait();
+    // Run one task no thread has picked up yet on the calling thread. Returns
+    // false when there is none, it never waits on the running ones.
+    bool runOne();
+    // Drop the tasks no thread has picked up yet, and block until the
+    // running ones have finished.
+    void cancel();
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        std::atomic_bool claimed = false;
+    };
+    struct State
+    {
+        QMutex mutex;
+        QWaitCondition finished;
+        int pending = 0;
+        QList<std::shared_ptr<Task>> tasks;
+    };
+
+    static bool runTask(const std::shared_ptr<State> &state, const std::shared_ptr<Task> &task);
+
+    std::shared_ptr<State> m_state;
+    LoaderPool::Priority m_priority;
+};
+
+#endif // LOADERPOOL_H
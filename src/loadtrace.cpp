@@ -0,0 +1,207 @@
+#include <src/loadtrace.h>
+
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+static LoadTrace *s_instance = nullptr;
+static quint64 s_nextId = 1;
+
+static const char *const kResultNames[] = { "succeeded", "failed", "superseded" };
+
+static QJsonArray toJson(const QVector3D &vector)
+{
+    return { vector.x(), vector.y(), vector.z() };
+}
+
+static QVector3D vectorFromJson(const QJsonValue &value, const QVector3D &fallback)
+{
+    const QJsonArray array = value.toArray();
+    if (array.size() != 3)
+        return fallback;
+    return QVector3D(array[0].toDouble(), array[1].toDouble(), array[2].toDouble());
+}
+
+const char *LoadTrace::stageName(int stage)
+{
+    static const char *const names[StageCount] = { "metadata", "fetch", "decode", "reorder", "convert", "gradients" };
+    return stage >= 0 && stage < StageCount ? names[stage] : "";
+}
+
+LoadTrace::LoadTrace(const QString &path)
+    : m_file(path)
+{
+    m_started.start();
+}
+
+bool LoadTrace::open()
+{
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Could not write load trace:" << m_file.fileName() << m_file.errorString();
+        return false;
+    }
+    qDebug() << "Recording loads to:" << m_file.fileName();
+    return true;
+}
+
+LoadTrace *LoadTrace::instance()
+{
+    return s_instance;
+}
+
+void LoadTrace::setInstance(LoadTrace *trace)
+{
+    s_instance = trace;
+}
+
+quint64 LoadTrace::recordCall(Call call)
+{
+    call.id = s_nextId++;
+    call.timeMs = m_started.elapsed();
+    m_pending[call.id].started.start();
+    m_calls.append(call);
+
+    QJsonObject line {
+        { "call", call.overlaySources.isEmpty() ? "loadAsync" : "loadOverlayAsync" },
+        { "id", qint64(call.id) },
+        { "time", call.timeMs },
+        { "source", call.source.toString() },
+        { "width", qint64(call.width) },
+        { "height", qint64(call.height) },
+        { "depth", qint64(call.depth) },
+        { "dataType", call.dataType },
+        { "focus", toJson(call.globalFocusPoint) },
+        { "level", call.level },
+        { "order", call.order },
+        { "regionChunks", call.regionChunks },
+        { "voxelBudget", call.voxelBudget },
+        { "byteBudget", call.byteBudget },
+        { "maxTextureSide", call.maxTextureSide },
+        { "sliceMin", toJson(call.sliceMin) },
+        { "sliceMax", toJson(call.sliceMax) },
+        { "gradients", call.gradientsEnabled },
+    };
+    if (!call.overlaySources.isEmpty()) {
+        QJsonArray sources, levels, orders;
+        for (const QUrl &source : std::as_const(call.overlaySources))
+            sources.append(source.toString());
+        for (int level : std::as_const(call.overlayLevels))
+            levels.append(level);
+        for (const QString &order : std::as_const(call.overlayOrders))
+            orders.append(order);
+        line.insert("overlaySources", sources);
+        line.insert("overlayLevels", levels);
+        line.insert("overlayOrders", orders);
+    }
+    write(line);
+    return call.id;
+}
+
+void LoadTrace::recordProgress(quint64 id)
+{
+    auto pending = m_pending.find(id);
+    if (pending != m_pending.end() && pending->firstImageMs < 0)
+        pending->firstImageMs = pending->started.elapsed();
+}
+
+void LoadTrace::recordOutcome(quint64 id, Result result, const Stages &stages)
+{
+    auto pending = m_pending.find(id);
+    if (pending == m_pending.end())
+        return; // Not a recorded call, or already ended.
+
+    Outcome outcome;
+    outcome.id = id;
+    outcome.result = result;
+    outcome.completeMs = pending->started.elapsed();
+    outcome.firstImageMs = pending->firstImageMs;
+    outcome.stages = stages;
+    m_pending.erase(pending);
+    m_outcomes.append(outcome);
+
+    QJsonObject stageTimes;
+    for (int stage = 0; stage < StageCount; stage++)
+        stageTimes.insert(stageName(stage), stages[stage]);
+    write({
+        { "outcome", kResultNames[result] },
+        { "id", qint64(id) },
+        { "firstImage", outcome.firstImageMs },
+        { "complete", outcome.completeMs },
+        { "stages", stageTimes },
+    });
+}
+
+QList<LoadTrace::Call> LoadTrace::calls() const
+{
+    return m_calls;
+}
+
+QList<LoadTrace::Outcome> LoadTrace::outcomes() const
+{
+    return m_outcomes;
+}
+
+void LoadTrace::write(const QJsonObject &line)
+{
+    if (!m_file.isOpen())
+        return;
+    // A line at a time, so a trace of a session that crashed is still read.
+    m_file.write(QJsonDocument(line).toJson(QJsonDocument::Compact) + '\n');
+    m_file.flush();
+}
+
+bool LoadTrace::read(const QString &path, QList<Call> *calls, QList<Outcome> *outcomes)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Could not read load trace:" << path << file.errorString();
+        return false;
+    }
+
+    while (!file.atEnd()) {
+        const QJsonObject line = QJsonDocument::fromJson(file.readLine()).object();
+        if (line.contains("call")) {
+            Call call;
+            call.id = line["id"].toInteger();
+            call.timeMs = line["time"].toInteger();
+            call.source = QUrl(line["source"].toString());
+            call.width = line["width"].toInteger(-1);
+            call.height = line["height"].toInteger(-1);
+            call.depth = line["depth"].toInteger(-1);
+            call.dataType = line["dataType"].toString();
+            call.globalFocusPoint = vectorFromJson(line["focus"], QVector3D(0, 0, 0));
+            call.level = line["level"].toInt(-1);
+            call.order = line["order"].toString("C");
+            call.regionChunks = line["regionChunks"].toInt(1);
+            // Older traces lack the budgets and the side limit because their
+            // loads had none. 0, unlimited, replays them as they ran.
+            call.voxelBudget = line["voxelBudget"].toInteger();
+            call.byteBudget = line["byteBudget"].toInteger();
+            call.maxTextureSide = line["maxTextureSide"].toInt();
+            call.sliceMin = vectorFromJson(line["sliceMin"], QVector3D(0, 0, 0));
+            call.sliceMax = vectorFromJson(line["sliceMax"], QVector3D(1, 1, 1));
+            call.gradientsEnabled = line["gradients"].toBool();
+            for (const QJsonValue &source : line["overlaySources"].toArray())
+                call.overlaySources.append(QUrl(source.toString()));
+            for (const QJsonValue &level : line["overlayLevels"].toArray())
+                call.overlayLevels.append(level.toInt(-1));
+            for (const QJsonValue &order : line["overlayOrders"].toArray())
+                call.overlayOrders.append(order.toString("C"));
+            if (calls)
+                calls->append(call);
+        } else if (line.contains("outcome")) {
+            Outcome outcome;
+            outcome.id = line["id"].toInteger();
+            const QString result = line["outcome"].toString();
+            outcome.result = result == kResultNames[Succeeded] ? Succeeded : result == kResultNames[Superseded] ? Superseded : Failed;
+            outcome.firstImageMs = line["firstImage"].toInteger(-1);
+            outcome.completeMs = line["complete"].toInteger(-1);
+            const QJsonObject stageTimes = line["stages"].toObject();
+            for (int stage = 0; stage < StageCount; stage++)
+                outcome.stages[stage] = stageTimes[stageName(stage)].toInteger();
+            if (outcomes)
+                outcomes->append(outcome);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+#ifndef LOADTRACE_H
+#define LOADTRACE_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
+#include <QVector3D>
+
+#include <array>
+
+// Record of the loads VolumeTextureData is asked for: every loadAsync and
+// loadOverlayAsync call with its arguments and the time it was made, and
+// how each load ended, with the time to its first shown part, to its
+// result, and spent in each loader stage. Written as JSON lines, a call or
+// an outcome per line, when started with `volumeraycaster --record-trace
+// <file>`, and re-issued by TraceReplay.
+//
+// Used on the GUI thread only.
+class LoadTrace
+{
+public:
+    enum Stage { Metadata, Fetch, Decode, Reorder, Convert, Gradients, StageCount };
+    // Microseconds spent per stage. Stages that run per chunk overlap, their
+    // times are summed over the chunks.
+    using Stages = std::array<qint64, StageCount>;
+    static const char *stageName(int stage);
+
+    struct Call
+    {
+        quint64 id = 0;
+        qint64 timeMs = 0; // Since the trace started.
+        QUrl source;
+        qsizetype width = -1;
+        qsizetype height = -1;
+        qsizetype depth = -1;
+        QString dataType;
+        QVector3D globalFocusPoint;
+        int level = -1;
+        QString order = "C";
+        QList<QUrl> overlaySources; // Set for loadOverlayAsync calls.
+        QList<int> overlayLevels;
+        QStringList overlayOrders;
+        // Properties of the texture the load started with.
+        int regionChunks = 1;
+        qint64 voxelBudget = 0;
+        qint64 byteBudget = 0;
+        int maxTextureSide = 0;
+        QVector3D sliceMin = { 0, 0, 0 };
+        QVector3D sliceMax = { 1, 1, 1 };
+        bool gradientsEnabled = false;
+    };
+
+    enum Result { Succeeded, Failed, Superseded };
+
+    struct Outcome
+    {
+        quint64 id = 0;
+        Result result = Failed;
+        qint64 firstImageMs = -1; // Since the call, -1 when no part was shown before the result.
+        qint64 completeMs = -1;
+        Stages stages = {};
+    };
+
+    // Records to `path`, or in memory only when it is empty.
+    explicit LoadTrace(const QString &path = QString());
+
+    // Replaces the file. False when it cannot be written.
+    bool open();
+
+    // The trace loads are recorded to, null unless one is set.
+    static LoadTrace *instance();
+    static void setInstance(LoadTrace *trace);
+
+    // Returns the id the call's progress and outcome are recorded with,
+    // unique in the process, so loads that outlive a trace are not taken
+    // for calls of the next one.
+    quint64 recordCall(Call call);
+    void recordProgress(quint64 id);
+    void recordOutcome(quint64 id, Result result, const Stages &stages);
+
+    QList<Call> calls() const;
+    QList<Outcome> outcomes() const;
+
+    // Reads a recorded trace. Lines that are not understood are skipped.
+    static bool read(const QString &path, QList<Call> *calls, QList<Outcome> *outcomes);
+
+private:
+    struct Pending
+    {
+        QElapsedTimer started;
+        qint64 firstImageMs = -1;
+    };
+
+    void write(const QJsonObject &line);
+
+    QFile m_file;
+    QElapsedTimer m_started;
+    QHash<quint64, Pending> m_pending;
+    QList<Call> m_calls;
+    QList<Outcome> m_outcomes;
+};
+
+#endif // LOADTRACE_H
@@ -7,13 +7,41 @@
 #include <QtGui>
 #include <QtQuick3D/qquick3d.h>
 
+#include <src/loadtrace.h>
+#include <src/memorybudget.h>
+#include <src/scrolloverview.h>
+#include <src/tracereplay.h>
+
 int main(int argc, char *argv[])
 {
+    bool replay = false;
+    QString tracePath;
+    for (int i = 1; i < argc; i++) {
+        replay |= qstrcmp(argv[i], "--replay") == 0;
+        if (qstrcmp(argv[i], "--record-trace") == 0 && i + 1 < argc)
+            tracePath = QString::fromLocal8Bit(argv[i + 1]);
+    }
+    // Replays open no window and also run on machines without a display.
+    if (replay && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
     QGuiApplication app(argc, argv);
 
+    // Loader threads reserve memory, create the budget on the GUI thread first.
+    MemoryBudget::instance();
+
+    if (replay)
+        return TraceReplay::run(app.arguments());
+
+    // Records the loads of this session for TraceReplay, before QML starts the first.
+    LoadTrace trace(tracePath);
+    if (!tracePath.isEmpty() && trace.open())
+        LoadTrace::setInstance(&trace);
+
     QSurfaceFormat::setDefaultFormat(QQuick3D::idealSurfaceFormat());
 
     QQmlApplicationEngine engine;
+    engine.addImageProvider("overview", new OverviewImageProvider);
     QObject::connect(
             &engine, &QQmlApplicationEngine::objectCreationFailed, &app, []() { QCoreApplication::exit(-1); }, Qt::QueuedConnection);
     engine.loadFromModule("VolumetricExample", "Main");
@@ -0,0 +1,178 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMetaEnum>
+#include <QThread>
+
+#include <src/memorybudget.h>
+
+struct MemoryReservation::Data
+{
+    Data(MemoryBudget::Category category, qint64 bytes)
+        : category(category), bytes(bytes)
+    {
+    }
+    ~Data() { MemoryBudget::instance()->release(category, bytes); }
+
+    MemoryBudget::Category category;
+    qint64 bytes;
+};
+
+qint64 MemoryReservation::bytes() const
+{
+    return d ? d->bytes : 0;
+}
+
+MemoryBudget::MemoryBudget(QObject *parent)
+    : QObject(parent)
+{
+    constexpr qint64 kDefaultBudgetMiB = 4096;
+    bool ok = false;
+    const qint64 budgetMiB = qEnvironmentVariableIntValue("VOLUMERAYCASTER_MEMORY_BUDGET_MB", &ok);
+    m_budget = (ok && budgetMiB > 0 ? budgetMiB : kDefaultBudgetMiB) * 1024 * 1024;
+}
+
+MemoryBudget *MemoryBudget::instance()
+{
+    static MemoryBudget *budget = [] {
+        auto result = new MemoryBudget();
+        // The first reservation may come from a loader thread, signals belong to the GUI thread.
+        if (QCoreApplication::instance() && result->thread() != QCoreApplication::instance()->thread())
+            result->moveToThread(QCoreApplication::instance()->thread());
+        return result;
+    }();
+    return budget;
+}
+
+MemoryBudget *MemoryBudget::create(QQmlEngine *qmlEngine, QJSEngine *jsEngine)
+{
+    Q_UNUSED(qmlEngine);
+    Q_UNUSED(jsEngine);
+    MemoryBudget *budget = instance();
+    QJSEngine::setObjectOwnership(budget, QJSEngine::CppOwnership);
+    return budget;
+}
+
+qint64 MemoryBudget::budget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+void MemoryBudget::setBudget(qint64 newBudget)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_budget == newBudget)
+            return;
+        m_budget = newBudget;
+    }
+    evict(0);
+    emit budgetChanged();
+}
+
+qint64 MemoryBudget::used() const
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 total = 0;
+    for (qint64 bytes : m_used)
+        total += bytes;
+    return total;
+}
+
+qint64 MemoryBudget::used(Category category) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_used[category];
+}
+
+QVariantMap MemoryBudget::usage() const
+{
+    const QMetaEnum categories = QMetaEnum::fromType<Category>();
+    QVariantMap result;
+    QMutexLocker locker(&m_mutex);
+    for (int category = 0; category < CategoryCount; category++)
+        result.insert(QString::fromLatin1(categories.valueToKey(category)), m_used[category]);
+    return result;
+}
+
+MemoryReservation MemoryBudget::reserve(Category category, qint64 bytes, bool speculative)
+{
+    if (!speculative)
+        evict(bytes);
+
+    MemoryReservation reservation = account(category, bytes, true);
+    if (!reservation.isValid())
+        qWarning() << "Memory budget exceeded, refusing" << bytes << "bytes for" << category;
+    return reservation;
+}
+
+MemoryReservation MemoryBudget::track(Category category, qint64 bytes)
+{
+    evict(bytes);
+    return account(category, bytes, false);
+}
+
+int MemoryBudget::registerCache(std::function<qint64(qint64)> evict)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    const int id = m_nextCacheId++;
+    m_caches.insert(id, std::move(evict));
+    return id;
+}
+
+void MemoryBudget::unregisterCache(int id)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    m_caches.remove(id);
+}
+
+MemoryReservation MemoryBudget::account(Category category, qint64 bytes, bool limit)
+{
+    {
+        // Checked and added at once, so concurrent reservations cannot all fit.
+        QMutexLocker locker(&m_mutex);
+        if (limit) {
+            qint64 total = bytes;
+            for (qint64 used : m_used)
+                total += used;
+            if (total > m_budget)
+                return MemoryReservation(); // Invalid.
+        }
+        m_used[category] += bytes;
+    }
+    notifyUsage();
+
+    MemoryReservation reservation;
+    reservation.d = std::make_shared<MemoryReservation::Data>(category, bytes);
+    return reservation;
+}
+
+void MemoryBudget::release(Category category, qint64 bytes)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_used[category] -= bytes;
+    }
+    notifyUsage();
+}
+
+void MemoryBudget::notifyUsage()
+{
+    if (m_usageNotified.exchange(true))
+        return; // Already queued, it reports the latest usage.
+    QMetaObject::invokeMethod(this, [this] {
+        m_usageNotified = false;
+        emit usageChanged();
+    }, Qt::QueuedConnection);
+}
+
+void MemoryBudget::evict(qint64 bytes)
+{
+    QMutexLocker cacheLocker(&m_cacheMutex);
+    for (const auto &cache : std::as_const(m_caches)) {
+        const qint64 excess = used() + bytes - budget();
+        if (excess <= 0)
+            return;
+        cache(excess);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QMutex>
+#include <QObject>
+#include <QVariantMap>
+#include <QtQml/QQmlEngine>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Bytes accounted against the memory budget for as long as any copy of the
+// reservation is alive. Default constructed and refused reservations are invalid.
+class MemoryReservation
+{
+public:
+    MemoryReservation() = default;
+
+    bool isValid() const { return d != nullptr; }
+    qint64 bytes() const;
+
+private:
+    friend class MemoryBudget;
+    struct Data;
+    std::shared_ptr<Data> d;
+};
+
+// Central accounting of the memory held by the load path. Every allocation
+// site reserves its bytes here. When a reservation would exceed the budget,
+// registered caches are asked to evict, and the reservation is refused if
+// that is not enough.
+class MemoryBudget : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+    QML_SINGLETON
+
+    Q_PROPERTY(qint64 budget READ budget WRITE setBudget NOTIFY budgetChanged FINAL)
+    Q_PROPERTY(qint64 used READ used NOTIFY usageChanged FINAL)
+    Q_PROPERTY(QVariantMap usage READ usage NOTIFY usageChanged FINAL)
+
+public:
+    enum Category {
+        Network, // Compressed replies.
+        Decoded, // Decompressed chunks in the store's data type.
+        Converted, // uint8 volumes waiting for upload.
+        Texture, // Volumes handed to the texture.
+        Cache, // Anything kept around for reuse.
+        CategoryCount
+    };
+    Q_ENUM(Category)
+
+    static MemoryBudget *instance();
+    static MemoryBudget *create(QQmlEngine *qmlEngine, QJSEngine *jsEngine);
+
+    qint64 budget() const;
+    void setBudget(qint64 newBudget);
+
+    qint64 used() const;
+    qint64 used(Category category) const;
+    // Bytes used per category, keyed by category name.
+    QVariantMap usage() const;
+
+    // Reserve bytes, evicting caches to make room. Returns an invalid
+    // reservation when the budget cannot be met. Speculative work never
+    // evicts caches, it only runs in memory that is already free.
+    MemoryReservation reserve(Category category, qint64 bytes, bool speculative = false);
+    // Account for bytes that are already allocated and cannot be refused,
+    // evicting caches if that takes the usage over budget.
+    MemoryReservation track(Category category, qint64 bytes);
+
+    // Caches register a callback that frees up to the requested number of
+    // bytes and returns how many it freed.
+    int registerCache(std::function<qint64(qint64)> evict);
+    void unregisterCache(int id);
+
+signals:
+    void budgetChanged();
+    void usageChanged();
+
+private:
+    friend class MemoryReservation;
+
+    explicit MemoryBudget(QObject *parent = nullptr);
+
+    // Add the bytes, or refuse them when `limit` is set and they exceed the budget.
+    MemoryReservation account(Category category, qint64 bytes, bool limit);
+    void release(Category category, qint64 bytes);
+    // Emit usageChanged on the budget's thread, once for a burst of changes.
+    void notifyUsage();
+    // Ask caches to free bytes until usage plus `bytes` fits the budget.
+    void evict(qint64 bytes);
+
+    mutable QMutex m_mutex;
+    qint64 m_budget = 0;
+    std::array<qint64, CategoryCount> m_used = {};
+    QMutex m_cacheMutex; // Guards the cache list, never held together with m_mutex.
+    QHash<int, std::function<qint64(qint64)>> m_caches;
+    int m_nextCacheId = 0;
+    std::atomic_bool m_usageNotified = false;
+};
+
+#endif // MEMORYBUDGET_H
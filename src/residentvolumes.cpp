@@ -0,0 +1,143 @@
+#include <src/residentvolumes.h>
+
+MemoryReservation ResidentVolume::textureReservation()
+{
+    if (!texture.isValid())
+        texture = MemoryBudget::instance()->track(MemoryBudget::Texture, result.volumeData.size());
+    return texture;
+}
+
+ResidentVolumes *ResidentVolumes::instance()
+{
+    static ResidentVolumes volumes;
+    return &volumes;
+}
+
+static QFuture<ResidentVolumes::AsyncLoaderData> finished(const ResidentVolumes::AsyncLoaderData &result)
+{
+    QPromise<ResidentVolumes::AsyncLoaderData> promise;
+    promise.start();
+    promise.addResult(result);
+    promise.finish();
+    return promise.future();
+}
+
+static ResidentVolumes::AsyncLoaderData failed(const ResidentVolumes::AsyncLoaderData &input)
+{
+    auto result = input;
+    result.success = false;
+    return result;
+}
+
+QFuture<ResidentVolumes::AsyncLoaderData> ResidentVolumes::acquire(const QString &key, const AsyncLoaderData &input,
+                                                                  const std::function<AsyncLoaderData(const AsyncLoaderData &)> &load, bool refresh)
+{
+    std::shared_ptr<ResidentVolume> volume;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto it = m_volumes.begin(); it != m_volumes.end();) {
+            if (it->expired())
+                it = m_volumes.erase(it);
+            else
+                ++it;
+        }
+
+        volume = m_volumes.value(key).lock();
+        if (volume && volume->loading) {
+            // Another instance is loading it, pass its partial volumes on meanwhile.
+            auto promise = std::make_shared<QPromise<AsyncLoaderData>>();
+            promise->start();
+            volume->waiters.append({ input, promise });
+            return promise->future();
+        }
+        if (volume && !refresh && !volume->cancelled && volume->result.success)
+            return finished(shared(volume, input));
+
+        // Not resident, its last load did not finish, or it is to be refreshed: load it here.
+        volume = std::make_shared<ResidentVolume>();
+        m_volumes.insert(key, volume);
+        m_loading.append(volume);
+    }
+
+    auto loadInput = input;
+    if (input.progress) {
+        loadInput.progress = [this, volume, progress = input.progress](const AsyncLoaderData &partial) {
+            progress(partial);
+            // Under the lock, so cancelWaiting() knows no more are passed on once it returns.
+            QMutexLocker locker(&m_mutex);
+            for (const ResidentVolume::Waiter &waiter : std::as_const(volume->waiters)) {
+                if (!waiter.input.progress || waiter.input.isCancelled())
+                    continue;
+                auto waiterPartial = partial;
+                waiterPartial.traceId = waiter.input.traceId;
+                waiter.input.progress(waiterPartial);
+            }
+        };
+    }
+    auto result = load(loadInput);
+    result.progress = input.progress; // The wrapper holds the volume.
+
+    QList<ResidentVolume::Waiter> waiters;
+    {
+        QMutexLocker locker(&m_mutex);
+        volume->cancelled = !result.success && input.isCancelled();
+        volume->result = result;
+        volume->result.progress = nullptr;
+        volume->result.reservation = MemoryReservation(); // Textures account for the bytes from here on.
+        volume->loading = false;
+        waiters.swap(volume->waiters);
+        m_loading.removeOne(volume);
+    }
+    for (const ResidentVolume::Waiter &waiter : std::as_const(waiters)) {
+        if (waiter.input.isCancelled() || (!volume->cancelled && !volume->result.success)) {
+            waiter.promise->addResult(failed(waiter.input)); // Failed for every view alike.
+        } else if (volume->cancelled) {
+            waiter.promise->future().cancel(); // Superseded in this instance, one of the waiting loads takes over.
+        } else {
+            waiter.promise->addResult(shared(volume, waiter.input));
+        }
+        waiter.promise->finish();
+    }
+
+    result.resident = volume;
+    return finished(result);
+}
+
+void ResidentVolumes::cancelWaiting(const std::shared_ptr<std::atomic_bool> &cancelled)
+{
+    QList<ResidentVolume::Waiter> cancelledWaiters;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (const std::shared_ptr<ResidentVolume> &volume : std::as_const(m_loading)) {
+            for (qsizetype i = volume->waiters.size() - 1; i >= 0; i--) {
+                if (volume->waiters[i].input.cancelled == cancelled)
+                    cancelledWaiters.append(volume->waiters.takeAt(i));
+            }
+        }
+    }
+    for (const ResidentVolume::Waiter &waiter : std::as_const(cancelledWaiters)) {
+        waiter.promise->addResult(failed(waiter.input));
+        waiter.promise->finish();
+    }
+}
+
+void ResidentVolumes::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_volumes.clear(); // Loads in flight still hand their volume to the loads waiting on it.
+}
+
+ResidentVolumes::AsyncLoaderData ResidentVolumes::shared(const std::shared_ptr<ResidentVolume> &volume, const AsyncLoaderData &input) const
+{
+    // The bytes are the resident volume's, the rest belongs to the request.
+    auto result = volume->result;
+    result.globalFocusPoint = input.globalFocusPoint;
+    result.cancelled = input.cancelled;
+    result.priority = input.priority;
+    result.progress = input.progress;
+    result.traceId = input.traceId;
+    result.gradientsEnabled = input.gradientsEnabled;
+    result.stages = {}; // Nothing was loaded for this request.
+    result.resident = volume;
+    return result;
+}
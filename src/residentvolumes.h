@@ -0,0 +1,91 @@
+#ifndef RESIDENTVOLUMES_H
+#define RESIDENTVOLUMES_H
+
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPromise>
+#include <QString>
+
+#include <functional>
+#include <memory>
+
+#include <src/memorybudget.h>
+#include <src/volumetexturedata.h>
+
+// A converted volume shared by every VolumeTextureData that shows the same
+// store, level and region. It stays resident for as long as a load or a
+// texture holds it.
+class ResidentVolume
+{
+public:
+    // Accounts for the bytes handed to textures once, however many textures
+    // hold them. Used on the GUI thread only.
+    MemoryReservation textureReservation();
+
+private:
+    friend class ResidentVolumes;
+    using AsyncLoaderData = VolumeTextureData::AsyncLoaderData;
+
+    // A load of another instance waiting for this one, it is passed the partial volumes.
+    struct Waiter
+    {
+        AsyncLoaderData input;
+        std::shared_ptr<QPromise<AsyncLoaderData>> promise;
+    };
+
+    bool loading = true;
+    bool cancelled = false; // The load was superseded, waiting loads load it themselves.
+    AsyncLoaderData result; // Once loaded, without the reservation of a single load.
+    QList<Waiter> waiters;
+    MemoryReservation texture;
+};
+
+// Process-wide registry of resident volumes. Loads ask it for the volume
+// their inputs produce: a resident one is shared, one that another instance
+// is loading is handed over once that load ends, with its partial volumes
+// passed on meanwhile, and only otherwise the volume is loaded. A single load
+// thus fans out to every view of the same region, memory and network cost do
+// not grow with the views.
+//
+// Keys identify what a load produces, see residentKey in volumetexturedata.cpp.
+// Resident volumes are not checked against their stores: revalidation loads
+// with `refresh`, and replays and benchmarks clear them between runs.
+class ResidentVolumes
+{
+public:
+    using AsyncLoaderData = VolumeTextureData::AsyncLoaderData;
+
+    static ResidentVolumes *instance();
+
+    // The volume for `key`, loaded with `load` on the calling thread when no
+    // other load shares it, the future is then finished on return. While
+    // another instance loads it, the future finishes when that load ends and
+    // the caller does not wait for it. It is cancelled when that load was
+    // superseded, the caller then acquires the volume again.
+    //
+    // The result holds the resident volume in `resident`, timings of shared
+    // loads are left empty. With `refresh` a resident volume is loaded again
+    // from its source, and the new one replaces it for later loads.
+    QFuture<AsyncLoaderData> acquire(const QString &key, const AsyncLoaderData &input,
+                                     const std::function<AsyncLoaderData(const AsyncLoaderData &)> &load, bool refresh = false);
+
+    // Stop waiting for other instances on behalf of the loads with the
+    // `cancelled` flag. Their futures finish as failed, and once this
+    // returns they are passed no more partial volumes.
+    void cancelWaiting(const std::shared_ptr<std::atomic_bool> &cancelled);
+
+    // Forget every resident volume, so later loads go to their sources.
+    // Textures keep showing the volumes they hold.
+    void clear();
+
+private:
+    AsyncLoaderData shared(const std::shared_ptr<ResidentVolume> &volume, const AsyncLoaderData &input) const;
+
+    QMutex m_mutex;
+    QHash<QString, std::weak_ptr<ResidentVolume>> m_volumes;
+    QList<std::shared_ptr<ResidentVolume>> m_loading; // Also those cleared while loading, they may have waiters.
+};
+
+#endif // RESIDENTVOLUMES_H
@@ -0,0 +1,327 @@
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QNetworkAccessManager>
+#include <QPromise>
+#include <QRandomGenerator>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <array>
+
+#include <src/resourcefetcher.h>
+
+namespace {
+
+struct FetchSettings
+{
+    int transferTimeoutMs = 30000;
+    int maxRetries = 3;
+    int backoffMs = 200; // Doubles with every retry.
+    int minHedgeDelayMs = 50;
+    int minLatencySamples = 16; // Hedge only once the percentile means something.
+
+    FetchSettings()
+    {
+        bool ok = false;
+        if (const int timeout = qEnvironmentVariableIntValue("VOLUMERAYCASTER_FETCH_TIMEOUT_MS", &ok); ok && timeout > 0)
+            transferTimeoutMs = timeout;
+        if (const int retries = qEnvironmentVariableIntValue("VOLUMERAYCASTER_FETCH_RETRIES", &ok); ok && retries >= 0)
+            maxRetries = retries;
+    }
+};
+
+const FetchSettings &settings()
+{
+    static const FetchSettings instance;
+    return instance;
+}
+
+// Fetches whose latencies are comparable. Small requests would pull a
+// shared percentile far below the transfer time of a whole chunk, and
+// nearly every chunk fetch would be hedged.
+enum SizeClass {
+    Small, // Metadata and range requests of a chunk's head.
+    Range, // Larger byte ranges, the blocks of a chunk.
+    Whole, // Whole chunks.
+    SizeClassCount
+};
+
+// Latencies of recent successful attempts. Only used on the network thread.
+class LatencyWindow
+{
+public:
+    void add(qint64 ms)
+    {
+        if (m_samples.size() < kSize)
+            m_samples.append(ms);
+        else
+            m_samples[m_next] = ms;
+        m_next = (m_next + 1) % kSize;
+    }
+
+    // Latency below which the given fraction of samples fall, -1 without enough samples.
+    qint64 percentile(double fraction) const
+    {
+        if (m_samples.size() < settings().minLatencySamples)
+            return -1;
+        QList<qint64> sorted = m_samples;
+        const qsizetype index = qMin(sorted.size() - 1, qsizetype(fraction * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+private:
+    static constexpr int kSize = 64;
+    QList<qint64> m_samples;
+    int m_next = 0;
+};
+
+// Budget reservation of one attempt, made before its reply is buffered.
+struct Attempt
+{
+    MemoryReservation reservation;
+    bool refused = false; // The reply does not fit the budget and was aborted.
+};
+
+// One resource fetch, possibly spread over several attempts.
+struct Fetch
+{
+    QUrl url;
+    qint64 offset = 0;
+    qint64 length = -1; // The whole resource.
+    QPromise<FetchedResource> promise;
+    QList<QNetworkReply *> replies; // Attempts in flight, the original and its hedge.
+    int retries = 0;
+    bool hedged = false;
+    bool finished = false;
+
+    SizeClass sizeClass() const
+    {
+        constexpr qint64 kSmallBytes = 64 * 1024;
+        if (length > 0)
+            return length <= kSmallBytes ? Small : Range;
+        const QString name = url.fileName();
+        return name.startsWith(".z") || name == "zarr.json" ? Small : Whole; // .zarray, .zattrs, .zgroup, .zmetadata.
+    }
+};
+
+} // namespace
+
+// One manager on a thread of its own serves every fetch, so requests to the
+// same host share connections and no loader thread runs an event loop.
+static QNetworkAccessManager *networkManager()
+{
+    static QNetworkAccessManager *manager = [] {
+        auto thread = new QThread();
+        thread->setObjectName("ResourceFetcher");
+        thread->start();
+        auto result = new QNetworkAccessManager();
+        result->moveToThread(thread);
+        return result;
+    }();
+    return manager;
+}
+
+static LatencyWindow &latencies(SizeClass sizeClass)
+{
+    static std::array<LatencyWindow, SizeClassCount> windows;
+    return windows[sizeClass];
+}
+
+// Errors worth another attempt: timeouts, dropped connections and overloaded servers.
+static bool isTransientError(QNetworkReply *reply)
+{
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 429 || status >= 500)
+        return true;
+
+    switch (reply->error()) {
+    case QNetworkReply::OperationCanceledError: // Transfer timeout.
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void finishFetch(const std::shared_ptr<Fetch> &fetch, FetchedResource result)
+{
+    fetch->finished = true;
+    // Aborting emits finished, which is ignored now.
+    const auto replies = fetch->replies;
+    fetch->replies.clear();
+    for (QNetworkReply *reply : replies)
+        reply->abort();
+
+    fetch->promise.addResult(result);
+    fetch->promise.finish();
+}
+
+static void startAttempt(const std::shared_ptr<Fetch> &fetch);
+
+// Reserve the bytes of a reply as it arrives: all of them once the size is
+// known, otherwise ahead of what has been received. Replies that do not fit
+// are aborted before they are buffered.
+static void reserveReply(QNetworkReply *reply, Attempt *attempt, qint64 received, qint64 total)
+{
+    const qint64 reserved = attempt->reservation.bytes();
+    if (attempt->refused || qMax(received, total) <= reserved)
+        return;
+    const qint64 bytes = total > 0 ? total : qMax(received, 2 * reserved);
+    attempt->reservation = MemoryReservation(); // Replaced by the larger one.
+    attempt->reservation = MemoryBudget::instance()->reserve(MemoryBudget::Network, bytes);
+    if (!attempt->reservation.isValid()) {
+        attempt->refused = true;
+        reply->abort();
+    }
+}
+
+static void handleReply(const std::shared_ptr<Fetch> &fetch, QNetworkReply *reply, qint64 elapsedMs, const std::shared_ptr<Attempt> &attempt)
+{
+    reply->deleteLater();
+    if (fetch->finished)
+        return; // Lost to the other attempt.
+    fetch->replies.removeOne(reply);
+
+    if (attempt->refused) {
+        qWarning() << "Reply does not fit the memory budget:" << fetch->url;
+        finishFetch(fetch, FetchedResource()); // Failed, a retry would not fit either.
+        return;
+    }
+
+    if (reply->error() == QNetworkReply::NoError) {
+        latencies(fetch->sizeClass()).add(elapsedMs);
+
+        FetchedResource result;
+        const qint64 size = reply->bytesAvailable();
+        if (attempt->reservation.bytes() >= size) {
+            result.reservation = MemoryBudget::instance()->track(MemoryBudget::Network, size); // Within what is reserved.
+            attempt->reservation = MemoryReservation();
+        } else {
+            result.reservation = MemoryBudget::instance()->reserve(MemoryBudget::Network, size); // No progress was reported.
+        }
+        if (result.reservation.isValid()) {
+            result.status = FetchedResource::Ok;
+            result.isRange = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206;
+            result.data = reply->readAll();
+            qDebug() << "Reply data:" << result.data.size() << "in" << elapsedMs << "ms";
+        }
+        finishFetch(fetch, result);
+        return;
+    }
+
+    if (reply->error() == QNetworkReply::ContentNotFoundError) {
+        FetchedResource result;
+        result.status = FetchedResource::Missing;
+        finishFetch(fetch, result);
+        return;
+    }
+
+    if (!fetch->replies.isEmpty())
+        return; // The hedge is still running, it may yet succeed.
+
+    if (isTransientError(reply) && fetch->retries < settings().maxRetries) {
+        // Exponential backoff with jitter, so retries from many chunks do not arrive together.
+        const int backoff = settings().backoffMs << fetch->retries;
+        const int delay = backoff / 2 + QRandomGenerator::global()->bounded(backoff / 2 + 1);
+        fetch->retries++;
+        qDebug() << "Retry" << fetch->retries << "of" << fetch->url << "in" << delay << "ms:" << reply->errorString();
+        QTimer::singleShot(delay, networkManager(), [fetch] { startAttempt(fetch); });
+        return;
+    }
+
+    qWarning() << "Fetch failed:" << fetch->url << reply->errorString();
+    finishFetch(fetch, FetchedResource()); // Failed.
+}
+
+static void startAttempt(const std::shared_ptr<Fetch> &fetch)
+{
+    if (fetch->finished)
+        return; // Cancelled while waiting to retry.
+
+    QNetworkRequest request(fetch->url);
+    request.setTransferTimeout(settings().transferTimeoutMs);
+    if (fetch->length > 0) {
+        request.setRawHeader("Range", QByteArray("bytes=") + QByteArray::number(fetch->offset) + '-' + QByteArray::number(fetch->offset + fetch->length - 1));
+    }
+
+    QNetworkReply *reply = networkManager()->get(request);
+    fetch->replies.append(reply);
+
+    QElapsedTimer timer;
+    timer.start();
+    auto attempt = std::make_shared<Attempt>();
+    QObject::connect(reply, &QNetworkReply::downloadProgress, reply, [reply, attempt](qint64 received, qint64 total) {
+        reserveReply(reply, attempt.get(), received, total);
+    });
+    QObject::connect(reply, &QNetworkReply::finished, reply, [fetch, reply, timer, attempt] { handleReply(fetch, reply, timer.elapsed(), attempt); });
+
+    // Hedge a slow attempt once with a duplicate request, slow for fetches of its size.
+    const qint64 hedgeDelay = latencies(fetch->sizeClass()).percentile(0.95);
+    if (!fetch->hedged && hedgeDelay >= 0) {
+        QTimer::singleShot(qMax<qint64>(hedgeDelay, settings().minHedgeDelayMs), reply, [fetch, reply] {
+            if (fetch->finished || fetch->hedged || !fetch->replies.contains(reply))
+                return;
+            fetch->hedged = true;
+            qDebug() << "Hedge:" << fetch->url;
+            startAttempt(fetch);
+        });
+    }
+}
+
+// Run `onCancel` on the network thread once `future` is cancelled. Called on the network thread.
+static void watchCancel(const QFuture<FetchedResource> &future, std::function<void()> onCancel)
+{
+    auto watcher = new QFutureWatcher<FetchedResource>();
+    QObject::connect(watcher, &QFutureWatcherBase::canceled, watcher, std::move(onCancel));
+    QObject::connect(watcher, &QFutureWatcherBase::finished, watcher, &QObject::deleteLater);
+    watcher->setFuture(future); // Signals a cancel that came before.
+}
+
+QFuture<FetchedResource> fetchResourceAsync(QUrl resourceUrl, qint64 offset, qint64 length)
+{
+    auto fetch = std::make_shared<Fetch>();
+    fetch->url = resourceUrl;
+    fetch->offset = offset;
+    fetch->length = length;
+    QFuture<FetchedResource> future = fetch->promise.future();
+    fetch->promise.start();
+
+    QMetaObject::invokeMethod(networkManager(), [fetch, future] {
+        watchCancel(future, [fetch] {
+            if (fetch->finished)
+                return;
+            qDebug() << "Fetch cancelled:" << fetch->url;
+            finishFetch(fetch, FetchedResource()); // Aborts the attempts in flight, the result is dropped.
+        });
+        qDebug() << "Fetch:" << fetch->url;
+        startAttempt(fetch);
+    }, Qt::QueuedConnection);
+
+    return future;
+}
+
+void cancelFetchWith(const QFuture<FetchedResource> &future, QFuture<FetchedResource> fetch)
+{
+    QMetaObject::invokeMethod(networkManager(), [future, fetch]() mutable {
+        watchCancel(future, [fetch]() mutable { fetch.cancel(); });
+    }, Qt::QueuedConnection);
+}
+
+QByteArray fetchResourceBlocking(QUrl resourceUrl, MemoryReservation *reservation)
+{
+    FetchedResource fetched = fetchResourceAsync(resourceUrl).result();
+    if (reservation) {
+        *reservation = fetched.reservation;
+    }
+    return fetched.data;
+}
@@ -0,0 +1,54 @@
+#ifndef RESOURCEFETCHER_H
+#define RESOURCEFETCHER_H
+
+#include <QByteArray>
+#include <QFuture>
+#include <QUrl>
+
+#include <src/memorybudget.h>
+
+// A fetched resource and the budget reservation for its bytes.
+struct FetchedResource
+{
+    enum Status {
+        Ok,
+        Missing, // The server has no such resource, e.g. a chunk never written.
+        Failed, // Gave up after retries, or the reply does not fit the memory budget.
+    };
+
+    Status status = Failed;
+    QByteArray data; // Empty unless the status is Ok.
+    bool isRange = false; // The server honoured the byte range, data holds only that range.
+    MemoryReservation reservation;
+};
+
+// Fetch a resource without blocking. Requests are issued on a network thread
+// shared by all loads, the future finishes on that thread.
+//
+// Every attempt is abandoned when no data arrives within the transfer timeout.
+// Transient errors are retried with exponential backoff. An attempt that takes
+// longer than the 95th percentile of recent fetches of its size class
+// (metadata and chunk heads, ranges, whole chunks) is hedged with a
+// duplicate request, the first reply wins.
+//
+// The timeout and the retry count can be set with the environment variables
+// VOLUMERAYCASTER_FETCH_TIMEOUT_MS and VOLUMERAYCASTER_FETCH_RETRIES.
+//
+// With a positive `length` only the bytes [offset, offset + length) are
+// requested. Servers may ignore the range and send the whole resource.
+//
+// Cancelling the future aborts the attempts in flight and any retry still to
+// come. The future then finishes as cancelled, so continuations attached with
+// then() are skipped and those attached with onCanceled() run.
+QFuture<FetchedResource> fetchResourceAsync(QUrl resourceUrl, qint64 offset = 0, qint64 length = -1);
+
+// Cancel `fetch` once `future` is cancelled. For fetches made on behalf of a
+// future of their own, like the parts of a chunk span.
+void cancelFetchWith(const QFuture<FetchedResource> &future, QFuture<FetchedResource> fetch);
+
+// Fetch a resource over the network, blocking the calling thread until the
+// reply arrives. Returns an empty array on error or when the reply does not
+// fit the memory budget. The reply bytes stay reserved while `reservation` lives.
+QByteArray fetchResourceBlocking(QUrl resourceUrl, MemoryReservation *reservation = nullptr);
+
+#endif // RESOURCEFETCHER_H
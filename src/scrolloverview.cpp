@@ -0,0 +1,654 @@
+#include <src/scrolloverview.h>
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QStandardPaths>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <src/memorybudget.h>
+#include <src/resourcefetcher.h>
+#include <src/storagezarr.h>
+#include <src/zarrsession.h>
+
+static constexpr int kMaxLevels = 10; // Multiscale levels looked for above the full resolution.
+static constexpr qint64 kPublishIntervalMs = 500; // Between images of a build in progress.
+static constexpr int kCancelCheckMs = 50; // How often a waiting build looks for its cancellation.
+
+namespace {
+
+// Maxima of the store along each axis, at the coarsest level's resolution.
+struct Projections
+{
+    qsizetype width = 0;
+    qsizetype height = 0;
+    qsizetype depth = 0;
+    std::vector<float> xy; // Along z.
+    std::vector<float> xz; // Along y.
+    std::vector<float> yz; // Along x.
+
+    Projections(qsizetype width, qsizetype height, qsizetype depth)
+        : width(width), height(height), depth(depth)
+        , xy(width * height, std::numeric_limits<float>::lowest())
+        , xz(width * depth, std::numeric_limits<float>::lowest())
+        , yz(height * depth, std::numeric_limits<float>::lowest())
+    {
+    }
+};
+
+}
+
+// Project a decoded chunk into its own small projections first, so merging
+// into the shared ones holds the lock only briefly.
+template<typename T>
+static void projectChunk(const T *values, const StorageZarr &zarr, int chunkZ, int chunkY, int chunkX, Projections &projections, QMutex &mutex)
+{
+    const auto [chunkDepth, chunkHeight, chunkWidth] = zarr.getChunks();
+    const qsizetype originX = qsizetype(chunkX) * chunkWidth;
+    const qsizetype originY = qsizetype(chunkY) * chunkHeight;
+    const qsizetype originZ = qsizetype(chunkZ) * chunkDepth;
+    // Chunks on the far edges reach past the array.
+    const qsizetype width = qMin<qsizetype>(chunkWidth, projections.width - originX);
+    const qsizetype height = qMin<qsizetype>(chunkHeight, projections.height - originY);
+    const qsizetype depth = qMin<qsizetype>(chunkDepth, projections.depth - originZ);
+    if (width <= 0 || height <= 0 || depth <= 0)
+        return;
+
+    Projections chunk(width, height, depth);
+    for (qsizetype z = 0; z < depth; z++) {
+        for (qsizetype y = 0; y < height; y++) {
+            const T *row = values + chunkWidth * (y + chunkHeight * z);
+            float rowMax = std::numeric_limits<float>::lowest();
+            for (qsizetype x = 0; x < width; x++) {
+                const float value = float(row[x]);
+                if (value > chunk.xy[x + width * y]) // Also skips NaN.
+                    chunk.xy[x + width * y] = value;
+                if (value > chunk.xz[x + width * z])
+                    chunk.xz[x + width * z] = value;
+                if (value > rowMax)
+                    rowMax = value;
+            }
+            chunk.yz[y + height * z] = qMax(chunk.yz[y + height * z], rowMax);
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    for (qsizetype y = 0; y < height; y++) {
+        for (qsizetype x = 0; x < width; x++) {
+            float &value = projections.xy[originX + x + projections.width * (originY + y)];
+            value = qMax(value, chunk.xy[x + width * y]);
+        }
+    }
+    for (qsizetype z = 0; z < depth; z++) {
+        for (qsizetype x = 0; x < width; x++) {
+            float &value = projections.xz[originX + x + projections.width * (originZ + z)];
+            value = qMax(value, chunk.xz[x + width * z]);
+        }
+        for (qsizetype y = 0; y < height; y++) {
+            float &value = projections.yz[originY + y + projections.height * (originZ + z)];
+            value = qMax(value, chunk.yz[y + height * z]);
+        }
+    }
+}
+
+// Project a chunk the store leaves out, every voxel of which holds `fill`.
+static void projectFill(float fill, const StorageZarr &zarr, int chunkZ, int chunkY, int chunkX, Projections &projections, QMutex &mutex)
+{
+    const auto [chunkDepth, chunkHeight, chunkWidth] = zarr.getChunks();
+    const qsizetype originX = qsizetype(chunkX) * chunkWidth;
+    const qsizetype originY = qsizetype(chunkY) * chunkHeight;
+    const qsizetype originZ = qsizetype(chunkZ) * chunkDepth;
+    const qsizetype width = qMin<qsizetype>(chunkWidth, projections.width - originX);
+    const qsizetype height = qMin<qsizetype>(chunkHeight, projections.height - originY);
+    const qsizetype depth = qMin<qsizetype>(chunkDepth, projections.depth - originZ);
+    if (width <= 0 || height <= 0 || depth <= 0 || qIsNaN(fill))
+        return;
+
+    QMutexLocker locker(&mutex);
+    for (qsizetype y = 0; y < height; y++) {
+        for (qsizetype x = 0; x < width; x++) {
+            float &value = projections.xy[originX + x + projections.width * (originY + y)];
+            value = qMax(value, fill);
+        }
+    }
+    for (qsizetype z = 0; z < depth; z++) {
+        for (qsizetype x = 0; x < width; x++) {
+            float &value = projections.xz[originX + x + projections.width * (originZ + z)];
+            value = qMax(value, fill);
+        }
+        for (qsizetype y = 0; y < height; y++) {
+            float &value = projections.yz[originY + y + projections.height * (originZ + z)];
+            value = qMax(value, fill);
+        }
+    }
+}
+
+// Grayscale images of the projections, stretched over the range of all three.
+// Voxels no chunk covered yet are black.
+static void projectionImages(const Projections &projections, QImage *xy, QImage *xz, QImage *yz)
+{
+    float low = std::numeric_limits<float>::max();
+    float high = std::numeric_limits<float>::lowest();
+    for (const std::vector<float> *values : { &projections.xy, &projections.xz, &projections.yz }) {
+        for (float value : *values) {
+            if (value == std::numeric_limits<float>::lowest())
+                continue;
+            low = qMin(low, value);
+            high = qMax(high, value);
+        }
+    }
+    const float scale = high > low ? 255.0f / (high - low) : 0.0f;
+
+    const auto toImage = [&](const std::vector<float> &values, qsizetype width, qsizetype height) {
+        QImage image(width, height, QImage::Format_Grayscale8);
+        for (qsizetype y = 0; y < height; y++) {
+            uchar *line = image.scanLine(y);
+            for (qsizetype x = 0; x < width; x++) {
+                const float value = values[x + width * y];
+                line[x] = value == std::numeric_limits<float>::lowest() ? 0 : uchar(qBound(0.0f, (value - low) * scale + 0.5f, 255.0f));
+            }
+        }
+        return image;
+    };
+    *xy = toImage(projections.xy, projections.width, projections.height);
+    *xz = toImage(projections.xz, projections.width, projections.depth);
+    *yz = toImage(projections.yz, projections.height, projections.depth);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+ScrollOverview::ScrollOverview(QObject *parent)
+    : QObject(parent), m_tasks(LoaderPool::Prefetch)
+{
+}
+
+ScrollOverview::~ScrollOverview()
+{
+    if (m_cancelled)
+        *m_cancelled = true;
+    m_tasks.wait();
+}
+
+QUrl ScrollOverview::source() const
+{
+    return m_source;
+}
+
+void ScrollOverview::setSource(const QUrl &newSource)
+{
+    if (m_source == newSource)
+        return;
+    m_source = newSource;
+    emit sourceChanged();
+    start();
+}
+
+QString ScrollOverview::order() const
+{
+    return m_order;
+}
+
+void ScrollOverview::setOrder(const QString &newOrder)
+{
+    if (m_order == newOrder)
+        return;
+    m_order = newOrder;
+    emit orderChanged();
+    start();
+}
+
+bool ScrollOverview::active() const
+{
+    return m_active;
+}
+
+void ScrollOverview::setActive(bool newActive)
+{
+    if (m_active == newActive)
+        return;
+    m_active = newActive;
+    emit activeChanged();
+    start();
+}
+
+QVector3D ScrollOverview::shape() const
+{
+    return m_shape;
+}
+
+QUrl ScrollOverview::xyImage() const
+{
+    return imageUrl("xy");
+}
+
+QUrl ScrollOverview::xzImage() const
+{
+    return imageUrl("xz");
+}
+
+QUrl ScrollOverview::yzImage() const
+{
+    return imageUrl("yz");
+}
+
+bool ScrollOverview::running() const
+{
+    return m_running;
+}
+
+qreal ScrollOverview::progress() const
+{
+    return m_progress;
+}
+
+QUrl ScrollOverview::imageUrl(const QString &view) const
+{
+    if (m_revision == 0)
+        return QUrl();
+    return QUrl(QString("image://overview/%1/%2?%3").arg(m_key, view).arg(m_revision));
+}
+
+void ScrollOverview::setRunning(bool newRunning)
+{
+    if (m_running == newRunning)
+        return;
+    m_running = newRunning;
+    emit runningChanged();
+}
+
+void ScrollOverview::setProgress(qreal newProgress)
+{
+    if (qFuzzyCompare(m_progress, newProgress))
+        return;
+    m_progress = newProgress;
+    emit progressChanged();
+}
+
+void ScrollOverview::setImages(const Images &images)
+{
+    OverviewImageProvider::setImage(m_key + "/xy", images.xy);
+    OverviewImageProvider::setImage(m_key + "/xz", images.xz);
+    OverviewImageProvider::setImage(m_key + "/yz", images.yz);
+    m_shape = images.shape;
+    m_revision++;
+    emit imagesChanged();
+}
+
+void ScrollOverview::start()
+{
+    if (!m_active || m_source.isEmpty())
+        return;
+    const QString key = QString::fromLatin1(QCryptographicHash::hash((m_source.adjusted(QUrl::StripTrailingSlash).toString() + "|" + m_order).toUtf8(),
+                                                                     QCryptographicHash::Sha1).toHex());
+    if (key == m_builtKey)
+        return; // Built or being built.
+
+    // Supersede the build in flight, it stops at its next batch.
+    if (m_cancelled)
+        *m_cancelled = true;
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    m_key = key;
+    m_builtKey = key;
+    m_revision = 0;
+    m_shape = QVector3D();
+    emit imagesChanged();
+
+    const quint64 generation = ++m_generation;
+    const QUrl source = m_source;
+    const QString order = m_order;
+    const auto cancelled = m_cancelled;
+    setProgress(0.0);
+    setRunning(true);
+    m_tasks.run([this, source, order, key, cancelled, generation] {
+        Images images;
+        const bool cached = readCache(key, &images);
+        if (!cached) {
+            images = build(source, order, cancelled, [this, generation](const Images &partial, qreal progress) {
+                QMetaObject::invokeMethod(this, [this, generation, partial, progress] {
+                    if (generation != m_generation)
+                        return;
+                    setImages(partial);
+                    setProgress(progress);
+                }, Qt::QueuedConnection);
+            });
+            if (images.complete)
+                writeCache(key, images);
+        }
+        QMetaObject::invokeMethod(this, [this, generation, images, cached] {
+            if (generation != m_generation)
+                return;
+            if (!images.xy.isNull()) {
+                setImages(images);
+                setProgress(1.0);
+            } else if (!cached) {
+                m_builtKey.clear(); // Try again next time.
+            }
+            setRunning(false);
+        }, Qt::QueuedConnection);
+    });
+}
+
+ScrollOverview::Images ScrollOverview::build(const QUrl &source, const QString &order, const std::shared_ptr<std::atomic_bool> &cancelled,
+                                             const std::function<void(const Images &partial, qreal progress)> &progress)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const std::shared_ptr<ZarrSession> session = ZarrSession::forStore(source);
+    const int fullLevel = session->resolveLevel(-1);
+    const StorageZarr::Metadata fullMetadata = session->metadata(fullLevel);
+    if (!fullMetadata.isValid()) {
+        qWarning() << "Overview: Zarr metadata is not available:" << source;
+        return Images();
+    }
+    int level = fullLevel;
+    if (fullLevel >= 0) {
+        while (level + 1 < fullLevel + kMaxLevels && session->metadata(level + 1).isValid())
+            level++;
+    }
+
+    StorageZarr zarr = session->storage(level);
+    zarr.setOrder(order);
+    const auto [shapeZ, shapeY, shapeX] = zarr.getShape();
+    const auto [chunkDepth, chunkHeight, chunkWidth] = zarr.getChunks();
+    if (chunkDepth <= 0 || chunkHeight <= 0 || chunkWidth <= 0 || shapeZ <= 0 || shapeY <= 0 || shapeX <= 0)
+        return Images();
+    const auto [fullZ, fullY, fullX] = fullMetadata.shape;
+
+    const int chunksZ = (shapeZ + chunkDepth - 1) / chunkDepth;
+    const int chunksY = (shapeY + chunkHeight - 1) / chunkHeight;
+    const int chunksX = (shapeX + chunkWidth - 1) / chunkWidth;
+    const qsizetype chunkCount = qsizetype(chunksZ) * chunksY * chunksX;
+    Projections projections(shapeX, shapeY, shapeZ);
+    QMutex mutex; // Guards the projections.
+    std::atomic_int failed = 0;
+    float fill = 0;
+    visitDataType(zarr.getDataTypeName(), [&](auto value) {
+        using T = decltype(value);
+        fill = float(fillValueAs<T>(zarr.getFillValue()));
+    });
+
+    Images images;
+    images.shape = QVector3D(fullX, fullY, fullZ);
+    const auto snapshot = [&] {
+        QMutexLocker locker(&mutex);
+        projectionImages(projections, &images.xy, &images.xz, &images.yz);
+        return images;
+    };
+
+    // Chunks between fetch and projection, a few per thread so only a few are
+    // in memory at once. Fetches do not hold a pool thread, their replies are
+    // decoded and projected in pool tasks.
+    const qsizetype maxInFlight = 2 * qMax(1, LoaderPool::instance()->maxThreadCount());
+    LoaderTaskGroup group(LoaderPool::Prefetch);
+    QMutex stateMutex;
+    QWaitCondition changed;
+    qsizetype inFlight = 0;
+    qsizetype done = 0;
+    qsizetype scheduled = 0; // Projections handed to the group, lets the waiting thread notice new work.
+    QList<QFuture<FetchedResource>> fetches; // Cancelled with the build.
+    const auto isCancelled = [&] { return cancelled && *cancelled; };
+    const auto schedule = [&](std::function<void()> task) {
+        group.run(std::move(task));
+        QMutexLocker locker(&stateMutex);
+        scheduled++;
+        changed.wakeAll();
+    };
+    // Runs queued projections one at a time meanwhile, never waits on running
+    // ones. A cancelled build is noticed within kCancelCheckMs.
+    const auto waitUntil = [&](auto condition) {
+        for (;;) {
+            qsizetype seen;
+            {
+                QMutexLocker locker(&stateMutex);
+                if (condition())
+                    return;
+                seen = scheduled;
+            }
+            if (group.runOne())
+                continue;
+            QMutexLocker locker(&stateMutex);
+            while (!condition() && seen == scheduled)
+                changed.wait(&stateMutex, kCancelCheckMs);
+        }
+    };
+
+    const auto project = [&](int z, int y, int x, QByteArray decoded, MemoryReservation reservation, bool missing) {
+        if (missing) {
+            projectFill(fill, zarr, z, y, x, projections, mutex);
+        } else if (decoded.size() == qsizetype(zarr.getChunkSizeBytes())) {
+            decoded = zarr.reorderChunk(decoded, &reservation, false); // Chunks are read side by side.
+            visitDataType(zarr.getDataTypeName(), [&](auto value) {
+                using T = decltype(value);
+                projectChunk(reinterpret_cast<const T *>(decoded.constData()), zarr, z, y, x, projections, mutex);
+            });
+        }
+        QMutexLocker locker(&stateMutex);
+        inFlight--;
+        done++;
+        changed.wakeAll();
+    };
+
+    QElapsedTimer published;
+    published.start();
+    for (qsizetype i = 0; i < chunkCount; i++) {
+        waitUntil([&] { return inFlight < maxInFlight || isCancelled(); });
+        if (isCancelled())
+            break;
+        qsizetype projected;
+        {
+            QMutexLocker locker(&stateMutex);
+            inFlight++;
+            projected = done;
+        }
+        if (published.elapsed() >= kPublishIntervalMs) {
+            progress(snapshot(), qreal(projected) / chunkCount);
+            published.restart();
+        }
+
+        const int z = i / (qsizetype(chunksY) * chunksX);
+        const int y = i / chunksX % chunksY;
+        const int x = i % chunksX;
+        if (zarr.isLocal()) {
+            schedule([&, z, y, x] {
+                MemoryReservation reservation;
+                const QByteArray decoded = zarr.readLocalChunk(level, z, y, x, &reservation);
+                const bool missing = decoded.isEmpty() && !zarr.hasLocalChunk(level, z, y, x);
+                if (decoded.isEmpty() && !missing)
+                    failed++; // Corrupt, or refused by the memory budget.
+                project(z, y, x, decoded, reservation, missing);
+            });
+        } else if (const QUrl url = zarr.getChunkUrl(level, z, y, x); session->isChunkMissing(url)) {
+            schedule([&, z, y, x] { project(z, y, x, QByteArray(), MemoryReservation(), true); });
+        } else {
+            QFuture<FetchedResource> fetch = fetchResourceAsync(url);
+            {
+                QMutexLocker locker(&stateMutex);
+                fetches.append(fetch);
+            }
+            fetch.then([&, z, y, x, url](FetchedResource fetched) {
+                const bool missing = fetched.status == FetchedResource::Missing;
+                if (missing)
+                    session->markChunkMissing(url);
+                else if (fetched.status == FetchedResource::Failed)
+                    failed++;
+                schedule([&, z, y, x, missing, fetched] {
+                    MemoryReservation reservation;
+                    const QByteArray decoded = fetched.data.isEmpty() ? QByteArray() : zarr.readChunk(fetched.data, &reservation);
+                    if (!fetched.data.isEmpty() && decoded.isEmpty())
+                        failed++; // Corrupt, or refused by the memory budget.
+                    project(z, y, x, decoded, reservation, missing);
+                });
+            }).onCanceled([&] {
+                QMutexLocker locker(&stateMutex);
+                inFlight--;
+                changed.wakeAll();
+            });
+        }
+    }
+    // Fetches in flight refer to the state above. A cancelled build aborts
+    // them rather than waiting for their replies.
+    waitUntil([&] { return inFlight == 0 || isCancelled(); });
+    if (isCancelled()) {
+        {
+            QMutexLocker locker(&stateMutex);
+            for (QFuture<FetchedResource> &fetch : fetches)
+                fetch.cancel();
+        }
+        waitUntil([&] { return inFlight == 0; });
+    }
+    group.wait();
+    if (isCancelled())
+        return Images();
+
+    snapshot();
+    images.complete = failed == 0;
+    qDebug() << "Overview of" << source << "from level" << level << ":" << chunkCount << "chunks in" << timer.elapsed() << "ms";
+    if (failed > 0)
+        qWarning() << "Overview: chunk fetches failed:" << failed.load(); // Shown, but not cached.
+    return images;
+}
+
+QString ScrollOverview::cachePath(const QString &key, const QString &view)
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath(QString("overview/%1-%2.png").arg(key, view));
+}
+
+bool ScrollOverview::readCache(const QString &key, Images *images)
+{
+    QImage xy(cachePath(key, "xy"));
+    QImage xz(cachePath(key, "xz"));
+    QImage yz(cachePath(key, "yz"));
+    if (xy.isNull() || xz.isNull() || yz.isNull())
+        return false;
+    const QStringList shape = xy.text("shape").split(',');
+    if (shape.size() != 3)
+        return false;
+    images->xy = xy;
+    images->xz = xz;
+    images->yz = yz;
+    images->shape = QVector3D(shape[0].toFloat(), shape[1].toFloat(), shape[2].toFloat());
+    return true;
+}
+
+void ScrollOverview::writeCache(const QString &key, const Images &images)
+{
+    QDir().mkpath(QFileInfo(cachePath(key, "xy")).absolutePath());
+    QImage xy = images.xy;
+    // The full resolution shape maps clicks to voxels without the store's metadata.
+    xy.setText("shape", QString("%1,%2,%3").arg(images.shape.x()).arg(images.shape.y()).arg(images.shape.z()));
+    if (!xy.save(cachePath(key, "xy")) || !images.xz.save(cachePath(key, "xz")) || !images.yz.save(cachePath(key, "yz")))
+        qWarning() << "Could not write overview cache:" << cachePath(key, "xy");
+}
+
+///////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// The images served, accounted against the memory budget as a cache. The
+// least recently requested ones are evicted first.
+class OverviewImageCache
+{
+public:
+    OverviewImageCache()
+    {
+        m_cacheId = MemoryBudget::instance()->registerCache([this](qint64 bytes) {
+            QMutexLocker locker(&m_mutex);
+            return evict(bytes);
+        });
+    }
+
+    ~OverviewImageCache()
+    {
+        MemoryBudget::instance()->unregisterCache(m_cacheId);
+    }
+
+    QImage find(const QString &id)
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_entries.find(id);
+        if (it == m_entries.end())
+            return QImage();
+        it->lastUse = ++m_clock;
+        return it->image;
+    }
+
+    void insert(const QString &id, const QImage &image)
+    {
+        // Accounted before taking the lock, tracking may evict from this cache.
+        MemoryReservation reservation = MemoryBudget::instance()->track(MemoryBudget::Cache, image.sizeInBytes());
+        QMutexLocker locker(&m_mutex);
+        m_entries.insert(id, { image, reservation, ++m_clock });
+    }
+
+private:
+    struct Entry
+    {
+        QImage image;
+        MemoryReservation reservation;
+        quint64 lastUse = 0;
+    };
+
+    qint64 evict(qint64 bytes)
+    {
+        qint64 freed = 0;
+        while (freed < bytes && !m_entries.isEmpty()) {
+            auto oldest = m_entries.begin();
+            for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+                if (it->lastUse < oldest->lastUse)
+                    oldest = it;
+            }
+            freed += oldest->image.sizeInBytes();
+            m_entries.erase(oldest);
+        }
+        return freed;
+    }
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    quint64 m_clock = 0;
+    int m_cacheId = -1;
+};
+
+}
+
+static OverviewImageCache &overviewImages()
+{
+    static OverviewImageCache images;
+    return images;
+}
+
+OverviewImageProvider::OverviewImageProvider()
+    : QQuickImageProvider(QQuickImageProvider::Image)
+{
+}
+
+QImage OverviewImageProvider::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
+{
+    const QString imageId = id.section('?', 0, 0); // The query only changes the URL.
+    QImage image = overviewImages().find(imageId);
+    if (image.isNull()) {
+        // Evicted, images of complete builds are still in the disk cache.
+        image = QImage(ScrollOverview::cachePath(imageId.section('/', 0, 0), imageId.section('/', 1, 1)));
+        if (!image.isNull())
+            overviewImages().insert(imageId, image);
+    }
+    if (size)
+        *size = image.size();
+    if (!image.isNull() && requestedSize.isValid())
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return image;
+}
+
+void OverviewImageProvider::setImage(const QString &id, const QImage &image)
+{
+    overviewImages().insert(id, image);
+}
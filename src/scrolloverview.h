@@ -0,0 +1,122 @@
+#ifndef SCROLLOVERVIEW_H
+#define SCROLLOVERVIEW_H
+
+#include <QImage>
+#include <QObject>
+#include <QQuickImageProvider>
+#include <QUrl>
+#include <QVector3D>
+#include <QtQml/QQmlEngine>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <src/loaderpool.h>
+
+// Maximum intensity projections of a whole Zarr store along z, y and x, for
+// finding a place to load. They are built in the background from the
+// coarsest level of the store, a batch of chunks at a time, and cached on
+// disk per store. The images are shown through OverviewImageProvider.
+class ScrollOverview : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+
+    Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged FINAL)
+    Q_PROPERTY(QString order READ order WRITE setOrder NOTIFY orderChanged FINAL)
+    Q_PROPERTY(bool active READ active WRITE setActive NOTIFY activeChanged FINAL)
+    Q_PROPERTY(QVector3D shape READ shape NOTIFY imagesChanged FINAL)
+    Q_PROPERTY(QUrl xyImage READ xyImage NOTIFY imagesChanged FINAL)
+    Q_PROPERTY(QUrl xzImage READ xzImage NOTIFY imagesChanged FINAL)
+    Q_PROPERTY(QUrl yzImage READ yzImage NOTIFY imagesChanged FINAL)
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged FINAL)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged FINAL)
+
+public:
+    explicit ScrollOverview(QObject *parent = nullptr);
+    ~ScrollOverview();
+
+    // The Zarr store and the order of its chunks, as passed to loadAsync.
+    QUrl source() const;
+    void setSource(const QUrl &newSource);
+    QString order() const;
+    void setOrder(const QString &newOrder);
+
+    // Nothing is built while inactive, e.g. while the overview is hidden.
+    bool active() const;
+    void setActive(bool newActive);
+
+    // Size of the store's full resolution level in voxels, x, y and z.
+    QVector3D shape() const;
+
+    // Projections along z (x right, y down), along y (x right, z down) and
+    // along x (y right, z down). Empty until the first part is built.
+    QUrl xyImage() const;
+    QUrl xzImage() const;
+    QUrl yzImage() const;
+
+    bool running() const;
+    qreal progress() const;
+
+signals:
+    void sourceChanged();
+    void orderChanged();
+    void activeChanged();
+    void imagesChanged();
+    void runningChanged();
+    void progressChanged();
+
+private:
+    friend class OverviewImageProvider;
+
+    struct Images
+    {
+        QImage xy;
+        QImage xz;
+        QImage yz;
+        QVector3D shape;
+        bool complete = false; // Every chunk was read, worth caching.
+    };
+
+    void start();
+    void setImages(const Images &images);
+    void setRunning(bool newRunning);
+    void setProgress(qreal newProgress);
+    QUrl imageUrl(const QString &view) const;
+
+    static Images build(const QUrl &source, const QString &order, const std::shared_ptr<std::atomic_bool> &cancelled,
+                        const std::function<void(const Images &partial, qreal progress)> &progress);
+    static QString cachePath(const QString &key, const QString &view);
+    static bool readCache(const QString &key, Images *images);
+    static void writeCache(const QString &key, const Images &images);
+
+    QUrl m_source;
+    QString m_order = "C";
+    bool m_active = false;
+    QString m_key; // Identifies the store's images in the provider and the disk cache.
+    QString m_builtKey; // Of the last build that was started.
+    QVector3D m_shape;
+    int m_revision = 0; // Part of the image URLs, so QML reloads them.
+    bool m_running = false;
+    qreal m_progress = 0.0;
+
+    quint64 m_generation = 0;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    LoaderTaskGroup m_tasks;
+};
+
+// Serves the overview images as "image://overview/<key>/<view>". They are
+// held in a cache counted against MemoryBudget; evicted images of complete
+// builds are read back from the disk cache.
+class OverviewImageProvider : public QQuickImageProvider
+{
+public:
+    OverviewImageProvider();
+
+    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override;
+
+    static void setImage(const QString &id, const QImage &image);
+};
+
+#endif // SCROLLOVERVIEW_H
@@ -1,8 +1,24 @@
 #include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
 #include <QJsonValue>
 #include <QJsonArray>
 #include <QJsonObject>
+#include <QPromise>
+#include <QtEndian>
 #include <QtGlobal>
+#include <QtNumeric>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 #include <src/storagezarr.h>
 #include <blosc2.h> //Zarr decompression.
@@ -16,11 +32,15 @@ StorageZarr::~StorageZarr()
 {
 }
 
-QByteArray StorageZarr::readChunk(const QByteArray& data)
+QByteArray StorageZarr::readChunk(const QByteArray& data, MemoryReservation* reservation) const
 {
     /* Decompress  */
     if (m_meta.compressor.id == "blosc") {
         qsizetype chunkSizeBytes = getChunkSizeBytes();
+        MemoryReservation decodedReservation = MemoryBudget::instance()->reserve(MemoryBudget::Decoded, chunkSizeBytes);
+        if (!decodedReservation.isValid()) {
+            return QByteArray(); // Empty.
+        }
         QByteArray newData(chunkSizeBytes, Qt::Uninitialized);
 
         int err = blosc2_decompress(data.constData(), data.size(), newData.data(), newData.size());
@@ -28,9 +48,20 @@ QByteArray StorageZarr::readChunk(const QByteArray& data)
             qWarning() << "Blosc2 Decompression error. Error code:" << err;
             return QByteArray(); // Empty.
         }
+        if (err != chunkSizeBytes) {
+            // The rest of newData would be uninitialized, yet pass every size check after this.
+            qWarning() << "Blosc2 chunk decompressed to" << err << "bytes instead of" << chunkSizeBytes;
+            return QByteArray(); // Empty.
+        }
 
+        if (reservation) {
+            *reservation = decodedReservation;
+        }
         return newData;
     } else if (m_meta.compressor.id.isEmpty()) { // No compression.
+        if (reservation) {
+            *reservation = MemoryBudget::instance()->track(MemoryBudget::Decoded, data.size());
+        }
         return data;
     } else {
         qWarning() << "Compressor not available" << m_meta.compressor.id;
@@ -39,6 +70,465 @@ QByteArray StorageZarr::readChunk(const QByteArray& data)
 
 }
 
+// Chunk layouts that differ from C order. Both keep z fastest.
+enum class ChunkLayout { F, YXZ };
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Transpose a square block of T, one 16 byte row per vector. Every round
+// interleaves the top half of the rows with the bottom half, after
+// log2(rows) rounds the rows are columns.
+template<typename T>
+static inline void transposeBlock(const T* src, qsizetype srcStride, T* dst, qsizetype dstStride)
+{
+    constexpr int kRows = 16 / sizeof(T);
+    __m128i rows[kRows];
+    for (int i = 0; i < kRows; i++)
+        rows[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + srcStride * i));
+    for (int round = 1; round < kRows; round *= 2) {
+        __m128i next[kRows];
+        for (int i = 0; i < kRows / 2; i++) {
+            const __m128i a = rows[i];
+            const __m128i b = rows[i + kRows / 2];
+            if constexpr (sizeof(T) == 1) {
+                next[2 * i] = _mm_unpacklo_epi8(a, b);
+                next[2 * i + 1] = _mm_unpackhi_epi8(a, b);
+            } else if constexpr (sizeof(T) == 2) {
+                next[2 * i] = _mm_unpacklo_epi16(a, b);
+                next[2 * i + 1] = _mm_unpackhi_epi16(a, b);
+            } else if constexpr (sizeof(T) == 4) {
+                next[2 * i] = _mm_unpacklo_epi32(a, b);
+                next[2 * i + 1] = _mm_unpackhi_epi32(a, b);
+            } else {
+                next[2 * i] = _mm_unpacklo_epi64(a, b);
+                next[2 * i + 1] = _mm_unpackhi_epi64(a, b);
+            }
+        }
+        for (int i = 0; i < kRows; i++)
+            rows[i] = next[i];
+    }
+    for (int i = 0; i < kRows; i++)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + dstStride * i), rows[i]);
+}
+#else
+// Transpose a square block of T, one 64-bit word per row, by swapping ever
+// larger sub-blocks across the diagonal.
+template<typename T>
+static inline void transposeBlock(const T* src, qsizetype srcStride, T* dst, qsizetype dstStride)
+{
+    constexpr int kRows = 8 / sizeof(T);
+    constexpr uint64_t kMasks[] = { 0x00FF00FF00FF00FFull, 0x0000FFFF0000FFFFull, 0x00000000FFFFFFFFull };
+    uint64_t rows[kRows];
+    for (int i = 0; i < kRows; i++)
+        std::memcpy(&rows[i], src + srcStride * i, sizeof(rows[i]));
+    int mask = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : 2;
+    for (int shift = 8 * sizeof(T), step = 1; shift < 64; shift *= 2, step *= 2, mask++) {
+        for (int block = 0; block < kRows; block += 2 * step) {
+            for (int i = block; i < block + step; i++) {
+                const uint64_t t = ((rows[i] >> shift) ^ rows[i + step]) & kMasks[mask];
+                rows[i + step] ^= t;
+                rows[i] ^= t << shift;
+            }
+        }
+    }
+    for (int i = 0; i < kRows; i++)
+        std::memcpy(dst + dstStride * i, &rows[i], sizeof(rows[i]));
+}
+#endif
+
+// Transpose an x by z plane with rows srcStride apart into a z by x plane
+// with rows dstStride apart.
+template<typename T>
+static void transposePlane(const T* src, qsizetype srcStride, T* dst, qsizetype dstStride, qsizetype width, qsizetype depth)
+{
+#if defined(__SSE2__) || defined(_M_X64)
+    constexpr qsizetype kBlock = 16 / sizeof(T);
+#else
+    constexpr qsizetype kBlock = 8 / sizeof(T);
+#endif
+    const qsizetype blockWidth = width - width % kBlock;
+    const qsizetype blockDepth = depth - depth % kBlock;
+    for (qsizetype z = 0; z < blockDepth; z += kBlock) {
+        for (qsizetype x = 0; x < blockWidth; x += kBlock)
+            transposeBlock(src + z + srcStride * x, srcStride, dst + x + dstStride * z, dstStride);
+        for (qsizetype x = blockWidth; x < width; x++) // Edge of a plane that is not a multiple of the block.
+            for (qsizetype i = z; i < z + kBlock; i++)
+                dst[x + dstStride * i] = src[i + srcStride * x];
+    }
+    for (qsizetype z = blockDepth; z < depth; z++)
+        for (qsizetype x = 0; x < width; x++)
+            dst[x + dstStride * z] = src[z + srcStride * x];
+}
+
+// Transpose a chunk from `Layout` into C order, x fastest. For every row y
+// the chunk is an x by z plane to transpose. Rows are done in slabs that fit
+// in cache: a slab is gathered, transposed between two buffers and scattered,
+// so memory is only read and written in runs of whole slab rows.
+template<ChunkLayout Layout, typename T>
+static void transposeChunk(const T* src, T* dst, qsizetype width, qsizetype height, qsizetype depth, bool parallel)
+{
+    constexpr qsizetype kSlabBytes = 128 * 1024;
+    const qsizetype plane = width * depth;
+    const qsizetype slabRows = qBound<qsizetype>(1, kSlabBytes / qsizetype(plane * sizeof(T)), height);
+    const qsizetype slabs = (height + slabRows - 1) / slabRows;
+
+#pragma omp parallel if (parallel)
+    {
+        std::vector<T> gathered(Layout == ChunkLayout::F ? slabRows * plane : 0);
+        std::vector<T> transposed(slabRows * plane);
+#pragma omp for schedule(static)
+        for (qsizetype slab = 0; slab < slabs; slab++) {
+            const qsizetype y0 = slab * slabRows;
+            const qsizetype rows = qMin(slabRows, height - y0);
+
+            // The slab as rows x of rows y of z.
+            const T* in = src + plane * y0; // "yxz" slabs are contiguous: rows y of rows x of z.
+            qsizetype strideX = depth;
+            qsizetype strideY = plane;
+            if constexpr (Layout == ChunkLayout::F) {
+                for (qsizetype x = 0; x < width; x++)
+                    std::memcpy(gathered.data() + rows * depth * x, src + depth * (y0 + height * x), rows * depth * sizeof(T));
+                in = gathered.data();
+                strideX = rows * depth;
+                strideY = depth;
+            }
+
+            for (qsizetype y = 0; y < rows; y++)
+                transposePlane(in + strideY * y, strideX, transposed.data() + width * y, rows * width, width, depth);
+            for (qsizetype z = 0; z < depth; z++)
+                std::memcpy(dst + width * (y0 + height * z), transposed.data() + rows * width * z, rows * width * sizeof(T));
+        }
+    }
+}
+
+// Only the element size matters to a transpose.
+template<ChunkLayout Layout>
+static void transposeChunkBytes(const char* src, char* dst, int typeSize, qsizetype width, qsizetype height, qsizetype depth, bool parallel)
+{
+    switch (typeSize) {
+    case 2:
+        transposeChunk<Layout>(reinterpret_cast<const uint16_t*>(src), reinterpret_cast<uint16_t*>(dst), width, height, depth, parallel);
+        break;
+    case 4:
+        transposeChunk<Layout>(reinterpret_cast<const uint32_t*>(src), reinterpret_cast<uint32_t*>(dst), width, height, depth, parallel);
+        break;
+    case 8:
+        transposeChunk<Layout>(reinterpret_cast<const uint64_t*>(src), reinterpret_cast<uint64_t*>(dst), width, height, depth, parallel);
+        break;
+    default:
+        transposeChunk<Layout>(reinterpret_cast<const uint8_t*>(src), reinterpret_cast<uint8_t*>(dst), width, height, depth, parallel);
+        break;
+    }
+}
+
+QByteArray StorageZarr::reorderChunk(const QByteArray& data, MemoryReservation* reservation, bool parallel) const
+{
+    if (!needsReorder() || data.isEmpty()) {
+        return data;
+    }
+    const auto [depth, height, width] = m_meta.chunks;
+    if (data.size() != qsizetype(getChunkSizeBytes())) {
+        qWarning() << "Chunk has an unexpected size for reordering:" << data.size();
+        return QByteArray(); // Empty.
+    }
+
+    MemoryReservation reorderedReservation = MemoryBudget::instance()->reserve(MemoryBudget::Decoded, data.size());
+    if (!reorderedReservation.isValid()) {
+        return QByteArray(); // Empty.
+    }
+    QByteArray reordered(data.size(), Qt::Uninitialized);
+    if (m_meta.order == "F") {
+        transposeChunkBytes<ChunkLayout::F>(data.constData(), reordered.data(), getDataTypeSizeBytes(), width, height, depth, parallel);
+    } else {
+        transposeChunkBytes<ChunkLayout::YXZ>(data.constData(), reordered.data(), getDataTypeSizeBytes(), width, height, depth, parallel);
+    }
+
+    if (reservation) {
+        *reservation = reorderedReservation;
+    }
+    return reordered;
+}
+
+QByteArray StorageZarr::readLocalMetadata(int level)
+{
+    QFile file(getMetadataUrl(level).toLocalFile());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray(); // Empty.
+    }
+    return file.readAll();
+}
+
+QByteArray StorageZarr::readLocalConsolidatedMetadata()
+{
+    QFile file(getConsolidatedMetadataUrl().toLocalFile());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray(); // Empty.
+    }
+    return file.readAll();
+}
+
+QString StorageZarr::localChunkPath(int level, int z, int y, int x) const
+{
+    const QString path = getChunkUrl(level, z, y, x).toLocalFile();
+    if (QFileInfo::exists(path)) {
+        return path;
+    }
+    // Stores written without "dimension_separator" may still be nested (or flat), try the other layout.
+    const QString otherSeparator = m_meta.dimensionSeparator == "/" ? "." : "/";
+    const QString otherPath = getChunkUrl(level, z, y, x, otherSeparator).toLocalFile();
+    return QFileInfo::exists(otherPath) ? otherPath : QString();
+}
+
+bool StorageZarr::hasLocalChunk(int level, int z, int y, int x) const
+{
+    return !localChunkPath(level, z, y, x).isEmpty();
+}
+
+bool StorageZarr::openLocalChunk(QFile& file, int level, int z, int y, int x) const
+{
+    const QString path = localChunkPath(level, z, y, x);
+    if (path.isEmpty()) {
+        qDebug() << "Missing chunk:" << getChunkUrl(level, z, y, x).toLocalFile();
+        return false;
+    }
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open chunk:" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+QByteArray StorageZarr::readLocalChunk(int level, int z, int y, int x, MemoryReservation* reservation) const
+{
+    QFile file;
+    if (!openLocalChunk(file, level, z, y, x)) {
+        return QByteArray(); // Empty.
+    }
+    if (m_meta.compressor.id.isEmpty()) { // No compression, a plain read is a single copy.
+        MemoryReservation decodedReservation = MemoryBudget::instance()->reserve(MemoryBudget::Decoded, file.size());
+        if (!decodedReservation.isValid()) {
+            return QByteArray(); // Empty.
+        }
+        if (reservation) {
+            *reservation = decodedReservation;
+        }
+        return file.readAll();
+    }
+
+    // Decompress straight from the page cache instead of copying the compressed bytes first.
+    const qint64 size = file.size();
+    if (uchar* mapped = file.map(0, size)) {
+        QByteArray result = readChunk(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), size), reservation);
+        file.unmap(mapped);
+        return result;
+    }
+    return readChunk(file.readAll(), reservation);
+}
+
+QByteArray StorageZarr::readLocalChunkSlices(int level, int z, int y, int x, int zBegin, int zEnd, MemoryReservation* reservation, const SlabCallback& onSlab) const
+{
+    QFile file;
+    if (!openLocalChunk(file, level, z, y, x)) {
+        return QByteArray(); // Empty.
+    }
+
+    // Only the pages of the blocks holding the slices are read from disk.
+    const qint64 size = file.size();
+    if (uchar* mapped = file.map(0, size)) {
+        QByteArray result = readChunkSlices(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), size), zBegin, zEnd, reservation, onSlab);
+        file.unmap(mapped);
+        return result;
+    }
+    return readChunkSlices(file.readAll(), zBegin, zEnd, reservation, onSlab);
+}
+
+bool StorageZarr::getChunkSpan(const QByteArray& head, qint64 begin, qint64 count, ChunkSpan* span)
+{
+    if (head.size() < BLOSC_MIN_HEADER_LENGTH) {
+        span->headerBytes = BLOSC_EXTENDED_HEADER_LENGTH;
+        return false;
+    }
+
+    const auto header = reinterpret_cast<const uchar*>(head.constData());
+    const uchar flags = header[2];
+    const qint64 nbytes = qFromLittleEndian<qint32>(header + 4);
+    const qint64 blocksize = qFromLittleEndian<qint32>(header + 8);
+    span->size = qFromLittleEndian<qint32>(header + 12);
+
+    // Both shuffle bits set mark the 32 byte header of Blosc2, Blosc1 headers are 16 bytes.
+    const bool extended = (flags & BLOSC_DOSHUFFLE) && (flags & BLOSC_DOBITSHUFFLE);
+    const qint64 headerLength = extended ? BLOSC_EXTENDED_HEADER_LENGTH : BLOSC_MIN_HEADER_LENGTH;
+    if (head.size() < headerLength) {
+        span->headerBytes = headerLength;
+        return false;
+    }
+    if (blocksize <= 0 || nbytes <= 0 || begin < 0 || count <= 0 || begin + count > nbytes) {
+        return false;
+    }
+
+    // Stored uncompressed, or a Blosc2 chunk of one repeated value: no blocks to locate.
+    const bool special = extended && (header[BLOSC_EXTENDED_HEADER_LENGTH - 1] & 0x70);
+    if (flags & BLOSC_MEMCPYED) {
+        span->headerBytes = headerLength;
+        span->begin = headerLength + begin;
+        span->end = span->begin + count;
+        return true;
+    }
+    if (special) {
+        span->headerBytes = headerLength;
+        span->begin = span->end = headerLength;
+        return true;
+    }
+
+    const qint64 blocks = (nbytes + blocksize - 1) / blocksize;
+    span->headerBytes = headerLength + blocks * qint64(sizeof(qint32));
+    if (head.size() < span->headerBytes) {
+        return false;
+    }
+
+    // Blocks may be stored out of order when compressed in parallel, a block
+    // ends where the next stored block starts.
+    QList<qint64> starts(blocks);
+    for (qint64 i = 0; i < blocks; i++) {
+        starts[i] = qFromLittleEndian<qint32>(header + headerLength + i * sizeof(qint32));
+    }
+    QList<qint64> sorted = starts;
+    std::sort(sorted.begin(), sorted.end());
+
+    span->begin = span->size;
+    span->end = span->headerBytes;
+    for (qint64 i = begin / blocksize; i <= (begin + count - 1) / blocksize; i++) {
+        const auto next = std::upper_bound(sorted.begin(), sorted.end(), starts[i]);
+        span->begin = qMin(span->begin, starts[i]);
+        span->end = qMax(span->end, next != sorted.end() ? *next : span->size);
+    }
+    return span->begin < span->end && span->end <= span->size;
+}
+
+QFuture<FetchedResource> StorageZarr::fetchChunkSpan(QUrl chunkUrl, qint64 begin, qint64 count)
+{
+    // Enough for the header and block offsets of most chunks, so one round trip finds the span.
+    constexpr qint64 kHeadBytes = 16 * 1024;
+
+    auto promise = std::make_shared<QPromise<FetchedResource>>();
+    QFuture<FetchedResource> future = promise->future();
+    promise->start();
+    const auto finish = [promise](const FetchedResource& result) {
+        promise->addResult(result);
+        promise->finish();
+    };
+
+    // Fetch the span once the header is known, the head is fetched again when it was too short.
+    auto fetchHead = std::make_shared<std::function<void(qint64)>>();
+    // Cancelling the span cancels the fetch of its part in flight.
+    *fetchHead = [=](qint64 headBytes) {
+        QFuture<FetchedResource> headFetch = fetchResourceAsync(chunkUrl, 0, headBytes);
+        cancelFetchWith(future, headFetch);
+        headFetch.then([=](FetchedResource head) {
+            if (head.status != FetchedResource::Ok || !head.isRange) {
+                finish(head); // Failed, missing or the whole chunk.
+                (*fetchHead) = nullptr; // Break the cycle.
+                return;
+            }
+
+            ChunkSpan span;
+            if (!getChunkSpan(head.data, begin, count, &span)) {
+                if (span.headerBytes > head.data.size() && head.data.size() == headBytes) {
+                    (*fetchHead)(span.headerBytes);
+                    return;
+                }
+                qWarning() << "Not a blosc chunk:" << chunkUrl;
+                finish(FetchedResource()); // Failed.
+                (*fetchHead) = nullptr;
+                return;
+            }
+            (*fetchHead) = nullptr;
+
+            const auto assemble = [span, head](const QByteArray& body, qint64 bodyOffset) {
+                FetchedResource result;
+                result.reservation = MemoryBudget::instance()->reserve(MemoryBudget::Network, span.size);
+                if (!result.reservation.isValid()) {
+                    return result; // Failed.
+                }
+                result.status = FetchedResource::Ok;
+                result.data = QByteArray(span.size, 0); // Blocks outside the span stay empty.
+                std::copy_n(head.data.constData(), qMin<qint64>(head.data.size(), span.size), result.data.data());
+                std::copy_n(body.constData(), qMin<qint64>(body.size(), span.size - bodyOffset), result.data.data() + bodyOffset);
+                return result;
+            };
+
+            if (span.end <= head.data.size()) {
+                finish(assemble(QByteArray(), 0)); // The head already holds the blocks.
+                return;
+            }
+            QFuture<FetchedResource> bodyFetch = fetchResourceAsync(chunkUrl, span.begin, span.end - span.begin);
+            cancelFetchWith(future, bodyFetch);
+            bodyFetch.then([=](FetchedResource body) {
+                if (body.status != FetchedResource::Ok || !body.isRange) {
+                    finish(body);
+                    return;
+                }
+                finish(assemble(body.data, span.begin));
+            }).onCanceled([=] { finish(FetchedResource()); });
+        }).onCanceled([=] {
+            finish(FetchedResource());
+            (*fetchHead) = nullptr;
+        });
+    };
+    (*fetchHead)(kHeadBytes);
+
+    return future;
+}
+
+QByteArray StorageZarr::readChunkSlices(const QByteArray& data, int zBegin, int zEnd, MemoryReservation* reservation, const SlabCallback& onSlab) const
+{
+    constexpr int kSlabs = 8; // Per chunk, when decoding slab by slab.
+
+    const qint64 sliceBytes = qint64(getDataTypeSizeBytes()) * std::get<1>(m_meta.chunks) * std::get<2>(m_meta.chunks);
+    const qint64 begin = sliceBytes * zBegin;
+    const qint64 count = sliceBytes * (zEnd - zBegin);
+    if (data.size() < BLOSC_MIN_HEADER_LENGTH || count <= 0) {
+        return QByteArray(); // Empty.
+    }
+
+    MemoryReservation decodedReservation = MemoryBudget::instance()->reserve(MemoryBudget::Decoded, count);
+    if (!decodedReservation.isValid()) {
+        return QByteArray(); // Empty.
+    }
+    QByteArray newData(count, Qt::Uninitialized);
+
+    // Items are counted in the chunk's type size, which is not always the dtype size.
+    const int typesize = qMax(1, int(uchar(data[3])));
+
+    // Slabs end on block boundaries where they can, a block split between
+    // two slabs is decoded twice.
+    int slabSlices = zEnd - zBegin;
+    if (onSlab) {
+        const qint64 blocksize = qFromLittleEndian<qint32>(reinterpret_cast<const uchar*>(data.constData()) + 8);
+        const int blockSlices = int(qBound<qint64>(1, (blocksize + sliceBytes - 1) / sliceBytes, zEnd - zBegin));
+        const int targetSlices = (zEnd - zBegin + kSlabs - 1) / kSlabs;
+        slabSlices = (targetSlices + blockSlices - 1) / blockSlices * blockSlices;
+    }
+    for (int z = zBegin; z < zEnd; z += slabSlices) {
+        const int slabEnd = qMin(z + slabSlices, zEnd);
+        const qint64 offset = sliceBytes * (z - zBegin);
+        const qint64 slabBytes = sliceBytes * (slabEnd - z);
+        int err = blosc2_getitem(data.constData(), data.size(), (begin + offset) / typesize, slabBytes / typesize, newData.data() + offset, slabBytes);
+        if (err < 0) {
+            qWarning() << "Blosc2 partial decompression error. Error code:" << err;
+            return QByteArray(); // Empty.
+        }
+        if (onSlab) {
+            onSlab(z, slabEnd, newData.constData() + offset);
+        }
+    }
+
+    if (reservation) {
+        *reservation = decodedReservation;
+    }
+    return newData;
+}
+
 QUrl StorageZarr::getMetadataUrl(int level)
 {
     QString combinedPath = m_baseUrl.path();
@@ -52,15 +542,53 @@ QUrl StorageZarr::getMetadataUrl(int level)
     return metadataUrl;
 }
 
-QUrl StorageZarr::getChunkUrl(int level, int z, int y, int x) {
-    QStringList coordinates;
-    if (m_meta.order == "C") {
-        coordinates << QString::number(z) << QString::number(y) << QString::number(x);
+QUrl StorageZarr::getConsolidatedMetadataUrl()
+{
+    QString combinedPath = m_baseUrl.path();
+    if (!combinedPath.endsWith('/')) {
+        combinedPath += '/';
     }
-    else if (m_meta.order == "yxz") { // This order value is not in the spec.
+    combinedPath += ".zmetadata";
+    QUrl combinedPathUrl(combinedPath);
+    return m_baseUrl.resolved(combinedPathUrl);
+}
+
+QString StorageZarr::getConsolidatedMetadataKey(int level)
+{
+    return level >= 0 ? QString("%1/.zarray").arg(level) : QString(".zarray");
+}
+
+QString StorageZarr::getDataTypeName() const
+{
+    // The byte order prefix is irrelevant for single byte types and we only run on little-endian hosts.
+    static const QHash<QString, QString> dataTypeNames = {
+        { "|u1", "uint8" },
+        { "<u1", "uint8" },
+        { "|u2", "uint16" },
+        { "<u2", "uint16" },
+        { "|i2", "int16" },
+        { "<i2", "int16" },
+        { "|f4", "float32" },
+        { "<f4", "float32" },
+        { "|f8", "float64" },
+        { "<f8", "float64" },
+    };
+    return dataTypeNames.value(m_meta.dtype);
+}
+
+QUrl StorageZarr::getChunkUrl(int level, int z, int y, int x) const {
+    return getChunkUrl(level, z, y, x, m_meta.dimensionSeparator);
+}
+
+QUrl StorageZarr::getChunkUrl(int level, int z, int y, int x, const QString& separator) const {
+    QStringList coordinates;
+    if (m_meta.order == "yxz") { // This order value is not in the spec.
         coordinates << QString::number(y) << QString::number(x) << QString::number(z);
     }
-    QString chunkResourcePath = "/" + coordinates.join(m_meta.dimensionSeparator);
+    else { // Keys follow the array's dimensions, "F" only changes the layout inside a chunk.
+        coordinates << QString::number(z) << QString::number(y) << QString::number(x);
+    }
+    QString chunkResourcePath = "/" + coordinates.join(separator);
     QString combinedPath = m_baseUrl.path();
     if (level >= 0) {
         QString levelPath = QString("/%1").arg(level);
@@ -137,6 +665,17 @@ StorageZarr::Metadata StorageZarr::Metadata::fromJson(const QJsonObject& json)
         result.compression = compression.toString();
     }
 
+    // Non-finite fill values are spelled out as strings in JSON.
+    if (const QJsonValue fillValue = json["fill_value"]; fillValue.isDouble()) {
+        result.fillValue = fillValue.toDouble();
+    } else if (fillValue.toString() == "NaN") {
+        result.fillValue = qQNaN();
+    } else if (fillValue.toString() == "Infinity") {
+        result.fillValue = qInf();
+    } else if (fillValue.toString() == "-Infinity") {
+        result.fillValue = -qInf();
+    }
+
     if (const QJsonValue compressor = json["compressor"]; compressor.isObject()) {
         if (const QJsonValue id = compressor["id"]; id.isString()) {
             result.compressor.id = id.toString();
@@ -3,11 +3,48 @@
 
 #include <QUrl>
 #include <QByteArray>
+#include <QFuture>
+#include <QFile>
 #include <QJsonDocument>
+#include <QtNumeric>
+
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+#include <src/memorybudget.h>
+#include <src/resourcefetcher.h>
 
 template<typename T>
 using triplet = std::tuple<T, T, T>;
 
+// Call `visitor` with a value of the C++ type behind a viewer data type name,
+// unknown names are read as uint8.
+template<typename Visitor>
+void visitDataType(const QString &dataType, Visitor &&visitor)
+{
+    if (dataType == "uint16")
+        visitor(uint16_t());
+    else if (dataType == "int16")
+        visitor(int16_t());
+    else if (dataType == "float32")
+        visitor(float());
+    else if (dataType == "float64")
+        visitor(double());
+    else
+        visitor(uint8_t());
+}
+
+// A store's fill value in its own type, non-finite values read as 0 for integer types.
+template<typename T>
+T fillValueAs(double fillValue)
+{
+    if constexpr (std::is_integral_v<T>)
+        return qIsFinite(fillValue) ? T(qBound<double>(std::numeric_limits<T>::lowest(), fillValue, std::numeric_limits<T>::max())) : T(0);
+    else
+        return T(fillValue);
+}
+
 // Interface to access large N-dimensional typed arrays stored in Zarr format.
 class StorageZarr
 {
@@ -32,36 +69,115 @@ public:
         QString dtype;
         QString compression;
         Compressor compressor;
+        double fillValue = 0; // Value of every element of a chunk the store leaves out, null reads as 0.
+
+        bool isValid() const { return version >= 0; }
 
         static Metadata fromJson(const QJsonObject& json);
         static Metadata fromByteArray(const QByteArray& data);
     };
 
+    // Bytes of a blosc compressed chunk needed to decode part of it.
+    struct ChunkSpan
+    {
+        qint64 headerBytes = 0; // Header and block offsets.
+        qint64 begin = 0; // Compressed bytes of the blocks holding the requested bytes.
+        qint64 end = 0;
+        qint64 size = 0; // Size of the whole compressed chunk.
+    };
+
+    // Called with decoded z slices [zBegin, zEnd) of a chunk as soon as they are decoded.
+    using SlabCallback = std::function<void(int zBegin, int zEnd, const char* slices)>;
+
     StorageZarr(QUrl url);
     ~StorageZarr();
 
     // Get URL to the metadata resource.
     QUrl getMetadataUrl(int level = -1);
+    // Get URL to the consolidated metadata of the whole hierarchy.
+    QUrl getConsolidatedMetadataUrl();
+    // Key of a level's metadata inside the consolidated metadata.
+    static QString getConsolidatedMetadataKey(int level = -1);
     // Get URL to the chunk resource.
-    QUrl getChunkUrl(int level, int z, int y, int x);
+    QUrl getChunkUrl(int level, int z, int y, int x) const;
 
     void setMetadata(const QByteArray& data) {
         m_meta = Metadata::fromByteArray(data);
     }
+    void setMetadata(const Metadata& meta) {
+        m_meta = meta;
+    }
 
-    std::tuple<int, int, int> getChunks() {
+    std::tuple<int, int, int> getChunks() const {
         return m_meta.chunks;
     }
 
+    std::tuple<int, int, int> getShape() const {
+        return m_meta.shape;
+    }
+
     size_t getChunkSizeBytes() const {
-        size_t dataTypeSizeBytes = 1;
+        size_t dataTypeSizeBytes = getDataTypeSizeBytes();
         return dataTypeSizeBytes * std::get<0>(m_meta.chunks) * std::get<1>(m_meta.chunks) * std::get<2>(m_meta.chunks);
     }
 
+    // Bytes per element, from the size suffix of the dtype ("<u2" is 2).
+    int getDataTypeSizeBytes() const {
+        return qMax(1, m_meta.dtype.mid(2).toInt());
+    }
+
     triplet<int> getNearestChunk(triplet<int> point); // z, y, x
     triplet<float> getNearestChunkRemainder(triplet<int> point); // z, y, x
 
-    QByteArray readChunk(const QByteArray& data);
+    // Decompress a chunk. The decompressed bytes are reserved against the
+    // memory budget; the reservation is handed out through `reservation`.
+    QByteArray readChunk(const QByteArray& data, MemoryReservation* reservation = nullptr) const;
+
+    // True when decoded chunks are not in C order and go through reorderChunk.
+    bool needsReorder() const {
+        return m_meta.order == "F" || m_meta.order == "yxz";
+    }
+    // Reorder a decoded chunk into C order, x fastest, the layout of the
+    // texture. "F" chunks are stored z fastest and "yxz" chunks are stored as
+    // (y, x, z). The reordered bytes replace the chunk's reservation. Runs
+    // across slabs of the chunk when `parallel` is set.
+    QByteArray reorderChunk(const QByteArray& data, MemoryReservation* reservation = nullptr, bool parallel = true) const;
+
+    // True when part of a chunk can be decoded on its own: blosc chunks in C
+    // order, where a range of z slices is a contiguous range of items.
+    bool canReadPartially() const {
+        return m_meta.compressor.id == "blosc" && m_meta.order == "C";
+    }
+    // Locate the blocks holding the decoded bytes [begin, begin + count) from
+    // the start of a compressed chunk. Returns false when `head` is not a blosc
+    // chunk or is shorter than span->headerBytes.
+    static bool getChunkSpan(const QByteArray& head, qint64 begin, qint64 count, ChunkSpan* span);
+    // Fetch only the header and the blocks of a remote chunk needed to decode
+    // the bytes [begin, begin + count). The result is the size of the whole
+    // compressed chunk with the other blocks left empty, or the whole chunk
+    // when the server does not do range requests.
+    static QFuture<FetchedResource> fetchChunkSpan(QUrl chunkUrl, qint64 begin, qint64 count);
+    // Decompress only the z slices [zBegin, zEnd) of a chunk. `data` may be a
+    // chunk fetched with fetchChunkSpan. With `onSlab` the slices are decoded
+    // in z order, a few slabs of whole blocks at a time, and each slab is
+    // handed on before the next is decoded.
+    QByteArray readChunkSlices(const QByteArray& data, int zBegin, int zEnd, MemoryReservation* reservation = nullptr, const SlabCallback& onSlab = {}) const;
+
+    // True when the store is a directory on the local filesystem.
+    bool isLocal() const {
+        return m_baseUrl.isLocalFile();
+    }
+    // Read the metadata resource of a local store, empty when missing.
+    QByteArray readLocalMetadata(int level = -1);
+    // Read the consolidated metadata of a local store, empty when missing.
+    QByteArray readLocalConsolidatedMetadata();
+    // True when a local store holds the chunk file. A read that comes back
+    // empty for a chunk that exists failed, it is not a left out chunk.
+    bool hasLocalChunk(int level, int z, int y, int x) const;
+    // Read and decompress a chunk of a local store, empty when missing.
+    QByteArray readLocalChunk(int level, int z, int y, int x, MemoryReservation* reservation = nullptr) const;
+    // Read a local chunk and decompress only its z slices [zBegin, zEnd).
+    QByteArray readLocalChunkSlices(int level, int z, int y, int x, int zBegin, int zEnd, MemoryReservation* reservation = nullptr, const SlabCallback& onSlab = {}) const;
 
     QString getOrder() const {
         return m_meta.order;
@@ -73,7 +189,20 @@ public:
     QString getDataType() const {
         return m_meta.dtype;
     }
+
+    double getFillValue() const {
+        return m_meta.fillValue;
+    }
+    // Viewer name of the data type ("uint16", ...), empty when not understood.
+    QString getDataTypeName() const;
 private:
+    QUrl getChunkUrl(int level, int z, int y, int x, const QString& separator) const;
+    // Path of a local chunk file in whichever dimension separator layout
+    // exists, empty when neither does.
+    QString localChunkPath(int level, int z, int y, int x) const;
+    // Open a local chunk file, trying both dimension separators.
+    bool openLocalChunk(QFile& file, int level, int z, int y, int x) const;
+
     // The path to the .zarr directory.
     QUrl m_baseUrl;
 
@@ -0,0 +1,1103 @@
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QVector2D>
+#include <QVector3D>
+#include <QWaitCondition>
+#include <QtEndian>
+#include <QtMath>
+
+#include <algorithm>
+#include <array>
+#include <type_traits>
+
+#include <src/memorybudget.h>
+#include <src/resourcefetcher.h>
+#include <src/storagezarr.h>
+#include <src/surfacesampler.h>
+#include <src/zarrsession.h>
+
+// A triangle corner refers to its position, texture coordinate and normal
+// separately, as OBJ faces do.
+struct MeshCorner
+{
+    int position = -1;
+    int uv = -1;
+    int normal = -1;
+};
+
+struct SurfaceMesh
+{
+    QList<QVector3D> positions;
+    QList<QVector2D> uvs;
+    QList<QVector3D> normals;
+    QList<std::array<MeshCorner, 3>> triangles;
+};
+
+// Split polygons into a fan of triangles.
+static void appendPolygon(SurfaceMesh *mesh, const QList<MeshCorner> &corners)
+{
+    for (qsizetype i = 2; i < corners.size(); i++)
+        mesh->triangles.append({ corners[0], corners[i - 1], corners[i] });
+}
+
+// Resolve a 1-based OBJ index, negative indices count back from the end.
+static int objIndex(const QByteArray &token, qsizetype count)
+{
+    bool ok = false;
+    const int index = token.toInt(&ok);
+    if (!ok || index == 0)
+        return -1;
+    return index > 0 ? index - 1 : int(count) + index;
+}
+
+static bool readObj(QFile &file, SurfaceMesh *mesh)
+{
+    while (!file.atEnd()) {
+        const QList<QByteArray> tokens = file.readLine().simplified().split(' ');
+        const QByteArray &type = tokens.first();
+        if (type == "v" && tokens.size() >= 4) {
+            mesh->positions.append(QVector3D(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat()));
+        } else if (type == "vt" && tokens.size() >= 3) {
+            mesh->uvs.append(QVector2D(tokens[1].toFloat(), tokens[2].toFloat()));
+        } else if (type == "vn" && tokens.size() >= 4) {
+            mesh->normals.append(QVector3D(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat()));
+        } else if (type == "f" && tokens.size() >= 4) {
+            QList<MeshCorner> corners;
+            for (qsizetype i = 1; i < tokens.size(); i++) {
+                const QList<QByteArray> indices = tokens[i].split('/'); // v, v/vt, v//vn or v/vt/vn.
+                MeshCorner corner;
+                corner.position = objIndex(indices[0], mesh->positions.size());
+                if (indices.size() > 1)
+                    corner.uv = objIndex(indices[1], mesh->uvs.size());
+                if (indices.size() > 2)
+                    corner.normal = objIndex(indices[2], mesh->normals.size());
+                corners.append(corner);
+            }
+            appendPolygon(mesh, corners);
+        }
+    }
+    return true;
+}
+
+struct PlyProperty
+{
+    QByteArray name;
+    QByteArray type;
+    QByteArray countType; // Set for list properties.
+};
+
+struct PlyElement
+{
+    QByteArray name;
+    qsizetype count = 0;
+    QList<PlyProperty> properties;
+};
+
+static int plyTypeSize(const QByteArray &type)
+{
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+        return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+        return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32")
+        return 4;
+    if (type == "double" || type == "float64")
+        return 8;
+    return 0; // Unknown.
+}
+
+static double plyValue(const QByteArray &type, const char *data)
+{
+    if (type == "char" || type == "int8")
+        return qint8(data[0]);
+    if (type == "uchar" || type == "uint8")
+        return quint8(data[0]);
+    if (type == "short" || type == "int16")
+        return qFromLittleEndian<qint16>(data);
+    if (type == "ushort" || type == "uint16")
+        return qFromLittleEndian<quint16>(data);
+    if (type == "int" || type == "int32")
+        return qFromLittleEndian<qint32>(data);
+    if (type == "uint" || type == "uint32")
+        return qFromLittleEndian<quint32>(data);
+    if (type == "float" || type == "float32")
+        return qFromLittleEndian<float>(data);
+    return qFromLittleEndian<double>(data);
+}
+
+// Reads the values of a PLY body, whitespace separated or little-endian binary.
+class PlyReader
+{
+public:
+    PlyReader(QFile &file, bool binary)
+        : m_file(file), m_binary(binary)
+    {
+        if (m_binary)
+            m_body = m_file.readAll();
+    }
+
+    double read(const QByteArray &type)
+    {
+        if (m_binary) {
+            const int size = plyTypeSize(type);
+            if (size == 0 || m_offset + size > m_body.size()) {
+                m_failed = true;
+                return 0.0;
+            }
+            const double value = plyValue(type, m_body.constData() + m_offset);
+            m_offset += size;
+            return value;
+        }
+
+        while (m_token >= m_tokens.size()) {
+            if (m_file.atEnd()) {
+                m_failed = true;
+                return 0.0;
+            }
+            m_tokens = m_file.readLine().simplified().split(' ');
+            m_token = m_tokens.first().isEmpty() ? m_tokens.size() : 0; // Skip blank lines.
+        }
+        return m_tokens[m_token++].toDouble();
+    }
+
+    bool failed() const { return m_failed; }
+
+private:
+    QFile &m_file;
+    bool m_binary = false;
+    bool m_failed = false;
+    QByteArray m_body;
+    qsizetype m_offset = 0;
+    QList<QByteArray> m_tokens;
+    qsizetype m_token = 0;
+};
+
+static bool readPly(QFile &file, SurfaceMesh *mesh)
+{
+    if (file.readLine().trimmed() != "ply")
+        return false;
+
+    bool binary = false;
+    QList<PlyElement> elements;
+    while (true) {
+        if (file.atEnd())
+            return false;
+        const QList<QByteArray> tokens = file.readLine().simplified().split(' ');
+        if (tokens.first() == "end_header")
+            break;
+        if (tokens.first() == "format" && tokens.size() >= 2) {
+            if (tokens[1] == "binary_little_endian") {
+                binary = true;
+            } else if (tokens[1] != "ascii") {
+                qWarning() << "PLY format is not supported:" << tokens[1];
+                return false;
+            }
+        } else if (tokens.first() == "element" && tokens.size() >= 3) {
+            elements.append({ tokens[1], tokens[2].toLongLong(), {} });
+        } else if (tokens.first() == "property" && !elements.isEmpty()) {
+            if (tokens.size() >= 5 && tokens[1] == "list")
+                elements.last().properties.append({ tokens[4], tokens[3], tokens[2] });
+            else if (tokens.size() >= 3)
+                elements.last().properties.append({ tokens[2], tokens[1], {} });
+        }
+    }
+
+    PlyReader reader(file, binary);
+    for (const PlyElement &element : std::as_const(elements)) {
+        const bool isVertex = element.name == "vertex";
+        const bool isFace = element.name == "face";
+        for (qsizetype i = 0; i < element.count; i++) {
+            QVector3D position;
+            QVector3D normal;
+            QVector2D uv;
+            bool hasNormal = false;
+            bool hasUv = false;
+            QList<int> indices;
+            QList<double> texcoords;
+            for (const PlyProperty &property : element.properties) {
+                if (!property.countType.isEmpty()) {
+                    const int count = int(reader.read(property.countType));
+                    for (int j = 0; j < count && !reader.failed(); j++) {
+                        const double value = reader.read(property.type);
+                        if (property.name == "vertex_indices" || property.name == "vertex_index")
+                            indices.append(int(value));
+                        else if (property.name == "texcoord")
+                            texcoords.append(value);
+                    }
+                    continue;
+                }
+                const float value = float(reader.read(property.type));
+                if (!isVertex)
+                    continue;
+                const QByteArray &name = property.name;
+                if (name == "x") {
+                    position.setX(value);
+                } else if (name == "y") {
+                    position.setY(value);
+                } else if (name == "z") {
+                    position.setZ(value);
+                } else if (name == "nx") {
+                    normal.setX(value);
+                    hasNormal = true;
+                } else if (name == "ny") {
+                    normal.setY(value);
+                    hasNormal = true;
+                } else if (name == "nz") {
+                    normal.setZ(value);
+                    hasNormal = true;
+                } else if (name == "s" || name == "u" || name == "texture_u") {
+                    uv.setX(value);
+                    hasUv = true;
+                } else if (name == "t" || name == "v" || name == "texture_v") {
+                    uv.setY(value);
+                    hasUv = true;
+                }
+            }
+            if (reader.failed()) {
+                qWarning() << "PLY file is truncated:" << file.fileName();
+                return false;
+            }
+
+            if (isVertex) {
+                mesh->positions.append(position);
+                if (hasNormal)
+                    mesh->normals.append(normal);
+                if (hasUv)
+                    mesh->uvs.append(uv);
+            } else if (isFace) {
+                // Faces either use the texture coordinates of their vertices or carry one per corner.
+                const bool cornerUvs = texcoords.size() == 2 * indices.size();
+                const bool vertexNormals = mesh->normals.size() == mesh->positions.size();
+                QList<MeshCorner> corners;
+                for (qsizetype j = 0; j < indices.size(); j++) {
+                    MeshCorner corner;
+                    corner.position = indices[j];
+                    corner.normal = vertexNormals ? indices[j] : -1;
+                    if (cornerUvs) {
+                        corner.uv = int(mesh->uvs.size());
+                        mesh->uvs.append(QVector2D(texcoords[2 * j], texcoords[2 * j + 1]));
+                    } else {
+                        corner.uv = indices[j];
+                    }
+                    corners.append(corner);
+                }
+                appendPolygon(mesh, corners);
+            }
+        }
+    }
+    return true;
+}
+
+// Drop triangles without positions or texture coordinates and fill in
+// normals where the file has none, area weighted per position.
+static void validateMesh(SurfaceMesh *mesh)
+{
+    const auto inRange = [](int index, qsizetype size) { return index >= 0 && index < size; };
+    QList<std::array<MeshCorner, 3>> triangles;
+    triangles.reserve(mesh->triangles.size());
+    bool missingNormals = false;
+    for (auto triangle : std::as_const(mesh->triangles)) {
+        bool valid = true;
+        for (MeshCorner &corner : triangle) {
+            valid = valid && inRange(corner.position, mesh->positions.size()) && inRange(corner.uv, mesh->uvs.size());
+            if (!inRange(corner.normal, mesh->normals.size()))
+                corner.normal = -1;
+            missingNormals = missingNormals || corner.normal < 0;
+        }
+        if (valid)
+            triangles.append(triangle);
+    }
+    mesh->triangles = triangles;
+
+    if (!missingNormals)
+        return;
+    const int base = int(mesh->normals.size());
+    mesh->normals.resize(base + mesh->positions.size());
+    for (const auto &triangle : std::as_const(mesh->triangles)) {
+        const QVector3D &a = mesh->positions[triangle[0].position];
+        const QVector3D &b = mesh->positions[triangle[1].position];
+        const QVector3D &c = mesh->positions[triangle[2].position];
+        const QVector3D weighted = QVector3D::crossProduct(b - a, c - a); // Length is twice the area.
+        for (const MeshCorner &corner : triangle)
+            mesh->normals[base + corner.position] += weighted;
+    }
+    for (auto &triangle : mesh->triangles) {
+        for (MeshCorner &corner : triangle) {
+            if (corner.normal < 0)
+                corner.normal = base + corner.position;
+        }
+    }
+}
+
+static bool readMesh(const QString &fileName, SurfaceMesh *mesh)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not open mesh:" << fileName;
+        return false;
+    }
+
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    bool ok = false;
+    if (suffix == "obj")
+        ok = readObj(file, mesh);
+    else if (suffix == "ply")
+        ok = readPly(file, mesh);
+    else
+        qWarning() << "Mesh format is not supported:" << fileName;
+    if (!ok)
+        return false;
+
+    validateMesh(mesh);
+    return !mesh->triangles.isEmpty();
+}
+
+// The surface point and normal under each pixel of the flattened image, in
+// voxels of the sampled level. Pixels no triangle covers have a null normal.
+struct SurfaceImage
+{
+    int width = 0;
+    int height = 0;
+    QList<QVector3D> positions;
+    QList<QVector3D> normals;
+};
+
+// Pixels per texture coordinate unit that make one pixel about one voxel.
+static float surfaceScale(const SurfaceMesh &mesh, float voxelScale)
+{
+    double surfaceArea = 0.0;
+    double uvArea = 0.0;
+    for (const auto &triangle : mesh.triangles) {
+        const QVector3D &a = mesh.positions[triangle[0].position];
+        const QVector3D &b = mesh.positions[triangle[1].position];
+        const QVector3D &c = mesh.positions[triangle[2].position];
+        surfaceArea += QVector3D::crossProduct(b - a, c - a).length() * voxelScale * voxelScale;
+        const QVector2D ab = mesh.uvs[triangle[1].uv] - mesh.uvs[triangle[0].uv];
+        const QVector2D ac = mesh.uvs[triangle[2].uv] - mesh.uvs[triangle[0].uv];
+        uvArea += qAbs(ab.x() * ac.y() - ab.y() * ac.x());
+    }
+    return uvArea > 0.0 ? float(qSqrt(surfaceArea / uvArea)) : 0.0f;
+}
+
+// Rasterize the mesh in texture space. The image is split into bands of rows
+// that are filled in parallel, each by the triangles overlapping it.
+static void rasterizeSurface(const SurfaceMesh &mesh, float voxelScale, SurfaceImage *image)
+{
+    constexpr int kBandRows = 64;
+
+    QVector2D uvMin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    QVector2D uvMax(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+    for (const auto &triangle : mesh.triangles) {
+        for (const MeshCorner &corner : triangle) {
+            const QVector2D &uv = mesh.uvs[corner.uv];
+            uvMin = QVector2D(qMin(uvMin.x(), uv.x()), qMin(uvMin.y(), uv.y()));
+            uvMax = QVector2D(qMax(uvMax.x(), uv.x()), qMax(uvMax.y(), uv.y()));
+        }
+    }
+    const QVector2D uvSize(qMax(uvMax.x() - uvMin.x(), 1e-6f), qMax(uvMax.y() - uvMin.y(), 1e-6f));
+
+    // Texture coordinates of a corner in pixels, v grows up and rows grow down.
+    const float width = image->width;
+    const float height = image->height;
+    const auto toPixel = [&](const QVector2D &uv) {
+        return QVector2D((uv.x() - uvMin.x()) / uvSize.x() * width, (uvMax.y() - uv.y()) / uvSize.y() * height);
+    };
+
+    const int bandCount = (image->height + kBandRows - 1) / kBandRows;
+    QList<QList<int>> bands(bandCount);
+    for (int t = 0; t < mesh.triangles.size(); t++) {
+        float top = std::numeric_limits<float>::max();
+        float bottom = std::numeric_limits<float>::lowest();
+        for (const MeshCorner &corner : mesh.triangles[t]) {
+            const float y = toPixel(mesh.uvs[corner.uv]).y();
+            top = qMin(top, y);
+            bottom = qMax(bottom, y);
+        }
+        const int first = qBound(0, int(top) / kBandRows, bandCount - 1);
+        const int last = qBound(0, int(bottom) / kBandRows, bandCount - 1);
+        for (int band = first; band <= last; band++)
+            bands[band].append(t);
+    }
+
+    image->positions.fill(QVector3D(), qsizetype(image->width) * image->height);
+    image->normals.fill(QVector3D(), qsizetype(image->width) * image->height);
+    QVector3D *positions = image->positions.data();
+    QVector3D *normals = image->normals.data();
+
+#pragma omp parallel for schedule(dynamic)
+    for (int band = 0; band < bandCount; band++) {
+        const int bandTop = band * kBandRows;
+        const int bandBottom = qMin(bandTop + kBandRows, image->height) - 1;
+        for (int t : bands[band]) {
+            const auto &triangle = mesh.triangles[t];
+            const QVector2D a = toPixel(mesh.uvs[triangle[0].uv]);
+            const QVector2D b = toPixel(mesh.uvs[triangle[1].uv]);
+            const QVector2D c = toPixel(mesh.uvs[triangle[2].uv]);
+            const float area = (b.x() - a.x()) * (c.y() - a.y()) - (b.y() - a.y()) * (c.x() - a.x());
+            if (qAbs(area) < 1e-12f)
+                continue;
+
+            const int left = qMax(0, int(qFloor(qMin(a.x(), qMin(b.x(), c.x())))));
+            const int right = qMin(image->width - 1, int(qCeil(qMax(a.x(), qMax(b.x(), c.x())))));
+            const int top = qMax(bandTop, int(qFloor(qMin(a.y(), qMin(b.y(), c.y())))));
+            const int bottom = qMin(bandBottom, int(qCeil(qMax(a.y(), qMax(b.y(), c.y())))));
+            for (int y = top; y <= bottom; y++) {
+                for (int x = left; x <= right; x++) {
+                    // Barycentric weights of the pixel center, with a little slack so shared edges leave no gaps.
+                    const float px = x + 0.5f;
+                    const float py = y + 0.5f;
+                    const float wa = ((b.x() - px) * (c.y() - py) - (b.y() - py) * (c.x() - px)) / area;
+                    const float wb = ((c.x() - px) * (a.y() - py) - (c.y() - py) * (a.x() - px)) / area;
+                    const float wc = 1.0f - wa - wb;
+                    constexpr float kSlack = -1e-4f;
+                    if (wa < kSlack || wb < kSlack || wc < kSlack)
+                        continue;
+
+                    const qsizetype pixel = qsizetype(y) * image->width + x;
+                    positions[pixel] = (mesh.positions[triangle[0].position] * wa
+                                               + mesh.positions[triangle[1].position] * wb
+                                               + mesh.positions[triangle[2].position] * wc) * voxelScale;
+                    normals[pixel] = (mesh.normals[triangle[0].normal] * wa
+                                             + mesh.normals[triangle[1].normal] * wb
+                                             + mesh.normals[triangle[2].normal] * wc).normalized();
+                }
+            }
+        }
+    }
+}
+
+static quint64 chunkKey(int z, int y, int x)
+{
+    return (quint64(z) << 42) | (quint64(y) << 21) | quint64(x);
+}
+
+// A decoded chunk, kept until every pixel group that reads it has run.
+struct SurfaceChunk
+{
+    QByteArray data; // Empty when the store leaves the chunk out, it holds the fill value.
+    MemoryReservation reservation;
+};
+
+using SurfaceChunks = QHash<quint64, std::shared_ptr<const SurfaceChunk>>;
+
+// Check a chunk read from the store and bring it into C order. Null when it
+// cannot be used.
+static std::shared_ptr<const SurfaceChunk> prepareChunk(const StorageZarr &zarr, std::shared_ptr<SurfaceChunk> chunk, int z, int y, int x)
+{
+    if (!chunk->data.isEmpty() && chunk->data.size() != qsizetype(zarr.getChunkSizeBytes())) {
+        qWarning() << "Chunk has an unexpected size:" << chunk->data.size() << z << y << x;
+        return nullptr;
+    }
+    if (zarr.needsReorder() && !chunk->data.isEmpty()) {
+        chunk->data = zarr.reorderChunk(chunk->data, &chunk->reservation, false); // Chunks are read side by side.
+        if (chunk->data.isEmpty())
+            return nullptr;
+    }
+    return chunk;
+}
+
+// Trilinear reads of a store from the chunks a pixel group reads. Each task
+// has its own reader, which holds on to the chunk it read last.
+template<typename T>
+class VoxelReader
+{
+public:
+    VoxelReader(const SurfaceChunks &chunks, const StorageZarr &zarr)
+        : m_chunks(chunks)
+    {
+        const float fillValue = float(fillValueAs<T>(zarr.getFillValue()));
+        m_fillValue = qIsNaN(fillValue) ? 0.0f : fillValue; // NaN fills are empty, as in the loader.
+        std::tie(m_chunkDepth, m_chunkHeight, m_chunkWidth) = zarr.getChunks();
+        std::tie(m_depth, m_height, m_width) = zarr.getShape();
+    }
+
+    float voxel(int x, int y, int z)
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= m_width || y >= m_height || z >= m_depth)
+            return 0.0f;
+        const int cx = x / m_chunkWidth;
+        const int cy = y / m_chunkHeight;
+        const int cz = z / m_chunkDepth;
+        if (!m_chunk || cx != m_x || cy != m_y || cz != m_z) {
+            m_chunk = m_chunks.value(chunkKey(cz, cy, cx));
+            m_x = cx;
+            m_y = cy;
+            m_z = cz;
+            m_failed = m_failed || !m_chunk;
+        }
+        if (!m_chunk)
+            return 0.0f;
+        if (m_chunk->data.isEmpty())
+            return m_fillValue;
+        const T *data = reinterpret_cast<const T *>(m_chunk->data.constData());
+        const qsizetype index = (x - cx * m_chunkWidth)
+                + qsizetype(m_chunkWidth) * ((y - cy * m_chunkHeight) + qsizetype(m_chunkHeight) * (z - cz * m_chunkDepth));
+        return float(data[index]);
+    }
+
+    // Voxel centers are at integer coordinates.
+    float sample(const QVector3D &point)
+    {
+        const int x = qFloor(point.x());
+        const int y = qFloor(point.y());
+        const int z = qFloor(point.z());
+        const float fx = point.x() - x;
+        const float fy = point.y() - y;
+        const float fz = point.z() - z;
+        const float c00 = voxel(x, y, z) * (1 - fx) + voxel(x + 1, y, z) * fx;
+        const float c10 = voxel(x, y + 1, z) * (1 - fx) + voxel(x + 1, y + 1, z) * fx;
+        const float c01 = voxel(x, y, z + 1) * (1 - fx) + voxel(x + 1, y, z + 1) * fx;
+        const float c11 = voxel(x, y + 1, z + 1) * (1 - fx) + voxel(x + 1, y + 1, z + 1) * fx;
+        return (c00 * (1 - fy) + c10 * fy) * (1 - fz) + (c01 * (1 - fy) + c11 * fy) * fz;
+    }
+
+    bool failed() const { return m_failed; }
+
+private:
+    const SurfaceChunks &m_chunks;
+    float m_fillValue = 0.0f;
+    int m_chunkWidth = 1, m_chunkHeight = 1, m_chunkDepth = 1;
+    int m_width = 0, m_height = 0, m_depth = 0;
+    std::shared_ptr<const SurfaceChunk> m_chunk;
+    int m_x = -1, m_y = -1, m_z = -1;
+    bool m_failed = false;
+};
+
+struct SampleJob
+{
+    QUrl source;
+    int level = -1;
+    QUrl mesh;
+    int layers = 1;
+    float layerSpacing = 1.0f;
+    QSize imageSize;
+    QUrl outputFolder;
+    std::shared_ptr<std::atomic_bool> cancelled;
+
+    bool isCancelled() const { return cancelled && *cancelled; }
+};
+
+// Sample every layer of the surface into `samples`, layer after layer. Pixels
+// are grouped by the chunk their surface point falls in. The chunks the
+// groups read are fetched in z, y, x order with a few in flight, and each
+// group runs as a pool task once all of its chunks are in. Fetches do not
+// hold a pool thread, and a chunk is dropped once its last group has run.
+template<typename T>
+static bool sampleLayers(const SampleJob &job, const std::shared_ptr<ZarrSession> &session, const StorageZarr &zarr, int level, const SurfaceImage &image,
+                         QList<float> &samples, const std::function<void(qreal)> &progress)
+{
+    constexpr int kCancelCheckMs = 50; // How often a waiting run looks for its cancellation.
+
+    int chunkDepth, chunkHeight, chunkWidth;
+    std::tie(chunkDepth, chunkHeight, chunkWidth) = zarr.getChunks();
+    int shapeZ, shapeY, shapeX;
+    std::tie(shapeZ, shapeY, shapeX) = zarr.getShape();
+
+    QHash<quint64, QList<qsizetype>> groups;
+    const qsizetype pixelCount = qsizetype(image.width) * image.height;
+    for (qsizetype pixel = 0; pixel < pixelCount; pixel++) {
+        if (image.normals[pixel].isNull())
+            continue;
+        const QVector3D &point = image.positions[pixel];
+        const int x = qMax(0, qFloor(point.x()) / chunkWidth);
+        const int y = qMax(0, qFloor(point.y()) / chunkHeight);
+        const int z = qMax(0, qFloor(point.z()) / chunkDepth);
+        groups[chunkKey(z, y, x)].append(pixel);
+    }
+    QList<quint64> keys = groups.keys();
+    std::sort(keys.begin(), keys.end()); // z, then y, then x.
+
+    // The chunks each group reads: the box around its outermost layers,
+    // widened by a voxel for the trilinear neighbours.
+    const float firstOffset = -(job.layers - 1) * 0.5f * job.layerSpacing;
+    const float lastOffset = -firstOffset;
+    QHash<quint64, QList<quint64>> groupChunks;
+    QHash<quint64, QList<quint64>> chunkGroups; // The groups that read each chunk.
+    for (quint64 key : std::as_const(keys)) {
+        QVector3D min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        QVector3D max(std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest());
+        for (qsizetype pixel : std::as_const(groups[key])) {
+            for (const float offset : { firstOffset, lastOffset }) {
+                const QVector3D point = image.positions[pixel] + image.normals[pixel] * offset;
+                min = QVector3D(qMin(min.x(), point.x()), qMin(min.y(), point.y()), qMin(min.z(), point.z()));
+                max = QVector3D(qMax(max.x(), point.x()), qMax(max.y(), point.y()), qMax(max.z(), point.z()));
+            }
+        }
+        const int x0 = qMax(0, qFloor(min.x())) / chunkWidth, x1 = qMin(shapeX - 1, qFloor(max.x()) + 1) / chunkWidth;
+        const int y0 = qMax(0, qFloor(min.y())) / chunkHeight, y1 = qMin(shapeY - 1, qFloor(max.y()) + 1) / chunkHeight;
+        const int z0 = qMax(0, qFloor(min.z())) / chunkDepth, z1 = qMin(shapeZ - 1, qFloor(max.z()) + 1) / chunkDepth;
+        for (int z = z0; z <= z1; z++) {
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    groupChunks[key].append(chunkKey(z, y, x));
+                    chunkGroups[chunkKey(z, y, x)].append(key);
+                }
+            }
+        }
+    }
+    QList<quint64> chunkKeys = chunkGroups.keys();
+    std::sort(chunkKeys.begin(), chunkKeys.end());
+
+    // Chunks between fetch and decode, a few per thread.
+    const qsizetype maxInFlight = 2 * qMax(1, LoaderPool::instance()->maxThreadCount());
+    float *output = samples.data();
+    std::atomic_bool failed = false;
+    std::atomic_int done = 0;
+    LoaderTaskGroup group(LoaderPool::Refinement);
+    QMutex mutex; // Guards the state below.
+    QWaitCondition changed;
+    qsizetype inFlight = 0;
+    qsizetype scheduled = 0; // Tasks handed to the group, lets the waiting thread notice new work.
+    QList<QFuture<FetchedResource>> fetches; // Cancelled with the run.
+    SurfaceChunks resident;
+    QHash<quint64, int> missingChunks; // Per group, the chunks it waits for.
+    QHash<quint64, int> readers; // Per chunk, the groups still to run that read it.
+    for (quint64 key : std::as_const(keys))
+        missingChunks[key] = int(groupChunks.value(key).size());
+    for (quint64 chunk : std::as_const(chunkKeys))
+        readers[chunk] = int(chunkGroups.value(chunk).size());
+
+    const auto schedule = [&](std::function<void()> task) {
+        group.run(std::move(task));
+        QMutexLocker locker(&mutex);
+        scheduled++;
+        changed.wakeAll();
+    };
+    // Runs queued tasks one at a time meanwhile, never waits on running ones.
+    // A cancelled run is noticed within kCancelCheckMs.
+    const auto waitUntil = [&](auto condition) {
+        for (;;) {
+            qsizetype seen;
+            {
+                QMutexLocker locker(&mutex);
+                if (condition())
+                    return;
+                seen = scheduled;
+            }
+            if (group.runOne())
+                continue;
+            QMutexLocker locker(&mutex);
+            while (!condition() && seen == scheduled)
+                changed.wait(&mutex, kCancelCheckMs);
+        }
+    };
+
+    const auto sampleGroup = [&](quint64 key) {
+        const QList<quint64> chunks = groupChunks.value(key);
+        SurfaceChunks groupResident;
+        {
+            QMutexLocker locker(&mutex);
+            for (quint64 chunk : chunks)
+                groupResident.insert(chunk, resident.value(chunk));
+        }
+        if (!job.isCancelled() && !failed) {
+            VoxelReader<T> reader(groupResident, zarr);
+            for (qsizetype pixel : groups.value(key)) {
+                const QVector3D &point = image.positions[pixel];
+                const QVector3D &normal = image.normals[pixel];
+                for (int layer = 0; layer < job.layers; layer++) {
+                    const float offset = (layer - (job.layers - 1) * 0.5f) * job.layerSpacing;
+                    output[layer * pixelCount + pixel] = reader.sample(point + normal * offset);
+                }
+            }
+            if (reader.failed())
+                failed = true;
+        }
+        progress(qreal(++done) / keys.size());
+
+        QMutexLocker locker(&mutex);
+        for (quint64 chunk : chunks) {
+            if (--readers[chunk] == 0)
+                resident.remove(chunk);
+        }
+    };
+
+    // Make a chunk resident and start the groups it completes.
+    const auto arrive = [&](quint64 chunkId, std::shared_ptr<const SurfaceChunk> chunk) {
+        QList<quint64> ready;
+        {
+            QMutexLocker locker(&mutex);
+            inFlight--;
+            if (chunk) {
+                resident.insert(chunkId, chunk);
+                for (quint64 key : chunkGroups.value(chunkId)) {
+                    if (--missingChunks[key] == 0)
+                        ready.append(key);
+                }
+            } else {
+                failed = true;
+            }
+            changed.wakeAll();
+        }
+        for (quint64 key : std::as_const(ready))
+            schedule([&, key] { sampleGroup(key); });
+    };
+
+    for (quint64 key : std::as_const(keys)) {
+        if (groupChunks.value(key).isEmpty())
+            schedule([&, key] { sampleGroup(key); }); // Outside the volume.
+    }
+    for (quint64 chunkId : std::as_const(chunkKeys)) {
+        waitUntil([&] { return inFlight < maxInFlight || failed || job.isCancelled(); });
+        if (job.isCancelled() || failed)
+            break;
+        {
+            QMutexLocker locker(&mutex);
+            inFlight++;
+        }
+
+        const int z = int(chunkId >> 42);
+        const int y = int((chunkId >> 21) & 0x1fffff);
+        const int x = int(chunkId & 0x1fffff);
+        if (zarr.isLocal()) {
+            schedule([&, chunkId, z, y, x] {
+                auto chunk = std::make_shared<SurfaceChunk>();
+                chunk->data = zarr.readLocalChunk(level, z, y, x, &chunk->reservation);
+                if (chunk->data.isEmpty() && zarr.hasLocalChunk(level, z, y, x)) {
+                    qWarning() << "Chunk could not be read:" << z << y << x;
+                    arrive(chunkId, nullptr); // Corrupt, or refused by the memory budget.
+                    return;
+                }
+                arrive(chunkId, prepareChunk(zarr, chunk, z, y, x));
+            });
+        } else if (const QUrl url = zarr.getChunkUrl(level, z, y, x); session->isChunkMissing(url)) {
+            arrive(chunkId, std::make_shared<SurfaceChunk>());
+        } else {
+            QFuture<FetchedResource> fetch = fetchResourceAsync(url);
+            {
+                QMutexLocker locker(&mutex);
+                fetches.append(fetch);
+            }
+            fetch.then([&, chunkId, z, y, x, url](FetchedResource fetched) {
+                if (fetched.status == FetchedResource::Failed) {
+                    qWarning() << "Chunk fetch failed:" << url;
+                    arrive(chunkId, nullptr);
+                    return;
+                }
+                if (fetched.status == FetchedResource::Missing) {
+                    session->markChunkMissing(url);
+                    arrive(chunkId, std::make_shared<SurfaceChunk>());
+                    return;
+                }
+                schedule([&, chunkId, z, y, x, fetched] {
+                    auto chunk = std::make_shared<SurfaceChunk>();
+                    chunk->data = zarr.readChunk(fetched.data, &chunk->reservation);
+                    arrive(chunkId, chunk->data.isEmpty() ? nullptr : prepareChunk(zarr, chunk, z, y, x)); // Empty when corrupt, or refused by the memory budget.
+                });
+            }).onCanceled([&] {
+                QMutexLocker locker(&mutex);
+                inFlight--;
+                changed.wakeAll();
+            });
+        }
+    }
+    // Fetches in flight refer to the state above. A cancelled run aborts them
+    // rather than waiting for their replies.
+    waitUntil([&] { return inFlight == 0 || job.isCancelled(); });
+    if (job.isCancelled()) {
+        {
+            QMutexLocker locker(&mutex);
+            for (QFuture<FetchedResource> &fetch : fetches)
+                fetch.cancel();
+        }
+        waitUntil([&] { return inFlight == 0; });
+    }
+    group.wait();
+
+    qDebug() << "Surface sampled" << keys.size() << "pixel groups from" << chunkKeys.size() << "chunks";
+    return !failed;
+}
+
+// Write each layer as a grayscale PNG. uint8 stores keep their values, the
+// other types are written as 16 bit, floats stretched over their range.
+template<typename T>
+static bool writeLayers(const SampleJob &job, const SurfaceImage &image, const QList<float> &samples)
+{
+    const QDir folder(job.outputFolder.toLocalFile());
+    if (!folder.mkpath(".")) {
+        qWarning() << "Could not create output folder:" << folder.path();
+        return false;
+    }
+
+    constexpr bool kEightBit = std::is_same_v<T, uint8_t>;
+    float offset = 0.0f;
+    float scale = 1.0f;
+    if constexpr (std::is_same_v<T, int16_t>) {
+        offset = 32768.0f;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        const auto [min, max] = std::minmax_element(samples.cbegin(), samples.cend());
+        if (min != samples.cend() && *max > *min) {
+            offset = -*min;
+            scale = 65535.0f / (*max - *min);
+        }
+    }
+
+    const qsizetype pixelCount = qsizetype(image.width) * image.height;
+    std::atomic_bool ok = true;
+#pragma omp parallel for
+    for (int layer = 0; layer < job.layers; layer++) {
+        QImage output(image.width, image.height, kEightBit ? QImage::Format_Grayscale8 : QImage::Format_Grayscale16);
+        for (int y = 0; y < image.height; y++) {
+            const float *row = samples.constData() + layer * pixelCount + qsizetype(y) * image.width;
+            if constexpr (kEightBit) {
+                uchar *line = output.scanLine(y);
+                for (int x = 0; x < image.width; x++)
+                    line[x] = uchar(qBound(0.0f, row[x] + 0.5f, 255.0f));
+            } else {
+                quint16 *line = reinterpret_cast<quint16 *>(output.scanLine(y));
+                for (int x = 0; x < image.width; x++)
+                    line[x] = quint16(qBound(0.0f, (row[x] + offset) * scale + 0.5f, 65535.0f));
+            }
+        }
+        const QString fileName = folder.filePath(QString("%1.png").arg(layer, 2, 10, QChar('0')));
+        if (!output.save(fileName, "PNG")) {
+            qWarning() << "Could not write layer:" << fileName;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Returns an error message, empty on success.
+static QString sampleSurface(const SampleJob &job, QSize *imageSize, const std::function<void(qreal)> &progress)
+{
+    constexpr int kMaxImageSide = 32768;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto session = ZarrSession::forStore(job.source);
+    const int level = session->resolveLevel(job.level);
+    if (!session->metadata(level).isValid())
+        return QString("Could not read the Zarr metadata of %1").arg(job.source.toString());
+    const StorageZarr zarr = session->storage(level);
+    const QString dataType = zarr.getDataTypeName();
+    if (dataType.isEmpty())
+        qWarning() << "Zarr data type is not understood:" << zarr.getDataType();
+
+    SurfaceMesh mesh;
+    if (!readMesh(job.mesh.toLocalFile(), &mesh))
+        return QString("Could not read a textured triangle mesh from %1").arg(job.mesh.toString());
+    if (job.isCancelled())
+        return QString();
+
+    // Mesh vertices are in full resolution voxels.
+    const float voxelScale = level > 0 ? 1.0f / (1 << level) : 1.0f;
+    SurfaceImage image;
+    image.width = job.imageSize.width();
+    image.height = job.imageSize.height();
+    if (job.imageSize.isEmpty()) {
+        const float pixelsPerUv = surfaceScale(mesh, voxelScale);
+        float uMin = std::numeric_limits<float>::max(), uMax = std::numeric_limits<float>::lowest();
+        float vMin = uMin, vMax = uMax;
+        for (const QVector2D &uv : std::as_const(mesh.uvs)) {
+            uMin = qMin(uMin, uv.x());
+            uMax = qMax(uMax, uv.x());
+            vMin = qMin(vMin, uv.y());
+            vMax = qMax(vMax, uv.y());
+        }
+        image.width = qBound(1, qCeil((uMax - uMin) * pixelsPerUv), kMaxImageSide);
+        image.height = qBound(1, qCeil((vMax - vMin) * pixelsPerUv), kMaxImageSide);
+    }
+
+    const qsizetype pixelCount = qsizetype(image.width) * image.height;
+    const qint64 bytes = pixelCount * (2 * sizeof(QVector3D) + job.layers * sizeof(float));
+    const MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, bytes);
+    if (!reservation.isValid())
+        return QString("Not enough memory for %1 layers of %2x%3").arg(job.layers).arg(image.width).arg(image.height);
+
+    rasterizeSurface(mesh, voxelScale, &image);
+    mesh = SurfaceMesh(); // Not needed past here.
+    if (job.isCancelled())
+        return QString();
+
+    QList<float> samples(job.layers * pixelCount, 0.0f);
+    bool ok = true;
+    visitDataType(dataType, [&](auto type) {
+        using T = decltype(type);
+        ok = sampleLayers<T>(job, session, zarr, level, image, samples, progress);
+        if (ok && !job.isCancelled())
+            ok = writeLayers<T>(job, image, samples);
+    });
+    if (!ok)
+        return QString("Sampling %1 failed").arg(job.mesh.toString());
+
+    qDebug() << "Sampled" << job.layers << "layers of" << image.width << "x" << image.height << "in" << timer.elapsed() << "ms";
+    *imageSize = QSize(image.width, image.height);
+    return QString();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+SurfaceSampler::SurfaceSampler(QObject *parent)
+    : QObject(parent), m_tasks(LoaderPool::Refinement)
+{
+}
+
+SurfaceSampler::~SurfaceSampler()
+{
+    if (m_cancelled)
+        *m_cancelled = true;
+    m_tasks.wait();
+}
+
+QUrl SurfaceSampler::source() const
+{
+    return m_source;
+}
+
+void SurfaceSampler::setSource(const QUrl &newSource)
+{
+    if (m_source == newSource)
+        return;
+    m_source = newSource;
+    emit sourceChanged();
+}
+
+int SurfaceSampler::level() const
+{
+    return m_level;
+}
+
+void SurfaceSampler::setLevel(int newLevel)
+{
+    if (m_level == newLevel)
+        return;
+    m_level = newLevel;
+    emit levelChanged();
+}
+
+QUrl SurfaceSampler::mesh() const
+{
+    return m_mesh;
+}
+
+void SurfaceSampler::setMesh(const QUrl &newMesh)
+{
+    if (m_mesh == newMesh)
+        return;
+    m_mesh = newMesh;
+    emit meshChanged();
+}
+
+int SurfaceSampler::layers() const
+{
+    return m_layers;
+}
+
+void SurfaceSampler::setLayers(int newLayers)
+{
+    newLayers = qMax(1, newLayers);
+    if (m_layers == newLayers)
+        return;
+    m_layers = newLayers;
+    emit layersChanged();
+}
+
+qreal SurfaceSampler::layerSpacing() const
+{
+    return m_layerSpacing;
+}
+
+void SurfaceSampler::setLayerSpacing(qreal newLayerSpacing)
+{
+    if (qFuzzyCompare(m_layerSpacing, newLayerSpacing))
+        return;
+    m_layerSpacing = newLayerSpacing;
+    emit layerSpacingChanged();
+}
+
+QSize SurfaceSampler::imageSize() const
+{
+    return m_imageSize;
+}
+
+void SurfaceSampler::setImageSize(const QSize &newImageSize)
+{
+    if (m_imageSize == newImageSize)
+        return;
+    m_imageSize = newImageSize;
+    emit imageSizeChanged();
+}
+
+bool SurfaceSampler::running() const
+{
+    return m_running;
+}
+
+void SurfaceSampler::setRunning(bool newRunning)
+{
+    if (m_running == newRunning)
+        return;
+    m_running = newRunning;
+    emit runningChanged();
+}
+
+qreal SurfaceSampler::progress() const
+{
+    return m_progress;
+}
+
+void SurfaceSampler::setProgress(qreal newProgress)
+{
+    if (qFuzzyCompare(m_progress, newProgress))
+        return;
+    m_progress = newProgress;
+    emit progressChanged();
+}
+
+void SurfaceSampler::sampleAsync(QUrl outputFolder)
+{
+    // Supersede the run in flight, it stops at its next task.
+    if (m_cancelled)
+        *m_cancelled = true;
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+
+    SampleJob job;
+    job.source = m_source;
+    job.level = m_level;
+    job.mesh = m_mesh;
+    job.layers = m_layers;
+    job.layerSpacing = m_layerSpacing;
+    job.imageSize = m_imageSize;
+    job.outputFolder = outputFolder;
+    job.cancelled = m_cancelled;
+
+    const quint64 generation = ++m_generation;
+    setProgress(0.0);
+    setRunning(true);
+    m_tasks.run([this, job, generation] {
+        const auto progress = [this, generation](qreal value) {
+            QMetaObject::invokeMethod(this, [this, generation, value] {
+                if (generation == m_generation)
+                    setProgress(qMax(m_progress, value)); // Tasks finish out of order.
+            }, Qt::QueuedConnection);
+        };
+        QSize imageSize;
+        const QString error = sampleSurface(job, &imageSize, progress);
+        const bool cancelled = job.isCancelled();
+        QMetaObject::invokeMethod(this, [this, job, generation, error, imageSize, cancelled] {
+            if (generation != m_generation)
+                return;
+            setRunning(false);
+            if (!error.isEmpty())
+                emit sampleFailed(job.outputFolder, error);
+            else if (!cancelled)
+                emit sampleSucceeded(job.outputFolder, imageSize.width(), imageSize.height(), job.layers);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void SurfaceSampler::cancel()
+{
+    if (m_cancelled)
+        *m_cancelled = true;
+    ++m_generation;
+    setRunning(false);
+}
@@ -0,0 +1,96 @@
+#ifndef SURFACESAMPLER_H
+#define SURFACESAMPLER_H
+
+#include <QObject>
+#include <QSize>
+#include <QUrl>
+#include <QtQml/QQmlEngine>
+
+#include <atomic>
+#include <memory>
+
+#include <src/loaderpool.h>
+
+// Samples a Zarr volume along a segmentation mesh and writes the flattened
+// surface as one image per layer. Layers are offset along the surface
+// normal, so the stack follows a sheet through the volume. Only the chunks
+// the layers touch are fetched, and the work is grouped by chunk.
+class SurfaceSampler : public QObject
+{
+    Q_OBJECT
+    QML_ELEMENT
+
+    Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged FINAL)
+    Q_PROPERTY(int level READ level WRITE setLevel NOTIFY levelChanged FINAL)
+    Q_PROPERTY(QUrl mesh READ mesh WRITE setMesh NOTIFY meshChanged FINAL)
+    Q_PROPERTY(int layers READ layers WRITE setLayers NOTIFY layersChanged FINAL)
+    Q_PROPERTY(qreal layerSpacing READ layerSpacing WRITE setLayerSpacing NOTIFY layerSpacingChanged FINAL)
+    Q_PROPERTY(QSize imageSize READ imageSize WRITE setImageSize NOTIFY imageSizeChanged FINAL)
+    Q_PROPERTY(bool running READ running NOTIFY runningChanged FINAL)
+    Q_PROPERTY(qreal progress READ progress NOTIFY progressChanged FINAL)
+
+public:
+    explicit SurfaceSampler(QObject *parent = nullptr);
+    ~SurfaceSampler();
+
+    // The Zarr store to sample.
+    QUrl source() const;
+    void setSource(const QUrl &newSource);
+
+    // Level of the store, -1 for the store's default. Mesh vertices are in
+    // full resolution voxels and are scaled down to the level.
+    int level() const;
+    void setLevel(int newLevel);
+
+    // OBJ or PLY triangle mesh with texture coordinates.
+    QUrl mesh() const;
+    void setMesh(const QUrl &newMesh);
+
+    // Layers are centered on the surface, `layerSpacing` voxels apart.
+    int layers() const;
+    void setLayers(int newLayers);
+    qreal layerSpacing() const;
+    void setLayerSpacing(qreal newLayerSpacing);
+
+    // Size of the flattened images, an empty size picks about one pixel per voxel.
+    QSize imageSize() const;
+    void setImageSize(const QSize &newImageSize);
+
+    bool running() const;
+    qreal progress() const;
+
+    // Write the layers to `outputFolder` as 00.png, 01.png and so on.
+    Q_INVOKABLE void sampleAsync(QUrl outputFolder);
+    Q_INVOKABLE void cancel();
+
+signals:
+    void sourceChanged();
+    void levelChanged();
+    void meshChanged();
+    void layersChanged();
+    void layerSpacingChanged();
+    void imageSizeChanged();
+    void runningChanged();
+    void progressChanged();
+    void sampleSucceeded(QUrl outputFolder, int width, int height, int layers);
+    void sampleFailed(QUrl outputFolder, QString error);
+
+private:
+    void setRunning(bool newRunning);
+    void setProgress(qreal newProgress);
+
+    QUrl m_source;
+    int m_level = -1;
+    QUrl m_mesh;
+    int m_layers = 1;
+    qreal m_layerSpacing = 1.0;
+    QSize m_imageSize;
+    bool m_running = false;
+    qreal m_progress = 0.0;
+
+    quint64 m_generation = 0;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    LoaderTaskGroup m_tasks;
+};
+
+#endif // SURFACESAMPLER_H
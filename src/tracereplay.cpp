@@ -0,0 +1,301 @@
+#include <src/tracereplay.h>
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QTimer>
+#include <QtMath>
+
+#include <algorithm>
+
+#include <src/loadtrace.h>
+#include <src/residentvolumes.h>
+#include <src/volumetexturedata.h>
+
+static constexpr int kLoadTimeoutMs = 60000;
+static constexpr int kPollIntervalMs = 20;
+
+namespace {
+
+// Timings of a replay or of the recorded session in ms, in report order.
+using Metrics = QList<std::pair<QString, double>>;
+
+struct Rewrite
+{
+    QString from;
+    QString to;
+};
+
+}
+
+// Nearest rank percentile, -1 without samples.
+static double percentile(QList<qint64> samples, qreal fraction)
+{
+    if (samples.isEmpty())
+        return -1;
+    std::sort(samples.begin(), samples.end());
+    const qsizetype rank = qCeil(fraction * samples.size());
+    return samples[qBound<qsizetype>(0, rank - 1, samples.size() - 1)];
+}
+
+static Metrics metrics(const QList<LoadTrace::Outcome> &outcomes)
+{
+    QList<qint64> firstImage;
+    QList<qint64> complete;
+    LoadTrace::Stages stages = {};
+    for (const LoadTrace::Outcome &outcome : outcomes) {
+        // Superseded loads did work too, their stages count.
+        for (int stage = 0; stage < LoadTrace::StageCount; stage++)
+            stages[stage] += outcome.stages[stage];
+        if (outcome.result != LoadTrace::Succeeded)
+            continue;
+        complete.append(outcome.completeMs);
+        firstImage.append(outcome.firstImageMs >= 0 ? outcome.firstImageMs : outcome.completeMs); // Shown all at once.
+    }
+
+    Metrics result {
+        { "first image p50", percentile(firstImage, 0.5) },
+        { "first image p95", percentile(firstImage, 0.95) },
+        { "complete p50", percentile(complete, 0.5) },
+        { "complete p95", percentile(complete, 0.95) },
+    };
+    for (int stage = 0; stage < LoadTrace::StageCount; stage++)
+        result.append({ QString(LoadTrace::stageName(stage)) + " total", stages[stage] / 1000.0 });
+    return result;
+}
+
+static int countResults(const QList<LoadTrace::Outcome> &outcomes, LoadTrace::Result result)
+{
+    return std::count_if(outcomes.begin(), outcomes.end(), [result](const LoadTrace::Outcome &outcome) { return outcome.result == result; });
+}
+
+static QUrl rewritten(const QUrl &source, const QList<Rewrite> &rewrites)
+{
+    const QString url = source.toString();
+    for (const Rewrite &rewrite : rewrites) {
+        if (!url.startsWith(rewrite.from))
+            continue;
+        const QString target = rewrite.to + url.mid(rewrite.from.size());
+        const QUrl result(target);
+        return result.scheme().isEmpty() ? QUrl::fromLocalFile(target) : result; // Plain paths are local stores.
+    }
+    return source;
+}
+
+static void issue(VolumeTextureData &volume, const LoadTrace::Call &call, const QList<Rewrite> &rewrites)
+{
+    volume.setRegionChunks(call.regionChunks);
+    volume.setVoxelBudget(call.voxelBudget);
+    volume.setByteBudget(call.byteBudget);
+    volume.setMaxTextureSide(call.maxTextureSide);
+    volume.setSliceMin(call.sliceMin);
+    volume.setSliceMax(call.sliceMax);
+    volume.setGradientsEnabled(call.gradientsEnabled);
+
+    const QUrl source = rewritten(call.source, rewrites);
+    if (call.overlaySources.isEmpty()) {
+        volume.loadAsync(source, call.width, call.height, call.depth, call.dataType, call.globalFocusPoint, call.level, call.order);
+        return;
+    }
+    QList<QUrl> overlaySources;
+    for (const QUrl &overlay : call.overlaySources)
+        overlaySources.append(rewritten(overlay, rewrites));
+    volume.loadOverlayAsync(source, overlaySources, call.globalFocusPoint, call.level, call.order, call.overlayLevels, call.overlayOrders);
+}
+
+// Issue the calls at their recorded times divided by `speed`, and wait until
+// every load has ended. Loads that are still running after the timeout are
+// left out of the outcomes.
+static QList<LoadTrace::Outcome> replayOnce(VolumeTextureData &volume, const QList<LoadTrace::Call> &calls,
+                                            const QList<Rewrite> &rewrites, double speed)
+{
+    LoadTrace trace;
+    LoadTrace::setInstance(&trace);
+    // Volumes resident from the last run would be shared instead of loaded.
+    ResidentVolumes::instance()->clear();
+
+    QEventLoop loop;
+    QElapsedTimer started;
+    started.start();
+    const qint64 origin = calls.first().timeMs;
+    const auto due = [&](qsizetype index) { return qint64((calls[index].timeMs - origin) / speed); };
+
+    qsizetype next = 0;
+    QTimer issueTimer;
+    issueTimer.setSingleShot(true);
+    issueTimer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&issueTimer, &QTimer::timeout, &loop, [&] {
+        while (next < calls.size() && due(next) <= started.elapsed())
+            issue(volume, calls[next++], rewrites);
+        if (next < calls.size())
+            issueTimer.start(int(due(next) - started.elapsed()));
+    });
+
+    // Every call ends with an outcome, superseded ones without a signal.
+    QTimer doneTimer;
+    QObject::connect(&doneTimer, &QTimer::timeout, &loop, [&] {
+        if (next == calls.size() && trace.outcomes().size() == calls.size())
+            loop.quit();
+    });
+    doneTimer.start(kPollIntervalMs);
+    QTimer::singleShot(due(calls.size() - 1) + kLoadTimeoutMs, &loop, &QEventLoop::quit);
+    issueTimer.start(0);
+    loop.exec();
+
+    LoadTrace::setInstance(nullptr);
+    return trace.outcomes();
+}
+
+static QJsonObject readBaseline(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Could not read baseline:" << path << file.errorString();
+        return {};
+    }
+    return QJsonDocument::fromJson(file.readAll()).object()["metrics"].toObject();
+}
+
+static bool writeBaseline(const QString &path, const QString &tracePath, const Metrics &replayed)
+{
+    QJsonObject values;
+    for (const auto &[name, value] : replayed)
+        values.insert(name, value);
+    const QJsonObject baseline {
+        { "trace", QFileInfo(tracePath).fileName() },
+        { "metrics", values },
+    };
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not write baseline:" << path << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(baseline).toJson());
+    return true;
+}
+
+int TraceReplay::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay the loads of a recorded trace, compare their timings with a baseline and exit.");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "replay", "Trace recorded with --record-trace.", "trace" },
+        { "speed", "Issue the calls this many times faster than recorded.", "factor", "1" },
+        { "runs", "Replays of the trace, the report takes the median.", "count", "3" },
+        { "rewrite", "Load sources starting with <from> from <to> instead, e.g. a local copy of the store.", "from=to" },
+        { "baseline", "Compare with a report saved by --save-baseline.", "file" },
+        { "save-baseline", "Save the report as a baseline.", "file" },
+        { "tolerance", "Fraction a timing may exceed the baseline by.", "fraction", "0.25" },
+        { "slack", "Time a timing may exceed the baseline by on top of the tolerance.", "ms", "20" },
+    });
+    parser.process(arguments);
+
+    const QString tracePath = parser.value("replay");
+    QList<LoadTrace::Call> calls;
+    QList<LoadTrace::Outcome> recorded;
+    if (!LoadTrace::read(tracePath, &calls, &recorded))
+        return 1;
+    if (calls.isEmpty()) {
+        qWarning() << "The trace holds no calls:" << tracePath;
+        return 1;
+    }
+
+    QList<Rewrite> rewrites;
+    for (const QString &rewrite : parser.values("rewrite")) {
+        const qsizetype separator = rewrite.indexOf('=');
+        if (separator <= 0) {
+            qWarning() << "Rewrite is not of the form from=to:" << rewrite;
+            return 1;
+        }
+        rewrites.append({ rewrite.left(separator), rewrite.mid(separator + 1) });
+    }
+    const double speed = qMax(0.01, parser.value("speed").toDouble());
+    const int runs = qMax(1, parser.value("runs").toInt());
+    const double tolerance = parser.value("tolerance").toDouble();
+    const double slack = parser.value("slack").toDouble();
+    const QJsonObject baseline = parser.isSet("baseline") ? readBaseline(parser.value("baseline")) : QJsonObject();
+    if (parser.isSet("baseline") && baseline.isEmpty())
+        return 1;
+
+    // Keep the snapshot of the user's last session out of the replay.
+    QStandardPaths::setTestModeEnabled(true);
+
+    // Let the built-in volume the texture starts with finish first.
+    VolumeTextureData volume;
+    {
+        QEventLoop loop;
+        QObject::connect(&volume, &VolumeTextureData::loadSucceeded, &loop, &QEventLoop::quit);
+        QObject::connect(&volume, &VolumeTextureData::loadFailed, &loop, &QEventLoop::quit);
+        QTimer::singleShot(kLoadTimeoutMs, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+
+    // Later runs find the stores' metadata in their sessions, as later loads
+    // of a viewing session do.
+    QList<Metrics> replays;
+    int failures = 0;
+    int unfinished = 0;
+    for (int run = 0; run < runs; run++) {
+        const QList<LoadTrace::Outcome> outcomes = replayOnce(volume, calls, rewrites, speed);
+        replays.append(metrics(outcomes));
+        failures = qMax(failures, countResults(outcomes, LoadTrace::Failed));
+        unfinished = qMax(unfinished, int(calls.size() - outcomes.size()));
+    }
+
+    // Median of the runs per metric.
+    Metrics replayed = replays.first();
+    for (qsizetype i = 0; i < replayed.size(); i++) {
+        QList<double> values;
+        for (const Metrics &replay : std::as_const(replays))
+            values.append(replay[i].second);
+        std::sort(values.begin(), values.end());
+        replayed[i].second = values[values.size() / 2];
+    }
+    const Metrics recordedMetrics = metrics(recorded);
+
+    QTextStream out(stdout);
+    out << calls.size() << " calls over " << (calls.last().timeMs - calls.first().timeMs) / 1000.0 << " s, replayed "
+        << runs << " times at " << speed << "x\n";
+    out << qSetFieldWidth(20) << Qt::left << "ms" << Qt::right << "recorded" << "replayed" << "baseline" << "change" << qSetFieldWidth(0) << "\n";
+
+    const auto format = [](double value) { return value < 0 ? QString("-") : QString::number(value, 'f', 1); };
+    bool passed = true;
+    for (qsizetype i = 0; i < replayed.size(); i++) {
+        const auto &[name, value] = replayed[i];
+        const double base = baseline.contains(name) ? baseline[name].toDouble() : -1;
+        QString change = "-";
+        bool regressed = false;
+        if (base >= 0 && value >= 0) {
+            change = base > 0 ? QString("%1%").arg(qRound((value / base - 1) * 100)) : QString("-");
+            regressed = value > base * (1 + tolerance) + slack;
+        }
+        out << qSetFieldWidth(20) << Qt::left << name << Qt::right
+            << format(recordedMetrics[i].second) << format(value) << format(base) << change << qSetFieldWidth(0);
+        if (regressed)
+            out << "  regressed";
+        out << "\n";
+        passed &= !regressed;
+    }
+
+    const int recordedFailures = countResults(recorded, LoadTrace::Failed);
+    out << countResults(recorded, LoadTrace::Succeeded) << " loads succeeded, " << recordedFailures << " failed and "
+        << countResults(recorded, LoadTrace::Superseded) << " were superseded when recorded, " << failures << " failed in replay";
+    if (unfinished > 0)
+        out << ", " << unfinished << " did not end in time";
+    out << "\n";
+    out.flush();
+    if (failures > recordedFailures || unfinished > 0)
+        passed = false;
+
+    if (parser.isSet("save-baseline") && !writeBaseline(parser.value("save-baseline"), tracePath, replayed))
+        return 1;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include <QStringList>
+
+// Re-issues the loads of a LoadTrace without a window, at the pace they
+// were recorded at or faster, and reports the time to the first shown part,
+// to the result, and spent in each loader stage. Started with
+// `volumeraycaster --replay <trace>`, `--help` lists the options.
+//
+// --rewrite points the recorded sources at a local copy of the stores, so
+// replays do not depend on the network. A report saved with --save-baseline
+// is compared with later replays of the same trace through --baseline.
+class TraceReplay
+{
+public:
+    // Returns the exit code: non-zero when a load failed that succeeded when
+    // recorded, or a timing regressed beyond the tolerance of the baseline.
+    static int run(const QStringList &arguments);
+};
+
+#endif // TRACEREPLAY_H
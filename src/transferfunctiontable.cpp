@@ -0,0 +1,194 @@
+#include <src/transferfunctiontable.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+static constexpr int kTableSize = 256;
+static constexpr double kMaxBinAlpha = 0.999; // Keeps the extinction finite.
+
+// Paths QImage can open, colormaps are usually in the QML module's resources.
+static QString imagePath(const QUrl &url)
+{
+    if (url.scheme() == "qrc")
+        return ":" + url.path();
+    if (url.isLocalFile())
+        return url.toLocalFile();
+    return url.toString();
+}
+
+TransferFunctionTable::TransferFunctionTable(QQuick3DObject *parent)
+    : QQuick3DTextureData(parent)
+{
+    setFormat(Format::RGBA8);
+    setSize(QSize(kTableSize, kTableSize));
+    setTextureData(QByteArray(kTableSize * kTableSize * 4, 0));
+    scheduleRebuild();
+}
+
+QUrl TransferFunctionTable::colormap() const
+{
+    return m_colormap;
+}
+
+void TransferFunctionTable::setColormap(const QUrl &newColormap)
+{
+    if (m_colormap == newColormap)
+        return;
+    m_colormap = newColormap;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+qreal TransferFunctionTable::stepAlpha() const
+{
+    return m_stepAlpha;
+}
+
+void TransferFunctionTable::setStepAlpha(qreal newStepAlpha)
+{
+    if (qFuzzyCompare(m_stepAlpha, newStepAlpha))
+        return;
+    m_stepAlpha = newStepAlpha;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+qreal TransferFunctionTable::tMin() const
+{
+    return m_tMin;
+}
+
+void TransferFunctionTable::setTMin(qreal newTMin)
+{
+    if (qFuzzyCompare(m_tMin, newTMin))
+        return;
+    m_tMin = newTMin;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+qreal TransferFunctionTable::tMax() const
+{
+    return m_tMax;
+}
+
+void TransferFunctionTable::setTMax(qreal newTMax)
+{
+    if (qFuzzyCompare(m_tMax, newTMax))
+        return;
+    m_tMax = newTMax;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+bool TransferFunctionTable::multipliedAlpha() const
+{
+    return m_multipliedAlpha;
+}
+
+void TransferFunctionTable::setMultipliedAlpha(bool newMultipliedAlpha)
+{
+    if (m_multipliedAlpha == newMultipliedAlpha)
+        return;
+    m_multipliedAlpha = newMultipliedAlpha;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+qreal TransferFunctionTable::stepRatio() const
+{
+    return m_stepRatio;
+}
+
+void TransferFunctionTable::setStepRatio(qreal newStepRatio)
+{
+    if (qFuzzyCompare(m_stepRatio, newStepRatio))
+        return;
+    m_stepRatio = newStepRatio;
+    emit inputsChanged();
+    scheduleRebuild();
+}
+
+void TransferFunctionTable::scheduleRebuild()
+{
+    if (m_rebuildPending)
+        return;
+    m_rebuildPending = true;
+    // Bindings set the inputs one after another, build once for all of them.
+    QMetaObject::invokeMethod(this, &TransferFunctionTable::rebuild, Qt::QueuedConnection);
+}
+
+void TransferFunctionTable::loadColormap()
+{
+    if (m_loadedColormap == m_colormap && !m_colors.isEmpty())
+        return;
+    m_loadedColormap = m_colormap;
+
+    m_colors.resize(kTableSize);
+    const QImage image(imagePath(m_colormap));
+    if (image.isNull()) {
+        if (!m_colormap.isEmpty())
+            qWarning() << "Could not read colormap:" << m_colormap;
+        for (int i = 0; i < kTableSize; i++)
+            m_colors[i] = QVector3D(1, 1, 1) * (i / float(kTableSize - 1)); // Grayscale.
+        return;
+    }
+    // Nearest texel at each bin centre, as the shader samples the colormap.
+    for (int i = 0; i < kTableSize; i++) {
+        const int x = qMin(image.width() - 1, int((i + 0.5) / kTableSize * image.width()));
+        const QColor color = image.pixelColor(x, image.height() / 2);
+        m_colors[i] = QVector3D(color.redF(), color.greenF(), color.blueF());
+    }
+}
+
+void TransferFunctionTable::rebuild()
+{
+    m_rebuildPending = false;
+    QElapsedTimer timer;
+    timer.start();
+    loadColormap();
+
+    // Extinction of one reference step per density bin, and extinction
+    // weighted colour, summed up to each bin. The integral over any range of
+    // bins is then the difference of two sums.
+    std::vector<double> extinction(kTableSize + 1, 0.0);
+    std::vector<std::array<double, 3>> weightedColor(kTableSize + 1, { 0.0, 0.0, 0.0 });
+    for (int i = 0; i < kTableSize; i++) {
+        const double density = i / double(kTableSize - 1);
+        const bool visible = density > 0 && density >= m_tMin && density <= m_tMax;
+        const double alpha = visible ? qMin(kMaxBinAlpha, (m_multipliedAlpha ? density : 1.0) * m_stepAlpha) : 0.0;
+        const double binExtinction = -std::log(1.0 - qMax(0.0, alpha));
+        extinction[i + 1] = extinction[i] + binExtinction;
+        for (int c = 0; c < 3; c++)
+            weightedColor[i + 1][c] = weightedColor[i][c] + binExtinction * m_colors[i][c];
+    }
+
+    // A segment passes every density between its samples once, with the
+    // average extinction of those densities over the segment's length.
+    QByteArray table(kTableSize * kTableSize * 4, Qt::Uninitialized);
+    auto texels = reinterpret_cast<uchar *>(table.data());
+    const double stepRatio = qMax(0.0, m_stepRatio);
+#pragma omp parallel for
+    for (int back = 0; back < kTableSize; back++) {
+        for (int front = 0; front < kTableSize; front++) {
+            const int low = qMin(front, back);
+            const int high = qMax(front, back);
+            const double segmentExtinction = extinction[high + 1] - extinction[low];
+            const double opacity = 1.0 - std::exp(-segmentExtinction / (high - low + 1) * stepRatio);
+            uchar *texel = texels + 4 * (front + kTableSize * back);
+            for (int c = 0; c < 3; c++) {
+                const double color = segmentExtinction > 0 ? (weightedColor[high + 1][c] - weightedColor[low][c]) / segmentExtinction
+                                                           : m_colors[back][c];
+                texel[c] = uchar(qBound(0.0, color, 1.0) * 255 + 0.5);
+            }
+            texel[3] = uchar(qBound(0.0, opacity, 1.0) * 255 + 0.5);
+        }
+    }
+    setTextureData(table);
+    qDebug() << "Transfer function table built in" << timer.nsecsElapsed() / 1000 << "us";
+}
@@ -0,0 +1,70 @@
+#ifndef TRANSFERFUNCTIONTABLE_H
+#define TRANSFERFUNCTIONTABLE_H
+
+#include <QUrl>
+#include <QVector3D>
+#include <QtQuick3D/QQuick3DTextureData>
+#include <QtQml/QQmlEngine>
+
+// Preintegrated transfer function: a 2D table of the colour and opacity of
+// a ray segment between a front and a back density sample, x being the
+// front and y the back. The density range between the samples is
+// integrated, so thin features between widely spaced samples are not
+// skipped and larger steps band less than sampling the colormap per step.
+//
+// The table is rebuilt on the GUI thread, once per batch of input changes.
+class TransferFunctionTable : public QQuick3DTextureData
+{
+    Q_OBJECT
+    QML_ELEMENT
+    Q_PROPERTY(QUrl colormap READ colormap WRITE setColormap NOTIFY inputsChanged FINAL)
+    Q_PROPERTY(qreal stepAlpha READ stepAlpha WRITE setStepAlpha NOTIFY inputsChanged FINAL)
+    Q_PROPERTY(qreal tMin READ tMin WRITE setTMin NOTIFY inputsChanged FINAL)
+    Q_PROPERTY(qreal tMax READ tMax WRITE setTMax NOTIFY inputsChanged FINAL)
+    Q_PROPERTY(bool multipliedAlpha READ multipliedAlpha WRITE setMultipliedAlpha NOTIFY inputsChanged FINAL)
+    Q_PROPERTY(qreal stepRatio READ stepRatio WRITE setStepRatio NOTIFY inputsChanged FINAL)
+
+public:
+    explicit TransferFunctionTable(QQuick3DObject *parent = nullptr);
+
+    // Colormap image, sampled along its middle row.
+    QUrl colormap() const;
+    void setColormap(const QUrl &newColormap);
+
+    // Opacity of one step of the reference length, scaled by the density
+    // when multipliedAlpha is set. Densities outside [tMin, tMax] are clear.
+    qreal stepAlpha() const;
+    void setStepAlpha(qreal newStepAlpha);
+    qreal tMin() const;
+    void setTMin(qreal newTMin);
+    qreal tMax() const;
+    void setTMax(qreal newTMax);
+    bool multipliedAlpha() const;
+    void setMultipliedAlpha(bool newMultipliedAlpha);
+
+    // Length of a ray segment in reference steps, one voxel when the
+    // reference is the default step length.
+    qreal stepRatio() const;
+    void setStepRatio(qreal newStepRatio);
+
+signals:
+    void inputsChanged();
+
+private:
+    void scheduleRebuild();
+    void rebuild();
+    void loadColormap();
+
+    QUrl m_colormap;
+    qreal m_stepAlpha = 0.2;
+    qreal m_tMin = 0;
+    qreal m_tMax = 1;
+    bool m_multipliedAlpha = false;
+    qreal m_stepRatio = 1;
+
+    QList<QVector3D> m_colors; // One per density bin.
+    QUrl m_loadedColormap; // The image m_colors was sampled from.
+    bool m_rebuildPending = false;
+};
+
+#endif // TRANSFERFUNCTIONTABLE_H
@@ -0,0 +1,320 @@
+#include <src/volumefilter.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtMath>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+static constexpr int kMaxMedianRadius = 3;
+static constexpr int kMaxRadius = 16;
+static constexpr float kMaxContrastGain = 4.0f;
+
+static qsizetype clampIndex(qsizetype index, qsizetype size)
+{
+    return qBound<qsizetype>(0, index, size - 1);
+}
+
+static std::vector<float> gaussianKernel(int radius)
+{
+    const float sigma = qMax(0.5f, radius / 2.0f);
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0;
+    for (int i = -radius; i <= radius; i++) {
+        kernel[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+        sum += kernel[i + radius];
+    }
+    for (float &weight : kernel)
+        weight /= sum;
+    return kernel;
+}
+
+static std::vector<float> boxKernel(int radius)
+{
+    return std::vector<float>(2 * radius + 1, 1.0f / (2 * radius + 1));
+}
+
+// Convolve the density channel with `kernel` along x, y and z. The x and y
+// passes run slice by slice in thread local buffers, the z pass reads the
+// slices back from a 16-bit volume holding them at `planeScale`. Every row
+// of the result goes to `finish(offset, values)` as floats, where `offset`
+// is the voxel index of its first value. `transform` maps voxel values
+// before they are filtered.
+template<typename Transform, typename Finish>
+static void separableFilter(const uint8_t *volume, int channels, qsizetype width, qsizetype height, qsizetype depth,
+                            const std::vector<float> &kernel, float planeScale, Transform transform, Finish finish)
+{
+    const qsizetype radius = qsizetype(kernel.size()) / 2;
+    std::vector<uint16_t> planes(width * height * depth);
+
+#pragma omp parallel
+    {
+        std::vector<float> slice(width * height);
+        std::vector<float> row(width);
+#pragma omp for schedule(dynamic)
+        for (qsizetype z = 0; z < depth; z++) {
+            for (qsizetype y = 0; y < height; y++) {
+                const uint8_t *src = volume + channels * width * (y + height * z);
+                float *dst = slice.data() + width * y;
+                for (qsizetype x = 0; x < width; x++) {
+                    float sum = 0;
+                    for (qsizetype k = -radius; k <= radius; k++)
+                        sum += kernel[k + radius] * transform(src[channels * clampIndex(x + k, width)]);
+                    dst[x] = sum;
+                }
+            }
+            for (qsizetype y = 0; y < height; y++) {
+                std::fill(row.begin(), row.end(), 0.0f);
+                for (qsizetype k = -radius; k <= radius; k++) {
+                    const float weight = kernel[k + radius];
+                    const float *src = slice.data() + width * clampIndex(y + k, height);
+#pragma omp simd
+                    for (qsizetype x = 0; x < width; x++)
+                        row[x] += weight * src[x];
+                }
+                uint16_t *dst = planes.data() + width * (y + height * z);
+#pragma omp simd
+                for (qsizetype x = 0; x < width; x++)
+                    dst[x] = uint16_t(qMin(65535.0f, row[x] * planeScale + 0.5f));
+            }
+        }
+    }
+
+    const float inverseScale = 1.0f / planeScale;
+#pragma omp parallel
+    {
+        std::vector<float> row(width);
+#pragma omp for
+        for (qsizetype line = 0; line < height * depth; line++) {
+            const qsizetype y = line % height;
+            const qsizetype z = line / height;
+            std::fill(row.begin(), row.end(), 0.0f);
+            for (qsizetype k = -radius; k <= radius; k++) {
+                const float weight = kernel[k + radius] * inverseScale;
+                const uint16_t *src = planes.data() + width * (y + height * clampIndex(z + k, depth));
+#pragma omp simd
+                for (qsizetype x = 0; x < width; x++)
+                    row[x] += weight * src[x];
+            }
+            finish(width * line, row.data());
+        }
+    }
+}
+
+// Median over a cube of (2 * radius + 1)^3 voxels. Each row keeps a
+// histogram of its window that slides along x, with the median tracked
+// incrementally as columns enter and leave.
+static void medianFilter(const uint8_t *volume, int channels, qsizetype width, qsizetype height, qsizetype depth,
+                         int radius, uint8_t *out)
+{
+    const int side = 2 * radius + 1;
+    const int half = side * side * side / 2;
+
+#pragma omp parallel for schedule(dynamic)
+    for (qsizetype line = 0; line < height * depth; line++) {
+        const qsizetype y = line % height;
+        const qsizetype z = line / height;
+        std::array<int, 256> histogram = {};
+        int median = 0;
+        int below = 0; // Voxels of the window under the median.
+
+        const auto column = [&](qsizetype x, int delta) {
+            const qsizetype columnX = clampIndex(x, width);
+            for (int dz = -radius; dz <= radius; dz++) {
+                for (int dy = -radius; dy <= radius; dy++) {
+                    const uint8_t value = volume[channels * (columnX + width * (clampIndex(y + dy, height) + height * clampIndex(z + dz, depth)))];
+                    histogram[value] += delta;
+                    if (value < median)
+                        below += delta;
+                }
+            }
+        };
+
+        for (qsizetype x = -radius; x <= radius; x++)
+            column(x, 1);
+        for (qsizetype x = 0; x < width; x++) {
+            while (below > half)
+                below -= histogram[--median];
+            while (below + histogram[median] <= half)
+                below += histogram[median++];
+            out[width * line + x] = uint8_t(median);
+
+            column(x - radius, -1);
+            column(x + radius + 1, 1);
+        }
+    }
+}
+
+// Standard deviation of the voxels that are not empty.
+static float densityDeviation(const uint8_t *volume, int channels, qsizetype voxels)
+{
+    double sum = 0;
+    double sumSquares = 0;
+    qsizetype count = 0;
+#pragma omp parallel for reduction(+ : sum, sumSquares, count)
+    for (qsizetype i = 0; i < voxels; i++) {
+        const double value = volume[channels * i];
+        if (value > 0) {
+            sum += value;
+            sumSquares += value * value;
+            count++;
+        }
+    }
+    if (count == 0)
+        return 0.0f;
+    const double mean = sum / count;
+    return float(std::sqrt(qMax(0.0, sumSquares / count - mean * mean)));
+}
+
+qsizetype VolumeFilter::scratchBytes(const Settings &settings, qsizetype voxels, int channels)
+{
+    const qsizetype dense = channels > 1 ? voxels : 0; // The filtered density before it is interleaved.
+    if (settings.type == "median")
+        return dense;
+    if (settings.type == "contrast")
+        return dense + 2 * voxels * qsizetype(sizeof(uint16_t)); // Planes and the local mean of squares.
+    return dense + voxels * qsizetype(sizeof(uint16_t)); // Planes.
+}
+
+QByteArray VolumeFilter::apply(const QByteArray &volume, int channels, qsizetype width, qsizetype height, qsizetype depth,
+                               const Settings &settings)
+{
+    const qsizetype voxels = width * height * depth;
+    if (settings.isNone() || volume.size() < voxels * channels || voxels == 0)
+        return volume;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const auto src = reinterpret_cast<const uint8_t *>(volume.constData());
+    const float amount = float(settings.amount);
+    QByteArray result(volume.size(), Qt::Uninitialized);
+    // Single channel volumes are filtered in place of the result.
+    std::vector<uint8_t> dense(channels > 1 ? voxels : 0);
+    uint8_t *out = channels > 1 ? dense.data() : reinterpret_cast<uint8_t *>(result.data());
+
+    if (settings.type == "median") {
+        medianFilter(src, channels, width, height, depth, qBound(1, settings.radius, kMaxMedianRadius), out);
+    } else if (settings.type == "gaussian") {
+        separableFilter(src, channels, width, height, depth, gaussianKernel(qBound(1, settings.radius, kMaxRadius)), 256.0f,
+                        [](uint8_t value) { return float(value); },
+                        [&](qsizetype offset, const float *values) {
+#pragma omp simd
+                            for (qsizetype x = 0; x < width; x++)
+                                out[offset + x] = uint8_t(values[x] + 0.5f);
+                        });
+    } else if (settings.type == "unsharp") {
+        separableFilter(src, channels, width, height, depth, gaussianKernel(qBound(1, settings.radius, kMaxRadius)), 256.0f,
+                        [](uint8_t value) { return float(value); },
+                        [&](qsizetype offset, const float *values) {
+#pragma omp simd
+                            for (qsizetype x = 0; x < width; x++) {
+                                const float value = src[channels * (offset + x)];
+                                out[offset + x] = uint8_t(qBound(0.0f, value + amount * (value - values[x]) + 0.5f, 255.0f));
+                            }
+                        });
+    } else if (settings.type == "contrast") {
+        // Stretch each voxel's deviation from its neighbourhood's mean by how
+        // much flatter the neighbourhood is than the volume. Empty space stays empty.
+        const std::vector<float> kernel = boxKernel(qBound(1, settings.radius, kMaxRadius));
+        const float globalDeviation = densityDeviation(src, channels, voxels);
+        std::vector<uint16_t> meanSquares(voxels);
+        separableFilter(src, channels, width, height, depth, kernel, 1.0f,
+                        [](uint8_t value) { return float(value) * value; },
+                        [&](qsizetype offset, const float *values) {
+#pragma omp simd
+                            for (qsizetype x = 0; x < width; x++)
+                                meanSquares[offset + x] = uint16_t(qMin(65535.0f, values[x] + 0.5f));
+                        });
+        separableFilter(src, channels, width, height, depth, kernel, 256.0f,
+                        [](uint8_t value) { return float(value); },
+                        [&](qsizetype offset, const float *values) {
+#pragma omp simd
+                            for (qsizetype x = 0; x < width; x++) {
+                                const float value = src[channels * (offset + x)];
+                                const float mean = values[x];
+                                const float deviation = std::sqrt(qMax(0.0f, meanSquares[offset + x] - mean * mean));
+                                const float gain = 1.0f + amount * qBound(0.0f, globalDeviation / qMax(deviation, 1.0f) - 1.0f, kMaxContrastGain - 1.0f);
+                                const float stretched = qBound(0.0f, mean + (value - mean) * gain + 0.5f, 255.0f);
+                                out[offset + x] = value > 0 ? uint8_t(stretched) : 0;
+                            }
+                        });
+    } else {
+        qWarning() << "Unknown volume filter:" << settings.type;
+        return volume;
+    }
+
+    if (channels > 1) {
+        std::copy_n(volume.constData(), volume.size(), result.data());
+        auto interleaved = reinterpret_cast<uint8_t *>(result.data());
+#pragma omp parallel for
+        for (qsizetype i = 0; i < voxels; i++)
+            interleaved[channels * i] = dense[i];
+    }
+
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    qDebug() << "Filtered" << width << "x" << height << "x" << depth << "with" << settings.key() << "in" << elapsed << "ms,"
+             << qRound(double(voxels) / elapsed / 1000.0) << "MVoxel/s";
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+VolumeFilterCache::VolumeFilterCache()
+{
+    m_cacheId = MemoryBudget::instance()->registerCache([this](qint64 bytes) {
+        QMutexLocker locker(&m_mutex);
+        return evict(bytes);
+    });
+}
+
+VolumeFilterCache::~VolumeFilterCache()
+{
+    MemoryBudget::instance()->unregisterCache(m_cacheId);
+}
+
+QByteArray VolumeFilterCache::find(const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return QByteArray();
+    it->lastUse = ++m_clock;
+    return it->volume;
+}
+
+void VolumeFilterCache::insert(const QString &key, const QByteArray &volume)
+{
+    // Accounted before taking the lock, tracking may evict from this cache.
+    MemoryReservation reservation = MemoryBudget::instance()->track(MemoryBudget::Cache, volume.size());
+    QMutexLocker locker(&m_mutex);
+    m_entries.insert(key, { volume, reservation, ++m_clock });
+}
+
+void VolumeFilterCache::clear()
+{
+    QHash<QString, Entry> entries;
+    {
+        QMutexLocker locker(&m_mutex);
+        entries.swap(m_entries);
+    }
+    // Reservations are released here, outside the lock.
+}
+
+qint64 VolumeFilterCache::evict(qint64 bytes)
+{
+    qint64 freed = 0;
+    while (freed < bytes && !m_entries.isEmpty()) {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->lastUse < oldest->lastUse)
+                oldest = it;
+        }
+        freed += oldest->volume.size();
+        m_entries.erase(oldest);
+    }
+    return freed;
+}
@@ -0,0 +1,75 @@
+#ifndef VOLUMEFILTER_H
+#define VOLUMEFILTER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include <src/memorybudget.h>
+
+// Noise filters for converted uint8 volumes. They run on the assembled
+// volume, so the chunks of a region see their neighbours' voxels across
+// their edges. Voxels past the edges of the volume repeat the edge.
+class VolumeFilter
+{
+public:
+    struct Settings
+    {
+        QString type = "none"; // "median", "gaussian", "unsharp" or "contrast".
+        int radius = 1; // Half the kernel width in voxels.
+        qreal amount = 1.0; // Strength of the unsharp mask and of local contrast.
+
+        bool isNone() const { return type.isEmpty() || type == "none"; }
+        // Identifies the settings in a cache.
+        QString key() const { return QString("%1/%2/%3").arg(type).arg(radius).arg(amount); }
+        bool operator==(const Settings &other) const { return key() == other.key(); }
+        bool operator!=(const Settings &other) const { return !(*this == other); }
+    };
+
+    // Bytes a filter allocates besides its result, to reserve them up front.
+    static qsizetype scratchBytes(const Settings &settings, qsizetype voxels, int channels);
+
+    // Filter the first channel of an interleaved uint8 volume, the density.
+    // Other channels are copied as they are.
+    static QByteArray apply(const QByteArray &volume, int channels, qsizetype width, qsizetype height, qsizetype depth,
+                            const Settings &settings);
+};
+
+// Filtered versions of one volume, keyed by filter settings, so switching
+// between filters or turning one off and on again does not filter anew.
+// Entries are accounted as cache memory and the least recently used are
+// evicted when the budget runs short.
+class VolumeFilterCache
+{
+public:
+    VolumeFilterCache();
+    ~VolumeFilterCache();
+
+    VolumeFilterCache(const VolumeFilterCache &) = delete;
+    VolumeFilterCache &operator=(const VolumeFilterCache &) = delete;
+
+    // Empty when the settings have not been filtered yet, or were evicted.
+    QByteArray find(const QString &key);
+    void insert(const QString &key, const QByteArray &volume);
+    // Forget every entry, for a new volume.
+    void clear();
+
+private:
+    struct Entry
+    {
+        QByteArray volume;
+        MemoryReservation reservation;
+        quint64 lastUse = 0;
+    };
+
+    // Drop least recently used entries until `bytes` are freed. Called with m_mutex held.
+    qint64 evict(qint64 bytes);
+
+    QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    quint64 m_clock = 0;
+    int m_cacheId = -1;
+};
+
+#endif // VOLUMEFILTER_H
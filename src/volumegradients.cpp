@@ -0,0 +1,103 @@
+#include <src/volumegradients.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtMath>
+
+#include <cmath>
+#include <vector>
+
+// The kernel is separable: each slice is smoothed and differentiated in x and
+// y once, and three neighbouring filtered slices combine along z. Work is
+// split into blocks of slices and rows that keep their filtered slices in cache.
+QByteArray VolumeGradients::compute(const uint8_t *volume, int channels, qsizetype width, qsizetype height, qsizetype depth)
+{
+    constexpr qsizetype kBlockSlices = 16;
+    constexpr qsizetype kBlockRows = 16;
+    constexpr int kGradientScale = 16; // Sum of the positive weights of a Sobel derivative.
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray gradients(width * height * depth * 4, Qt::Uninitialized);
+    const auto gradientsPtr = reinterpret_cast<uint8_t *>(gradients.data());
+
+    const qsizetype zBlocks = (depth + kBlockSlices - 1) / kBlockSlices;
+    const qsizetype yBlocks = (height + kBlockRows - 1) / kBlockRows;
+#pragma omp parallel for schedule(dynamic)
+    for (qsizetype block = 0; block < zBlocks * yBlocks; block++) {
+        const qsizetype z0 = (block / yBlocks) * kBlockSlices;
+        const qsizetype z1 = qMin(z0 + kBlockSlices, depth);
+        const qsizetype y0 = (block % yBlocks) * kBlockRows;
+        const qsizetype y1 = qMin(y0 + kBlockRows, height);
+        const qsizetype rows = y1 - y0;
+
+        // Filtered slices z - 1, z and z + 1 in a ring, slice z in slot (z + 1) % 3.
+        std::vector<int16_t> dx(3 * rows * width), dy(3 * rows * width), smooth(3 * rows * width);
+        std::vector<int16_t> rowSmooth(width), rowDerivative(width);
+
+        for (qsizetype z = z0 - 1; z <= z1; z++) {
+            const qsizetype sliceZ = qBound<qsizetype>(0, z, depth - 1);
+            const qsizetype slot = (z + 1) % 3;
+            for (qsizetype y = y0; y < y1; y++) {
+                const auto row = [&](qsizetype rowY) {
+                    return volume + channels * width * (qBound<qsizetype>(0, rowY, height - 1) + height * sliceZ);
+                };
+                const uint8_t *above = row(y - 1);
+                const uint8_t *center = row(y);
+                const uint8_t *below = row(y + 1);
+#pragma omp simd
+                for (qsizetype x = 0; x < width; x++) {
+                    rowSmooth[x] = int16_t(above[channels * x] + 2 * center[channels * x] + below[channels * x]);
+                    rowDerivative[x] = int16_t(below[channels * x] - above[channels * x]);
+                }
+
+                const qsizetype offset = (slot * rows + y - y0) * width;
+                int16_t *sliceDx = dx.data() + offset;
+                int16_t *sliceDy = dy.data() + offset;
+                int16_t *sliceSmooth = smooth.data() + offset;
+                const auto filter = [&](qsizetype x, qsizetype left, qsizetype right) {
+                    sliceDx[x] = int16_t(rowSmooth[right] - rowSmooth[left]);
+                    sliceDy[x] = int16_t(rowDerivative[left] + 2 * rowDerivative[x] + rowDerivative[right]);
+                    sliceSmooth[x] = int16_t(rowSmooth[left] + 2 * rowSmooth[x] + rowSmooth[right]);
+                };
+                filter(0, 0, qMin<qsizetype>(1, width - 1));
+#pragma omp simd
+                for (qsizetype x = 1; x < width - 1; x++)
+                    filter(x, x - 1, x + 1);
+                if (width > 1)
+                    filter(width - 1, width - 2, width - 1);
+            }
+
+            if (z < z0 + 1)
+                continue; // The ring is not full yet.
+
+            // Combine along z into slice z - 1.
+            const qsizetype outZ = z - 1;
+            const qsizetype before = ((outZ) % 3) * rows * width;
+            const qsizetype here = ((outZ + 1) % 3) * rows * width;
+            const qsizetype after = ((outZ + 2) % 3) * rows * width;
+            for (qsizetype y = y0; y < y1; y++) {
+                const qsizetype line = (y - y0) * width;
+                uint8_t *out = gradientsPtr + 4 * width * (y + height * outZ);
+#pragma omp simd
+                for (qsizetype x = 0; x < width; x++) {
+                    const float gx = dx[before + line + x] + 2 * dx[here + line + x] + dx[after + line + x];
+                    const float gy = dy[before + line + x] + 2 * dy[here + line + x] + dy[after + line + x];
+                    const float gz = smooth[after + line + x] - smooth[before + line + x];
+                    const float magnitude = std::sqrt(gx * gx + gy * gy + gz * gz);
+                    const float inverse = magnitude > 0 ? 127.5f / magnitude : 0.0f;
+                    out[4 * x + 0] = uint8_t(127.5f + gx * inverse);
+                    out[4 * x + 1] = uint8_t(127.5f + gy * inverse);
+                    out[4 * x + 2] = uint8_t(127.5f + gz * inverse);
+                    out[4 * x + 3] = uint8_t(qMin(255.0f, magnitude / kGradientScale));
+                }
+            }
+        }
+    }
+
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    qDebug() << "Gradients of" << width << "x" << height << "x" << depth << "in" << elapsed << "ms,"
+             << qRound(double(width * height * depth) / elapsed / 1000.0) << "MVoxel/s";
+    return gradients;
+}
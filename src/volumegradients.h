@@ -0,0 +1,19 @@
+#ifndef VOLUMEGRADIENTS_H
+#define VOLUMEGRADIENTS_H
+
+#include <QByteArray>
+
+#include <cstdint>
+
+// Gradients of converted volumes, for shading.
+class VolumeGradients
+{
+public:
+    // 3D Sobel gradient of the density channel (the first of `channels`),
+    // packed as RGBA8: the gradient direction in rgb mapped from [-1, 1] to
+    // [0, 255] and its magnitude in a, where a step of the full range between
+    // neighbours is 255. Voxels past the edges of the volume repeat the edge.
+    static QByteArray compute(const uint8_t *volume, int channels, qsizetype width, qsizetype height, qsizetype depth);
+};
+
+#endif // VOLUMEGRADIENTS_H
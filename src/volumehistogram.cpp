@@ -0,0 +1,123 @@
+#include <QtMath>
+
+#include <src/volumehistogram.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+VolumeHistogram::Bins VolumeHistogram::compute(const uint8_t *data, qsizetype size)
+{
+    Bins result = {};
+
+#pragma omp parallel
+    {
+        // Four interleaved sub-histograms per thread break the store-to-load
+        // dependency on runs of equal values, which dominate CT background.
+        std::array<uint32_t, 4 * kBins> local = {};
+        qsizetype begin = 0;
+        qsizetype end = size;
+#ifdef _OPENMP
+        const qsizetype threads = omp_get_num_threads();
+        const qsizetype thread = omp_get_thread_num();
+        begin = size * thread / threads;
+        end = size * (thread + 1) / threads;
+#endif
+        std::array<quint64, kBins> partial = {};
+        while (begin < end) {
+            // Flush before the 32-bit sub-bins can overflow.
+            const qsizetype batchEnd = qMin(end, begin + (qsizetype(1) << 30));
+            qsizetype i = begin;
+            for (; i + 4 <= batchEnd; i += 4) {
+                local[0 * kBins + data[i + 0]]++;
+                local[1 * kBins + data[i + 1]]++;
+                local[2 * kBins + data[i + 2]]++;
+                local[3 * kBins + data[i + 3]]++;
+            }
+            for (; i < batchEnd; i++)
+                local[data[i]]++;
+            for (int bin = 0; bin < kBins; bin++) {
+                partial[bin] += quint64(local[bin]) + local[kBins + bin] + local[2 * kBins + bin] + local[3 * kBins + bin];
+            }
+            local.fill(0);
+            begin = batchEnd;
+        }
+
+#pragma omp critical
+        for (int bin = 0; bin < kBins; bin++)
+            result[bin] += partial[bin];
+    }
+
+    return result;
+}
+
+void VolumeHistogram::addChunk(const QString &key, const Bins &bins)
+{
+    removeChunk(key);
+    m_chunks.insert(key, bins);
+    for (int bin = 0; bin < kBins; bin++)
+        m_total[bin] += bins[bin];
+}
+
+void VolumeHistogram::removeChunk(const QString &key)
+{
+    auto it = m_chunks.constFind(key);
+    if (it == m_chunks.constEnd())
+        return;
+    for (int bin = 0; bin < kBins; bin++)
+        m_total[bin] -= it.value()[bin];
+    m_chunks.erase(it);
+}
+
+void VolumeHistogram::syncChunks(const VolumeHistogram &other)
+{
+    const auto keys = m_chunks.keys();
+    for (const QString &key : keys) {
+        if (!other.m_chunks.contains(key))
+            removeChunk(key);
+    }
+    for (auto it = other.m_chunks.constBegin(); it != other.m_chunks.constEnd(); ++it) {
+        const auto mine = m_chunks.constFind(it.key());
+        if (mine == m_chunks.constEnd() || mine.value() != it.value())
+            addChunk(it.key(), it.value());
+    }
+}
+
+void VolumeHistogram::clear()
+{
+    m_chunks.clear();
+    m_total.fill(0);
+}
+
+double VolumeHistogram::percentile(double fraction) const
+{
+    quint64 count = 0;
+    for (int bin = 1; bin < kBins; bin++)
+        count += m_total[bin];
+    if (count == 0)
+        return fraction <= 0 ? 0.0 : 1.0;
+
+    const quint64 target = qBound<quint64>(0, quint64(qBound(0.0, fraction, 1.0) * count), count);
+    quint64 sum = 0;
+    for (int bin = 1; bin < kBins; bin++) {
+        sum += m_total[bin];
+        if (sum >= target && sum > 0)
+            return bin / double(kBins - 1);
+    }
+    return 1.0;
+}
+
+QList<qreal> VolumeHistogram::normalized() const
+{
+    QList<qreal> result(kBins, 0.0);
+    quint64 maxCount = 0;
+    for (int bin = 1; bin < kBins; bin++) // Skip the empty-space bin, it would flatten the rest.
+        maxCount = qMax(maxCount, m_total[bin]);
+    if (maxCount == 0)
+        return result;
+
+    const qreal maxLog = qLn(1.0 + maxCount);
+    for (int bin = 0; bin < kBins; bin++)
+        result[bin] = qMin(1.0, qLn(1.0 + m_total[bin]) / maxLog);
+    return result;
+}
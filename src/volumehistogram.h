@@ -0,0 +1,45 @@
+#ifndef VOLUMEHISTOGRAM_H
+#define VOLUMEHISTOGRAM_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include <array>
+#include <cstdint>
+
+// Intensity histogram of the uint8 texture values, kept per chunk and merged.
+class VolumeHistogram
+{
+public:
+    static constexpr int kBins = 256;
+    using Bins = std::array<quint64, kBins>;
+
+    // Bin a buffer of texture values in parallel.
+    static Bins compute(const uint8_t *data, qsizetype size);
+
+    // Add a chunk's bins to the total, replacing any previous entry for the key.
+    void addChunk(const QString &key, const Bins &bins);
+    // Subtract a chunk's bins from the total.
+    void removeChunk(const QString &key);
+    // Add, replace or evict chunks so that only the chunks of `other` remain,
+    // with its bins. A reloaded chunk may keep its key but not its values.
+    void syncChunks(const VolumeHistogram &other);
+    void clear();
+
+    bool isEmpty() const { return m_chunks.isEmpty(); }
+    const Bins &total() const { return m_total; }
+
+    // Value in [0..1] below which `fraction` of the non-zero voxels fall.
+    // Bin zero is ignored because the ray marcher treats it as empty space.
+    double percentile(double fraction) const;
+
+    // Bin counts scaled to [0..1] on a log scale, for display.
+    QList<qreal> normalized() const;
+
+private:
+    QHash<QString, Bins> m_chunks;
+    Bins m_total = {};
+};
+
+#endif // VOLUMEHISTOGRAM_H
@@ -0,0 +1,134 @@
+#include <src/volumesnapshot.h>
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+static constexpr quint32 kMagic = 0x56565353; // "VVSS"
+static constexpr qint64 kPageSize = 4096;
+
+// Volume bytes start on the first page after the header.
+static qint64 dataOffset(qint64 headerSize)
+{
+    return (headerSize + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+QString VolumeSnapshot::path()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("last_volume.snapshot");
+}
+
+bool VolumeSnapshot::save(const VolumeTextureData::AsyncLoaderData &data)
+{
+    // Superseding loads cancel this one before they save, checking under the
+    // lock orders the writes as the loads were started.
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (data.isCancelled())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray header;
+    {
+        QDataStream out(&header, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_5);
+        out << kMagic << kVersion;
+        out << data.source << qint64(data.width) << qint64(data.height) << qint64(data.depth) << data.dataType;
+        out << data.localFocusPoint << data.globalFocusPoint << qint32(data.level) << data.order;
+        out << data.overlaySources << data.overlayLevels << data.overlayOrders;
+        out << qint32(data.regionChunks) << data.sliceMin << data.sliceMax << data.spacing;
+        out << qint32(data.channels) << data.occupiedMin << data.occupiedMax;
+        for (quint64 count : data.histogram.total())
+            out << count;
+        out << qint64(data.volumeData.size());
+    }
+
+    const QString fileName = path();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write volume snapshot:" << file.errorString();
+        return false;
+    }
+    const qint64 offset = dataOffset(sizeof(quint32) + header.size());
+    const QByteArray padding(offset - sizeof(quint32) - header.size(), '\0');
+    const quint32 headerSize = header.size();
+    if (file.write(reinterpret_cast<const char *>(&headerSize), sizeof(headerSize)) != sizeof(headerSize)
+            || file.write(header) != header.size()
+            || file.write(padding) != padding.size()
+            || file.write(data.volumeData) != data.volumeData.size()
+            || !file.commit()) {
+        qWarning() << "Could not write volume snapshot:" << file.errorString();
+        return false;
+    }
+
+    qDebug() << "Saved volume snapshot:" << data.volumeData.size() << "bytes in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool VolumeSnapshot::load(VolumeTextureData::AsyncLoaderData &data)
+{
+    auto snapshot = std::make_shared<QFile>(path());
+    if (!snapshot->open(QIODevice::ReadOnly))
+        return false; // No snapshot yet.
+
+    quint32 headerSize = 0;
+    if (snapshot->read(reinterpret_cast<char *>(&headerSize), sizeof(headerSize)) != sizeof(headerSize))
+        return false;
+    const QByteArray header = snapshot->read(headerSize);
+
+    QDataStream in(header);
+    in.setVersion(QDataStream::Qt_6_5);
+    quint32 magic = 0;
+    quint32 version = 0;
+    in >> magic >> version;
+    if (magic != kMagic || version != kVersion) {
+        qDebug() << "Ignoring volume snapshot of version" << version;
+        return false;
+    }
+
+    qint64 width, height, depth, volumeSize;
+    qint32 level, regionChunks, channels;
+    VolumeHistogram::Bins bins;
+    in >> data.source >> width >> height >> depth >> data.dataType;
+    in >> data.localFocusPoint >> data.globalFocusPoint >> level >> data.order;
+    in >> data.overlaySources >> data.overlayLevels >> data.overlayOrders;
+    in >> regionChunks >> data.sliceMin >> data.sliceMax >> data.spacing;
+    in >> channels >> data.occupiedMin >> data.occupiedMax;
+    for (quint64 &count : bins)
+        in >> count;
+    in >> volumeSize;
+
+    const qint64 offset = dataOffset(sizeof(quint32) + headerSize);
+    if (in.status() != QDataStream::Ok || volumeSize != width * height * depth * channels
+            || snapshot->size() < offset + volumeSize) {
+        qWarning() << "Ignoring truncated volume snapshot:" << snapshot->fileName();
+        return false;
+    }
+
+    uchar *mapped = snapshot->map(offset, volumeSize);
+    if (!mapped) {
+        qWarning() << "Could not map volume snapshot:" << snapshot->errorString();
+        return false;
+    }
+
+    data.width = width;
+    data.height = height;
+    data.depth = depth;
+    data.level = level;
+    data.regionChunks = regionChunks;
+    data.channels = channels;
+    data.volumeData = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), volumeSize);
+    data.histogram.clear();
+    data.histogram.addChunk(data.source.toString(), bins);
+    data.success = true;
+    data.mapping = snapshot;
+    return true;
+}
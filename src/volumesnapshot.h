@@ -0,0 +1,33 @@
+#ifndef VOLUMESNAPSHOT_H
+#define VOLUMESNAPSHOT_H
+
+#include <QString>
+
+#include <src/volumetexturedata.h>
+
+// The last volume shown by the first VolumeTextureData kept on disk, so a
+// restart can show it straight away and revalidate it against its source in
+// the background. It is written when loads go idle and when the app quits. The converted
+// bytes are stored page aligned after a versioned header and are memory
+// mapped on load instead of read.
+class VolumeSnapshot
+{
+public:
+    // Bumped whenever the layout or the meaning of a field changes. Snapshots
+    // of any other version are ignored.
+    static constexpr quint32 kVersion = 2;
+
+    static QString path();
+
+    // Write the converted volume and the inputs that produced it. Written to
+    // a temporary file first, so a crash never leaves a partial snapshot.
+    // Loads that have been superseded are not written, so an older load
+    // never replaces the snapshot of a newer one.
+    static bool save(const VolumeTextureData::AsyncLoaderData &data);
+
+    // Read the header and map the volume bytes. The volume data refers to the
+    // mapping and stays valid for as long as the data's mapping is kept.
+    static bool load(VolumeTextureData::AsyncLoaderData &data);
+};
+
+#endif // VOLUMESNAPSHOT_H
@@ -2,31 +2,73 @@
 // SPDX-License-Identifier: LicenseRef-Qt-Commercial OR BSD-3-Clause
 
 #include "volumetexturedata.h"
-#include "qthread.h"
 #include <QSize>
 #include <QFile>
+#include <QFileInfo>
 #include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector2D>
+#include <QtMath>
 
 #include <QDebug>
 #include <QCoreApplication>
-#include <QEventLoop>
-#include <QNetworkRequest>
-#include <QNetworkReply>
-#include <QNetworkAccessManager>
+#include <QLoggingCategory>
 
-#include <unordered_map>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <vector>
 
 #include <nrrd.h>
 
+#include <src/loaderpool.h>
+#include <src/memorybudget.h>
+#include <src/residentvolumes.h>
+#include <src/resourcefetcher.h>
 #include <src/storagezarr.h>
+#include <src/volumegradients.h>
+#include <src/zarrsession.h>
+#include <src/volumefilter.h>
+#include <src/volumehistogram.h>
+#include <src/volumesnapshot.h>
 
 QT_BEGIN_NAMESPACE
 
+// Per load details, enabled with QT_LOGGING_RULES="volume.downsampling.debug=true".
+Q_LOGGING_CATEGORY(lcDownsampling, "volume.downsampling", QtWarningMsg)
+
 enum ExampleId { Helix, Box, Colormap };
 
-// Method to convert data from T to uint8_t
+// Range of the values in an array of T.
+template<typename T>
+static std::pair<double, double> valueRange(const T *data, qsizetype count, bool parallel = true)
+{
+    T min = std::numeric_limits<T>::max();
+    T max = std::numeric_limits<T>::lowest();
+
+#pragma omp parallel if (parallel)
+    {
+        T localMin = std::numeric_limits<T>::max();
+        T localMax = std::numeric_limits<T>::lowest();
+#pragma omp for
+        for (qsizetype i = 0; i < count; i++) {
+            localMin = qMin(localMin, data[i]);
+            localMax = qMax(localMax, data[i]);
+        }
+#pragma omp critical
+        {
+            min = qMin(min, localMin);
+            max = qMax(max, localMax);
+        }
+    }
+    return { double(min), double(max) }; // int16 ranges overflow T
+}
+
+// Method to convert data from T to uint8_t, binning the result as it goes
 template<typename T>
-static void convertData(QByteArray &imageData, const QByteArray &imageDataSource)
+static VolumeHistogram::Bins convertData(QByteArray &imageData, const QByteArray &imageDataSource)
 {
     Q_ASSERT(imageDataSource.size() > 0);
     constexpr auto kScale = sizeof(T) / sizeof(uint8_t);
@@ -35,38 +77,204 @@ static void convertData(QByteArray &imageData, const QByteArray &imageDataSource
     imageData.resize(imageDataSourceSize);
     auto imageDataPtr = reinterpret_cast<uint8_t *>(imageData.data());
 
-    T min = std::numeric_limits<T>::max();
-    T max = std::numeric_limits<T>::min();
+    const auto [min, max] = valueRange(imageDataSourceData, imageDataSourceSize);
+    const double range = max - min;
+    const double rangeInv = range > 0 ? 255.0 / range : 0.0; // use double for optimal precision
 
-#pragma omp parallel for
-    for (int i = 0; i < imageDataSourceSize; i++) {
-        if (imageDataSourceData[i] > max) {
+    VolumeHistogram::Bins bins = {};
+#pragma omp parallel
+    {
+        VolumeHistogram::Bins localBins = {};
+#pragma omp for
+        for (int i = 0; i < imageDataSourceSize; i++) {
+            const uint8_t value = (imageDataSourceData[i] - min) * rangeInv;
+            imageDataPtr[i] = value;
+            localBins[value]++;
+        }
 #pragma omp critical
-            max = qMax(max, imageDataSourceData[i]);
+        for (int bin = 0; bin < VolumeHistogram::kBins; bin++)
+            bins[bin] += localBins[bin];
+    }
+    return bins;
+}
+
+// Convert a chunk from T to uint8_t over [min, max] into its place in a larger
+// volume, binning the result as it goes. Values outside the range are clamped,
+// uint8_t chunks are copied as they are.
+template<typename T>
+static VolumeHistogram::Bins convertChunk(uint8_t *volume, qsizetype volumeWidth, qsizetype volumeHeight,
+                                          qsizetype originX, qsizetype originY, qsizetype originZ,
+                                          const T *chunk, qsizetype width, qsizetype height, qsizetype depth,
+                                          double min, double max, bool parallel = true)
+{
+    const double rangeInv = max > min ? 255.0 / (max - min) : 0.0;
+
+    VolumeHistogram::Bins bins = {};
+#pragma omp parallel if (parallel)
+    {
+        VolumeHistogram::Bins localBins = {};
+#pragma omp for
+        for (qsizetype row = 0; row < height * depth; row++) {
+            const qsizetype y = row % height;
+            const qsizetype z = row / height;
+            const T *src = chunk + width * row;
+            uint8_t *dst = volume + originX + volumeWidth * (originY + y + volumeHeight * (originZ + z));
+            for (qsizetype x = 0; x < width; x++) {
+                uint8_t value;
+                if constexpr (std::is_same_v<T, uint8_t>)
+                    value = src[x];
+                else
+                    value = uint8_t(qBound(0.0, (src[x] - min) * rangeInv, 255.0));
+                dst[x] = value;
+                localBins[value]++;
+            }
         }
+#pragma omp critical
+        for (int bin = 0; bin < VolumeHistogram::kBins; bin++)
+            bins[bin] += localBins[bin];
     }
+    return bins;
+}
 
-#pragma omp parallel for
-    for (int i = 0; i < imageDataSourceSize; i++) {
-        if (imageDataSourceData[i] < min) {
+// Convert a chunk as convertChunk does, downsampled by a factor per axis:
+// each voxel of the volume is the mean of a block of source voxels. Only
+// whole blocks are converted, sides that are not a multiple of their factor
+// lose their last voxels. The rows of a block are summed at full width,
+// which vectorises, and then reduced along x, so there is no full
+// resolution copy of the converted chunk.
+template<typename T>
+static VolumeHistogram::Bins convertChunkDownsampled(uint8_t *volume, qsizetype volumeWidth, qsizetype volumeHeight,
+                                                     qsizetype originX, qsizetype originY, qsizetype originZ,
+                                                     const T *chunk, qsizetype width, qsizetype height, qsizetype depth,
+                                                     int factorX, int factorY, int factorZ,
+                                                     double min, double max, bool parallel = true)
+{
+    const qsizetype outWidth = width / factorX;
+    const qsizetype outHeight = height / factorY;
+    const qsizetype outDepth = depth / factorZ;
+    const double rangeInv = max > min ? 255.0 / (max - min) : 0.0;
+    const double blockInv = 1.0 / (factorX * factorY * factorZ);
+
+    VolumeHistogram::Bins bins = {};
+#pragma omp parallel if (parallel)
+    {
+        VolumeHistogram::Bins localBins = {};
+        std::vector<float> sums(outWidth * factorX);
+#pragma omp for
+        for (qsizetype row = 0; row < outHeight * outDepth; row++) {
+            const qsizetype y = row % outHeight;
+            const qsizetype z = row / outHeight;
+            std::fill(sums.begin(), sums.end(), 0.0f);
+            float *sum = sums.data();
+            for (int dz = 0; dz < factorZ; dz++) {
+                for (int dy = 0; dy < factorY; dy++) {
+                    const T *src = chunk + width * (y * factorY + dy + height * (z * factorZ + dz));
+#pragma omp simd
+                    for (qsizetype x = 0; x < outWidth * factorX; x++)
+                        sum[x] += float(src[x]);
+                }
+            }
+
+            uint8_t *dst = volume + originX + volumeWidth * (originY + y + volumeHeight * (originZ + z));
+            for (qsizetype x = 0; x < outWidth; x++) {
+                float blockSum = 0.0f;
+                for (int dx = 0; dx < factorX; dx++)
+                    blockSum += sum[x * factorX + dx];
+                const double mean = blockSum * blockInv;
+                uint8_t value;
+                if constexpr (std::is_same_v<T, uint8_t>)
+                    value = uint8_t(mean + 0.5);
+                else
+                    value = uint8_t(qBound(0.0, (mean - min) * rangeInv, 255.0));
+                dst[x] = value;
+                localBins[value]++;
+            }
+        }
 #pragma omp critical
-            min = qMin(min, imageDataSourceData[i]);
+        for (int bin = 0; bin < VolumeHistogram::kBins; bin++)
+            bins[bin] += localBins[bin];
+    }
+    return bins;
+}
+
+// Downsampling factors along x, y and z that bring a volume of `size`
+// voxels within the budgets and the texture side limit, budgets and limits
+// of 0 are unlimited. Factors divide `block`, the chunk shape, so chunks reduce to
+// whole voxels, any factor goes along axes where it is 0. The axis with the
+// most voxels is reduced first.
+static std::array<int, 3> downsampleFactors(const std::array<qsizetype, 3> &size, const std::array<qsizetype, 3> &block,
+                                            int bytesPerVoxel, qint64 voxelBudget, qint64 byteBudget, int maxSide)
+{
+    std::array<int, 3> factors = { 1, 1, 1 };
+    const auto side = [&](int axis) { return size[axis] / factors[axis]; };
+    const auto fits = [&] {
+        qint64 voxels = 1;
+        for (int axis = 0; axis < 3; axis++) {
+            if (maxSide > 0 && side(axis) > maxSide)
+                return false;
+            voxels *= side(axis);
+        }
+        return (voxelBudget <= 0 || voxels <= voxelBudget) && (byteBudget <= 0 || voxels * bytesPerVoxel <= byteBudget);
+    };
+    while (!fits()) {
+        int axis = -1;
+        for (int candidate = 0; candidate < 3; candidate++) {
+            const qsizetype limit = block[candidate] > 0 ? block[candidate] : size[candidate];
+            if (factors[candidate] < limit && (axis < 0 || side(candidate) > side(axis)))
+                axis = candidate;
         }
+        if (axis < 0)
+            break; // Down to a voxel per chunk.
+        int factor = factors[axis] + 1;
+        while (block[axis] > 0 && block[axis] % factor != 0)
+            factor++;
+        factors[axis] = factor;
     }
-    const T range = max - min;
-    const double rangeInv = 255.0 / range; // use double for optimal precision
+    return factors;
+}
 
-#pragma omp parallel for
-    for (int i = 0; i < imageDataSourceSize; i++) {
-        imageDataPtr[i] = (imageDataSourceData[i] - min) * rangeInv;
+// Distance from a voxel to the helix x = offset + radius * cos(t), y = offset + radius * sin(t),
+// z = climb * t - zOffset, clipped to the part of the curve inside the volume.
+static float helixDistance(const QVector3D &cell, float zOffset)
+{
+    constexpr float radius = 70.f;
+    constexpr float climb = 15.f;
+    constexpr float offset = 256 / 2;
+    constexpr float turn = 2.f * float(M_PI);
+
+    const float tMin = zOffset / climb;
+    const float tMax = (255.f + zOffset) / climb;
+
+    // Start from the turn at the voxel's angle that is closest in height, then
+    // refine with Newton steps on the squared distance.
+    const float angle = std::atan2(cell.y() - offset, cell.x() - offset);
+    const float tHeight = (cell.z() + zOffset) / climb;
+    float t = angle + turn * std::round((tHeight - angle) / turn);
+    for (int i = 0; i < 2; i++) {
+        const float c = std::cos(t);
+        const float s = std::sin(t);
+        const QVector3D delta(offset + radius * c - cell.x(), offset + radius * s - cell.y(), climb * t - zOffset - cell.z());
+        const QVector3D tangent(-radius * s, radius * c, climb);
+        const QVector3D normal(-radius * c, -radius * s, 0);
+        const float derivative = QVector3D::dotProduct(delta, tangent);
+        const float curvature = tangent.lengthSquared() + QVector3D::dotProduct(delta, normal);
+        if (curvature <= 0)
+            break;
+        t -= derivative / curvature;
     }
+    t = qBound(tMin, t, tMax);
+
+    const QVector3D point(offset + radius * std::cos(t), offset + radius * std::sin(t), climb * t - zOffset);
+    return cell.distanceToPoint(point);
 }
 
+// Generates the built-in volumes in a single parallel pass that evaluates
+// each voxel independently.
 static QByteArray createBuiltinVolume(int exampleId)
 {
     constexpr int size = 256;
 
-    QByteArray byteArray(size * size * size, 0);
+    QByteArray byteArray(size * size * size, Qt::Uninitialized);
     uint8_t *data = reinterpret_cast<uint8_t *>(byteArray.data());
     const auto cellIndex = [size](int x, int y, int z) {
         Q_UNUSED(size); // MSVC specific
@@ -75,118 +283,60 @@ static QByteArray createBuiltinVolume(int exampleId)
         return index;
     };
 
-    const auto createHelix = [&](float zOffset, uint8_t color) {
-        //  x = radius * cos(t)
-        //  y = radius * sin(t)
-        //  z = climb * t
-        //
-        // We go through t until z is outside of box
+    const auto helixVoxel = [&](int x, int y, int z) -> uint8_t {
+        // Fill with weird ball and holes
+        const QVector3D cell(x, y, z);
+        const QVector3D centreCell(size / 2, size / 2, size / 2);
+        const float dist = centreCell.distanceToPoint(cell);
+        const float value = dist * 0.5f - 40.f; // Negative value means cell is inside of sphere
+        uint8_t color = value >= 0 ? quint8(qBound(value, 0.f, 80.f)) : 80;
 
+        // Three helices, later ones are drawn on top.
         constexpr float radius = 70.f;
-        constexpr float climb = 15.f;
-        constexpr float offset = 256 / 2;
-        constexpr int thick = 6; // half radius
-
-        int i = -1;
-        QVector3D lastCell = QVector3D(0, 0, 0);
-        while (true) {
-            i++;
-            const float t = i * 0.005f;
-            const int cellX = offset + radius * qCos(t);
-            const int cellY = offset + radius * qSin(t);
-            const int cellZ = (climb * t) - zOffset;
-            if (cellZ < 0) {
-                continue;
-            }
-            if (cellZ > 255)
-                break;
-
-            QVector3D originalCell(cellX, cellY, cellZ);
-            if (originalCell == lastCell)
-                continue;
-            lastCell = originalCell;
-
-#pragma omp parallel for
-            for (int z = cellZ - thick; z < cellZ + thick; z++) {
-                if (z < 0 || z > 255)
-                    continue;
-                for (int y = cellY - thick; y < cellY + thick; y++) {
-                    if (y < 0 || y > 255)
-                        continue;
-                    for (int x = cellX - thick; x < cellX + thick; x++) {
-                        if (x < 0 || x > 255)
-                            continue;
-                        QVector3D currCell(x, y, z);
-                        float dist = originalCell.distanceToPoint(currCell);
-                        if (dist < thick) {
-                            data[cellIndex(x, y, z)] = color;
-                        }
-                    }
-                }
-            }
+        constexpr float thick = 6; // half radius
+        const float radial = QVector2D(x - size / 2, y - size / 2).length();
+        if (qAbs(radial - radius) >= thick)
+            return color;
+        const std::array<std::pair<float, uint8_t>, 3> helices = { { { 0, 200 }, { 30, 150 }, { 60, 100 } } };
+        for (const auto &[zOffset, helixColor] : helices) {
+            if (helixDistance(cell, zOffset) < thick)
+                color = helixColor;
         }
+        return color;
     };
 
-    if (exampleId == ExampleId::Helix) {
-        // Fill with weird ball and holes
-        QVector3D centreCell(size / 2, size / 2, size / 2);
-#pragma omp parallel for
-        for (int z = 0; z < size; z++) {
-            for (int y = 0; y < size; y++) {
-                for (int x = 0; x < size; x++) {
-                    const float dist = centreCell.distanceToPoint(QVector3D(x, y, z));
-                    const float value = dist * 0.5f - 40.f; // Negative value means cell is inside of sphere
-                    data[cellIndex(x, y, z)] = value >= 0 ? quint8(qBound(value, 0.f, 80.f)) : 80;
-                }
-            }
-        }
-        createHelix(0, 200);
-        createHelix(30, 150);
-        createHelix(60, 100);
-
-    } else if (exampleId == ExampleId::Colormap) {
-#pragma omp parallel for
-        for (int z = 0; z < 256; z++) {
-            for (int y = 0; y < 256; y++) {
-                for (int x = 0; x < 256; x++) {
-                    data[cellIndex(x, y, z)] = x;
-                }
-            }
-        }
-    } else if (exampleId == ExampleId::Box) {
-        std::array<int, 6> colors = { 50, 100, 255, 200, 150, 10 };
+    const auto boxVoxel = [&](int x, int y, int z) -> uint8_t {
+        constexpr std::array<int, 6> colors = { 50, 100, 255, 200, 150, 10 };
         constexpr int width = 10;
+        // Faces are drawn x first, then y, then z, so z wins on the edges.
+        uint8_t color = 0;
+        if (x < width)
+            color = colors[0];
+        else if (x >= size - width)
+            color = colors[1];
+        if (y < width)
+            color = colors[2];
+        else if (y >= size - width)
+            color = colors[3];
+        if (z < width)
+            color = colors[4];
+        else if (z >= size - width)
+            color = colors[5];
+        return color;
+    };
+
 #pragma omp parallel for
-        for (int i = 0; i < width; i++) {
-            int x0 = i;
-            int x1 = 255 - i;
-            for (int z = 0; z < 256; z++) {
-                for (int y = 0; y < 256; y++) {
-                    data[cellIndex(x0, y, z)] = colors[0];
-                    data[cellIndex(x1, y, z)] = colors[1];
-                }
-            }
-        }
-#pragma omp parallel for
-        for (int i = 0; i < width; i++) {
-            int y0 = i;
-            int y1 = 255 - i;
-            for (int z = 0; z < 256; z++) {
-                for (int x = 0; x < 256; x++) {
-                    data[cellIndex(x, y0, z)] = colors[2];
-                    data[cellIndex(x, y1, z)] = colors[3];
-                }
-            }
-        }
-#pragma omp parallel for
-        for (int i = 0; i < width; i++) {
-            int z0 = i;
-            int z1 = 255 - i;
-            for (int y = 0; y < 256; y++) {
-                for (int x = 0; x < 256; x++) {
-                    data[cellIndex(x, y, z0)] = colors[4];
-                    data[cellIndex(x, y, z1)] = colors[5];
-                }
+    for (int z = 0; z < size; z++) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                uint8_t color = 0;
+                if (exampleId == ExampleId::Helix)
+                    color = helixVoxel(x, y, z);
+                else if (exampleId == ExampleId::Box)
+                    color = boxVoxel(x, y, z);
+                else if (exampleId == ExampleId::Colormap)
+                    color = x;
+                data[cellIndex(x, y, z)] = color;
             }
         }
     }
@@ -194,71 +344,69 @@ static QByteArray createBuiltinVolume(int exampleId)
     return byteArray;
 }
 
-static QByteArray fetchResourceBlocking(QUrl resourceUrl)
+// First chunk of a region of `size` chunks around `focus`, kept inside the array where it fits.
+static int regionStart(int focus, int size, int shape, int chunk)
 {
-    qDebug() << "Fetch:" << resourceUrl;
-
-    QNetworkRequest netRequest(resourceUrl);
-    QNetworkAccessManager* manager = new QNetworkAccessManager();
-
-    // Create an event loop to block until the request finishes
-    QEventLoop loop;
-
-    // Connect the finished signal to quit the event loop
-    QObject::connect(manager, &QNetworkAccessManager::finished, &loop, &QEventLoop::quit);
-
-    // Make the request
-    QNetworkReply* reply = manager->get(netRequest);
+    int start = focus - (size - 1) / 2;
+    const int count = chunk > 0 ? (shape + chunk - 1) / chunk : 0;
+    if (count >= size)
+        start = qMin(start, count - size);
+    return qMax(start, 0);
+}
 
-    // Enter the event loop and block until the request is finished
-    loop.exec();
+// The block of regionChunks^3 chunks loaded around a focus point.
+struct ZarrRegion
+{
+    int focusX, focusY, focusZ; // Chunk holding the focus point.
+    int startX, startY, startZ; // First chunk of the region.
+    QVector3D localFocusPoint; // The focus point in local box coordinates.
+};
 
-    // Once finished, handle the reply
-    if (reply->error() == QNetworkReply::NoError) {
-        // Success: process the reply data
-        QByteArray data = reply->readAll();
-        qDebug() << "Reply data:" << data.size();
-        return data;
-    }
-    else {
-        // Error handling
-        qDebug() << "Error:" << reply->errorString();
-    }
+static ZarrRegion zarrRegion(StorageZarr &zarr, const QVector3D &globalFocusPoint, int regionChunks)
+{
+    const auto focusPoint = std::make_tuple(globalFocusPoint.z(), globalFocusPoint.y(), globalFocusPoint.x()); // PI letter (z, y, x).
+    ZarrRegion region;
+    std::tie(region.focusZ, region.focusY, region.focusX) = zarr.getNearestChunk(focusPoint);
+    const auto [remZ, remY, remX] = zarr.getNearestChunkRemainder(focusPoint);
+    const auto [chunkDepth, chunkHeight, chunkWidth] = zarr.getChunks();
+    const auto [shapeZ, shapeY, shapeX] = zarr.getShape();
 
-    // Clean up the reply
-    reply->deleteLater();
+    region.startX = regionStart(region.focusX, regionChunks, shapeX, chunkWidth);
+    region.startY = regionStart(region.focusY, regionChunks, shapeY, chunkHeight);
+    region.startZ = regionStart(region.focusZ, regionChunks, shapeZ, chunkDepth);
 
-    return QByteArray(); // Empty.
+    float boxSize = 50;
+    const QVector3D focusInRegion(region.focusX - region.startX + remX, region.focusY - region.startY + remY, region.focusZ - region.startZ + remZ);
+    region.localFocusPoint = 2 * boxSize * focusInRegion / regionChunks - QVector3D(boxSize, boxSize, boxSize);
+    return region;
 }
 
+// Loads a block of regionChunks^3 chunks around the focus point into one uint8
+// volume. The chunks go through a pipeline: up to kMaxChunksInFlight chunks are
+// fetched at once on the network thread while the chunks that already arrived
+// are decoded and converted on the loader pool, so a region costs about the
+// slower of network and CPU time rather than their sum.
+//
+// Every chunk is scaled to uint8 over the value range of the focus chunk, which
+// is fetched first, so the chunks of a region line up without seams.
 static VolumeTextureData::AsyncLoaderData loadVolumeZarr(const VolumeTextureData::AsyncLoaderData& input)
 {
-    QByteArray imageDataSource;
+    constexpr int kMaxChunksInFlight = 8;
+    constexpr qint64 kPublishInterval = 100; // Shortest time between partial volumes in ms.
+    constexpr int kCancelCheckMs = 50; // How often a waiting load looks for its cancellation.
 
     QVector3D globalFocusPoint = input.globalFocusPoint; // Point to center the cursor on in global scroll coorindates.
     QVector3D localFocusPoint; // Point to center the cursor on in local box coordinates.
 
-    StorageZarr zarr(input.source);
+    QElapsedTimer metadataTimer;
+    metadataTimer.start();
+    auto session = ZarrSession::forStore(input.source);
+    const int level = session->resolveLevel(input.level);
+    StorageZarr zarr = session->storage(level);
+    const qint64 metadataUsecs = metadataTimer.nsecsElapsed() / 1000;
 
-    QUrl metdataUrl = zarr.getMetadataUrl(input.level);
-    QByteArray jsonData = fetchResourceBlocking(metdataUrl);
-    if (!jsonData.isEmpty()) {
-        zarr.setMetadata(jsonData);
-    }
-
-    std::unordered_map<std::string, std::string> dataTypeMap = { // Use std::string because QString has no hash function.
-        { "|u1", "uint8" },
-        { "|u2", "uint16" },
-        { "|i2", "int16" },
-        { "|f4", "float32" },
-        { "|f8", "float64" },
-    };
-    std::string oldDataType = zarr.getDataType().toStdString();
-    QString newDataType;
-    if (dataTypeMap.count(oldDataType) != 0) {
-        newDataType = QString::fromStdString(dataTypeMap[oldDataType]);
-    }
-    else {
+    QString newDataType = zarr.getDataTypeName();
+    if (newDataType.isEmpty()) {
         qWarning() << "Zarr data type is not understood:" << zarr.getDataType();
     }
 
@@ -267,26 +415,505 @@ static VolumeTextureData::AsyncLoaderData loadVolumeZarr(const VolumeTextureData
         qDebug() << "Zarr dimension order changed to:" << input.order;
     }
 
-    const auto focusPoint = std::make_tuple(globalFocusPoint.z(), globalFocusPoint.y(), globalFocusPoint.x()); // PI letter (z, y, x).
-    const auto [chunkZ, chunkY, chunkX] = zarr.getNearestChunk(focusPoint);
-    const auto [remZ, remY, remX] = zarr.getNearestChunkRemainder(focusPoint);
+    int chunkDepth, chunkHeight, chunkWidth; // Plain variables, the stages capture them.
+    std::tie(chunkDepth, chunkHeight, chunkWidth) = zarr.getChunks();
 
-    float boxSize = 50;
-    localFocusPoint = 2 * boxSize * QVector3D(remX, remY, remZ) - QVector3D(boxSize, boxSize, boxSize);
+    const int regionChunks = qMax(input.regionChunks, 1);
+    const ZarrRegion region = zarrRegion(zarr, globalFocusPoint, regionChunks);
+    const int focusX = region.focusX, focusY = region.focusY, focusZ = region.focusZ;
+    const int startX = region.startX, startY = region.startY, startZ = region.startZ;
+    localFocusPoint = region.localFocusPoint;
 
-    QUrl chunkUrl = zarr.getChunkUrl(input.level, chunkZ, chunkY, chunkX);
-    QByteArray data = fetchResourceBlocking(chunkUrl);
-    if (!data.isEmpty()) {
-        imageDataSource = zarr.readChunk(data);
+    auto result = input;
+    result.stages[LoadTrace::Metadata] = metadataUsecs;
+    if (chunkWidth <= 0 || chunkHeight <= 0 || chunkDepth <= 0) {
+        qWarning() << "Zarr metadata is not available:" << input.source;
+        result.success = false;
+        return result;
     }
 
-    auto result = input;
-    result.volumeData = imageDataSource;
+    // Regions over the budget are downsampled as their chunks are converted.
+    const qsizetype regionWidth = qsizetype(chunkWidth) * regionChunks;
+    const qsizetype regionHeight = qsizetype(chunkHeight) * regionChunks;
+    const qsizetype regionDepth = qsizetype(chunkDepth) * regionChunks;
+    const std::array<int, 3> factors = downsampleFactors({ regionWidth, regionHeight, regionDepth }, { chunkWidth, chunkHeight, chunkDepth },
+                                                         1, input.voxelBudget, input.byteBudget, input.maxTextureSide);
+    const int factorX = factors[0], factorY = factors[1], factorZ = factors[2];
+    const bool downsampled = factorX > 1 || factorY > 1 || factorZ > 1;
+    const int outChunkWidth = chunkWidth / factorX; // Volume voxels per chunk.
+    const int outChunkHeight = chunkHeight / factorY;
+    const qsizetype width = regionWidth / factorX;
+    const qsizetype height = regionHeight / factorY;
+    const qsizetype depth = regionDepth / factorZ;
+    if (downsampled) {
+        qCDebug(lcDownsampling) << "Downsampling" << regionWidth << "x" << regionHeight << "x" << regionDepth << "by" << factorX << factorY << factorZ
+                 << "to" << width << "x" << height << "x" << depth;
+    }
+    MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, width * height * depth);
+    if (!reservation.isValid() || input.isCancelled()) {
+        result.success = false;
+        return result;
+    }
+    QByteArray volume(width * height * depth, 0); // Missing chunks stay empty.
+    const auto volumePtr = reinterpret_cast<uint8_t *>(volume.data());
+
+    // Only chunks inside the slice box are loaded. Along z, where slices are
+    // contiguous in a chunk, only the slices inside the box are decoded.
+    const auto sliceBegin = [](float fraction, qsizetype size) { return qBound<qsizetype>(0, qFloor(fraction * size), size); };
+    const auto sliceEnd = [](float fraction, qsizetype size) { return qBound<qsizetype>(0, qCeil(fraction * size), size); };
+    const qsizetype boxMinX = sliceBegin(input.sliceMin.x(), regionWidth), boxMaxX = sliceEnd(input.sliceMax.x(), regionWidth);
+    const qsizetype boxMinY = sliceBegin(input.sliceMin.y(), regionHeight), boxMaxY = sliceEnd(input.sliceMax.y(), regionHeight);
+    const qsizetype boxMinZ = sliceBegin(input.sliceMin.z(), regionDepth), boxMaxZ = sliceEnd(input.sliceMax.z(), regionDepth);
+
+    // Chunks nearest to the focus go first, the focus chunk leads.
+    struct Chunk
+    {
+        int x, y, z;
+        QString key;
+        int zBegin, zEnd; // Slices of the chunk to decode.
+    };
+    QList<Chunk> chunks;
+    for (int z = startZ; z < startZ + regionChunks; z++) {
+        for (int y = startY; y < startY + regionChunks; y++) {
+            for (int x = startX; x < startX + regionChunks; x++) {
+                const qsizetype originX = qsizetype(x - startX) * chunkWidth;
+                const qsizetype originY = qsizetype(y - startY) * chunkHeight;
+                const qsizetype originZ = qsizetype(z - startZ) * chunkDepth;
+                if (originX >= boxMaxX || originX + chunkWidth <= boxMinX || originY >= boxMaxY || originY + chunkHeight <= boxMinY)
+                    continue;
+                // Whole blocks of slices when downsampling, chunk depths are multiples of factorZ.
+                const int zBegin = int(qBound<qsizetype>(0, boxMinZ - originZ, chunkDepth)) / factorZ * factorZ;
+                const int zEnd = qMin(chunkDepth, (int(qBound<qsizetype>(0, boxMaxZ - originZ, chunkDepth)) + factorZ - 1) / factorZ * factorZ);
+                if (zBegin >= zEnd)
+                    continue;
+                const bool partial = zarr.canReadPartially() && (zBegin > 0 || zEnd < chunkDepth);
+                chunks.append({ x, y, z, zarr.getChunkUrl(level, z, y, x).toString(), partial ? zBegin : 0, partial ? zEnd : chunkDepth });
+            }
+        }
+    }
+    if (chunks.isEmpty()) {
+        qWarning() << "No chunks inside the slice box:" << input.source;
+        result.success = false;
+        return result;
+    }
+    const auto focusDistance = [&](const Chunk &chunk) {
+        return QVector3D(chunk.x - focusX, chunk.y - focusY, chunk.z - focusZ).lengthSquared();
+    };
+    std::stable_sort(chunks.begin(), chunks.end(), [&](const Chunk &a, const Chunk &b) { return focusDistance(a) < focusDistance(b); });
+    const QString rangeKey = chunks.first().key; // The chunk nearest to the focus sets the scale.
+
+    // State shared by the stages, guarded by `mutex`.
+    struct Pipeline
+    {
+        QMutex mutex;
+        QWaitCondition changed;
+        int inFlight = 0; // Chunks issued and not yet converted.
+        int scheduled = 0; // Tasks handed to the group, lets the waiting thread notice new work.
+        bool rangeKnown = false; // Set once the chunk nearest to the focus is decoded.
+        bool hasRange = false; // False when that chunk is missing, chunks then use their own range.
+        double min = 0;
+        double max = 0;
+        QList<std::function<void()>> waitingForRange;
+        VolumeHistogram histogram;
+        int loaded = 0;
+        int filled = 0; // Chunks the store leaves out, set to the fill value.
+        bool failed = false; // A chunk could not be fetched, the load fails.
+        QList<QFuture<FetchedResource>> fetches; // Cancelled with the load.
+        qint64 reorderedBytes = 0; // Chunks transposed into C order, and the time it took.
+        qint64 reorderNsecs = 0;
+        LoadTrace::Stages stages = {}; // Summed over the chunks.
+        QElapsedTimer published; // Since the last partial volume.
+        qint64 publishInterval = kPublishInterval;
+        double previewMin = std::numeric_limits<double>::max(); // Range of the slabs decoded so far.
+        double previewMax = std::numeric_limits<double>::lowest();
+        // Chunks of the region that hold something other than empty voxels.
+        std::array<int, 3> occupiedMin = { std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max() };
+        std::array<int, 3> occupiedMax = { -1, -1, -1 };
+
+        void occupy(int x, int y, int z)
+        {
+            occupiedMin = { qMin(occupiedMin[0], x), qMin(occupiedMin[1], y), qMin(occupiedMin[2], z) };
+            occupiedMax = { qMax(occupiedMax[0], x), qMax(occupiedMax[1], y), qMax(occupiedMax[2], z) };
+        }
+    };
+    auto pipeline = std::make_shared<Pipeline>();
+    LoaderTaskGroup group(input.priority);
+    const bool parallelChunk = chunks.size() == 1; // A lone chunk parallelises within, a region across chunks.
+
+    const auto schedule = [pipeline, &group](std::function<void()> task) {
+        group.run(std::move(task));
+        QMutexLocker locker(&pipeline->mutex);
+        pipeline->scheduled++;
+        pipeline->changed.wakeAll();
+    };
+
+    // Block until `done` holds, running queued stages one at a time meanwhile
+    // so the pipeline moves even when every pool thread is busy. Stages that
+    // are already running are never waited on, `done` is checked again as
+    // soon as one of them finishes, so fetches overlap with decoding. A
+    // cancelled load is noticed within kCancelCheckMs.
+    const auto waitUntil = [pipeline, &group](auto done) {
+        for (;;) {
+            int seen;
+            {
+                QMutexLocker locker(&pipeline->mutex);
+                if (done())
+                    return;
+                seen = pipeline->scheduled;
+            }
+            if (group.runOne())
+                continue;
+            QMutexLocker locker(&pipeline->mutex);
+            while (!done() && seen == pipeline->scheduled)
+                pipeline->changed.wait(&pipeline->mutex, kCancelCheckMs);
+        }
+    };
+
+    const auto addStage = [pipeline](LoadTrace::Stage stage, const QElapsedTimer &timer) {
+        QMutexLocker locker(&pipeline->mutex);
+        pipeline->stages[stage] += timer.nsecsElapsed() / 1000;
+    };
+
+    const auto finishChunk = [pipeline](bool loaded) {
+        QMutexLocker locker(&pipeline->mutex);
+        pipeline->inFlight--;
+        pipeline->loaded += loaded ? 1 : 0;
+        pipeline->changed.wakeAll();
+    };
+
+    // Hand a copy of the volume as converted so far to the texture, at most
+    // every publishInterval. The copy runs alongside conversions, a chunk
+    // being converted meanwhile may show half done.
+    const qsizetype chunkCount = chunks.size();
+    const auto publish = [=] {
+        if (!input.progress || input.isCancelled())
+            return;
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            if (pipeline->loaded == chunkCount)
+                return; // The result follows.
+            if (pipeline->published.isValid() && pipeline->published.elapsed() < pipeline->publishInterval)
+                return;
+            pipeline->published.start();
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        VolumeTextureData::AsyncLoaderData partial;
+        partial.reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, width * height * depth, true);
+        if (!partial.reservation.isValid())
+            return; // Only worth it in memory that is free.
+        partial.volumeData = QByteArray(reinterpret_cast<const char *>(volumePtr), width * height * depth);
+        partial.source = input.source;
+        partial.width = width;
+        partial.height = height;
+        partial.depth = depth;
+        partial.traceId = input.traceId;
+        partial.success = true;
+        input.progress(partial);
+
+        // Copies of big regions are spaced further apart.
+        QMutexLocker locker(&pipeline->mutex);
+        pipeline->publishInterval = qMax(kPublishInterval, 10 * timer.elapsed());
+    };
+
+    // Stage 3: scale a decoded chunk into its place in the volume.
+    const auto convert = [=](const Chunk &chunk, QByteArray decoded, MemoryReservation decodedReservation) {
+        Q_UNUSED(decodedReservation); // Held until the chunk is converted.
+        if (input.isCancelled()) {
+            finishChunk(false);
+            return;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        VolumeHistogram::Bins bins = {};
+        visitDataType(newDataType, [&](auto type) {
+            using T = decltype(type);
+            const auto chunkPtr = reinterpret_cast<const T *>(decoded.constData());
+            const qsizetype slices = chunk.zEnd - chunk.zBegin;
+            const qsizetype count = qsizetype(chunkWidth) * chunkHeight * slices;
+            double min = pipeline->min;
+            double max = pipeline->max;
+            if (!pipeline->hasRange) // Stable once rangeKnown is set.
+                std::tie(min, max) = valueRange(chunkPtr, count, parallelChunk);
+            if (downsampled) {
+                bins = convertChunkDownsampled(volumePtr, width, height,
+                                               qsizetype(chunk.x - startX) * outChunkWidth, qsizetype(chunk.y - startY) * outChunkHeight,
+                                               (qsizetype(chunk.z - startZ) * chunkDepth + chunk.zBegin) / factorZ,
+                                               chunkPtr, chunkWidth, chunkHeight, slices, factorX, factorY, factorZ, min, max, parallelChunk);
+            } else {
+                bins = convertChunk(volumePtr, width, height,
+                                    qsizetype(chunk.x - startX) * chunkWidth, qsizetype(chunk.y - startY) * chunkHeight, qsizetype(chunk.z - startZ) * chunkDepth + chunk.zBegin,
+                                    chunkPtr, chunkWidth, chunkHeight, slices, min, max, parallelChunk);
+            }
+        });
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            pipeline->histogram.addChunk(chunk.key, bins);
+            pipeline->occupy(chunk.x - startX, chunk.y - startY, chunk.z - startZ);
+            pipeline->stages[LoadTrace::Convert] += timer.nsecsElapsed() / 1000;
+        }
+        finishChunk(true);
+        publish();
+    };
+
+    // Stage 3 for chunks the store leaves out: every voxel holds the fill
+    // value, the chunk is set to its converted value without a conversion pass.
+    const double fillValue = zarr.getFillValue();
+    const auto fill = [=](const Chunk &chunk) {
+        if (input.isCancelled()) {
+            finishChunk(false);
+            return;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        uint8_t value = 0; // NaN fills are empty.
+        if (!qIsNaN(fillValue)) {
+            visitDataType(newDataType, [&](auto type) {
+                using T = decltype(type);
+                const T fillAsType = fillValueAs<T>(fillValue);
+                double min = pipeline->min;
+                double max = pipeline->max;
+                if (!pipeline->hasRange)
+                    min = max = double(fillAsType);
+                convertChunk(&value, 1, 1, 0, 0, 0, &fillAsType, 1, 1, 1, min, max, false);
+            });
+        }
+
+        const qsizetype slices = (chunk.zEnd - chunk.zBegin) / factorZ; // In the volume.
+        if (value != 0) { // The volume starts out empty.
+            const qsizetype originX = qsizetype(chunk.x - startX) * outChunkWidth;
+            const qsizetype originY = qsizetype(chunk.y - startY) * outChunkHeight;
+            const qsizetype originZ = (qsizetype(chunk.z - startZ) * chunkDepth + chunk.zBegin) / factorZ;
+            for (qsizetype row = 0; row < outChunkHeight * slices; row++) {
+                const qsizetype y = row % outChunkHeight;
+                const qsizetype z = row / outChunkHeight;
+                memset(volumePtr + originX + width * (originY + y + height * (originZ + z)), value, outChunkWidth);
+            }
+        }
+
+        VolumeHistogram::Bins bins = {};
+        bins[value] = quint64(outChunkWidth) * outChunkHeight * slices;
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            pipeline->histogram.addChunk(chunk.key, bins);
+            pipeline->filled++;
+            if (value != 0)
+                pipeline->occupy(chunk.x - startX, chunk.y - startY, chunk.z - startZ);
+            pipeline->stages[LoadTrace::Convert] += timer.nsecsElapsed() / 1000;
+        }
+        finishChunk(true);
+        publish();
+    };
+
+    // Stage 2: decode a chunk and pass it on once the scale is known. Chunks
+    // the store leaves out come through `missing` and go on to `fill`.
+    const auto decode = [=](const Chunk &chunk, QByteArray decoded, MemoryReservation decodedReservation, bool missing) {
+        const bool isFocus = chunk.key == rangeKey;
+        qsizetype expectedSize = 0;
+        visitDataType(newDataType, [&](auto type) { expectedSize = qsizetype(sizeof(type)) * chunkWidth * chunkHeight * (chunk.zEnd - chunk.zBegin); });
+        const bool valid = (missing || decoded.size() >= expectedSize) && !input.isCancelled();
+        if (!decoded.isEmpty() && decoded.size() < expectedSize)
+            qWarning() << "Chunk is smaller than expected:" << chunk.key << decoded.size() << "<" << expectedSize;
+        const bool failed = !valid && !input.isCancelled(); // Not fetched, not decoded or refused by the budget.
+
+        double min = 0;
+        double max = 0;
+        if (isFocus && valid && !missing) {
+            visitDataType(newDataType, [&](auto type) {
+                using T = decltype(type);
+                std::tie(min, max) = valueRange(reinterpret_cast<const T *>(decoded.constData()), expectedSize / qsizetype(sizeof(T)), parallelChunk);
+            });
+        }
+
+        QList<std::function<void()>> ready;
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            if (isFocus) {
+                pipeline->rangeKnown = true;
+                pipeline->hasRange = valid && !missing;
+                pipeline->min = min;
+                pipeline->max = max;
+                ready.swap(pipeline->waitingForRange);
+            }
+            if (failed)
+                pipeline->failed = true;
+            if (valid) {
+                std::function<void()> task = missing
+                        ? std::function<void()>([=] { fill(chunk); })
+                        : std::function<void()>([=] { convert(chunk, decoded, decodedReservation); });
+                if (pipeline->rangeKnown)
+                    ready.append(task);
+                else
+                    pipeline->waitingForRange.append(task);
+            }
+        }
+        if (!valid)
+            finishChunk(false);
+        for (auto &task : ready)
+            schedule(std::move(task));
+    };
+
+    // Stage 2 for chunks stored in another order: transpose them into the
+    // texture's layout before anything reads them.
+    const auto reorder = [pipeline, parallelChunk](const StorageZarr &chunkZarr, QByteArray &decoded, MemoryReservation &decodedReservation) {
+        if (!chunkZarr.needsReorder() || decoded.isEmpty())
+            return;
+        QElapsedTimer timer;
+        timer.start();
+        decoded = chunkZarr.reorderChunk(decoded, &decodedReservation, parallelChunk);
+        QMutexLocker locker(&pipeline->mutex);
+        pipeline->reorderedBytes += decoded.size();
+        pipeline->reorderNsecs += timer.nsecsElapsed();
+        pipeline->stages[LoadTrace::Reorder] += timer.nsecsElapsed() / 1000;
+    };
+
+    // A lone chunk that can be decoded in parts is decoded slab by slab along z.
+    // Each slab is converted with the range of the slabs so far and published,
+    // the whole chunk is converted again in stage 3 once its range is known.
+    const bool slabs = input.progress && chunkCount == 1 && zarr.canReadPartially() && !downsampled;
+    const auto previewSlab = [=](const Chunk &chunk, int zBegin, int zEnd, const char *slices) {
+        if (input.isCancelled())
+            return;
+        visitDataType(newDataType, [&](auto type) {
+            using T = decltype(type);
+            const auto slabPtr = reinterpret_cast<const T *>(slices);
+            const auto [slabMin, slabMax] = valueRange(slabPtr, qsizetype(chunkWidth) * chunkHeight * (zEnd - zBegin));
+            pipeline->previewMin = qMin(pipeline->previewMin, slabMin); // Slabs of one chunk come in order.
+            pipeline->previewMax = qMax(pipeline->previewMax, slabMax);
+            convertChunk(volumePtr, width, height,
+                         qsizetype(chunk.x - startX) * chunkWidth, qsizetype(chunk.y - startY) * chunkHeight, qsizetype(chunk.z - startZ) * chunkDepth + zBegin,
+                         slabPtr, chunkWidth, chunkHeight, zEnd - zBegin, pipeline->previewMin, pipeline->previewMax);
+        });
+        if (zEnd < chunk.zEnd)
+            publish();
+    };
+
+    // Stage 1: issue fetches, at most kMaxChunksInFlight chunks are between fetch and convert.
+    for (const Chunk &chunk : std::as_const(chunks)) {
+        waitUntil([&] { return pipeline->inFlight < kMaxChunksInFlight || input.isCancelled(); });
+        if (input.isCancelled())
+            break;
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            if (pipeline->failed)
+                break; // No point fetching the rest.
+            pipeline->inFlight++;
+        }
+
+        if (session->isChunkMissing(QUrl(chunk.key))) {
+            // Left out of the store, known from an earlier load.
+            schedule([=] { decode(chunk, QByteArray(), MemoryReservation(), true); });
+        } else if (zarr.isLocal()) {
+            // Local reads decode straight from the mapped file, read and decode are one stage.
+            schedule([=] {
+                MemoryReservation decodedReservation;
+                QByteArray decoded;
+                QElapsedTimer timer;
+                timer.start();
+                if (slabs) {
+                    decoded = zarr.readLocalChunkSlices(level, chunk.z, chunk.y, chunk.x, chunk.zBegin, chunk.zEnd, &decodedReservation,
+                                                             [=](int zBegin, int zEnd, const char *slices) { previewSlab(chunk, zBegin, zEnd, slices); });
+                } else {
+                    decoded = chunk.zEnd - chunk.zBegin < chunkDepth
+                            ? zarr.readLocalChunkSlices(level, chunk.z, chunk.y, chunk.x, chunk.zBegin, chunk.zEnd, &decodedReservation)
+                            : zarr.readLocalChunk(level, chunk.z, chunk.y, chunk.x, &decodedReservation);
+                }
+                addStage(LoadTrace::Decode, timer);
+                // Only missing files are left out chunks, a chunk that does not decode fails the load.
+                const bool missing = decoded.isEmpty() && !zarr.hasLocalChunk(level, chunk.z, chunk.y, chunk.x);
+                reorder(zarr, decoded, decodedReservation);
+                decode(chunk, decoded, decodedReservation, missing);
+            });
+        } else {
+            const bool partial = chunk.zEnd - chunk.zBegin < chunkDepth;
+            const qint64 sliceBytes = qint64(zarr.getDataTypeSizeBytes()) * chunkWidth * chunkHeight;
+            QElapsedTimer fetchTimer;
+            fetchTimer.start();
+            QFuture<FetchedResource> fetch = partial
+                    ? StorageZarr::fetchChunkSpan(QUrl(chunk.key), sliceBytes * chunk.zBegin, sliceBytes * (chunk.zEnd - chunk.zBegin))
+                    : fetchResourceAsync(QUrl(chunk.key));
+            {
+                QMutexLocker locker(&pipeline->mutex);
+                pipeline->fetches.append(fetch);
+            }
+            fetch.then([=](FetchedResource fetched) {
+                addStage(LoadTrace::Fetch, fetchTimer);
+                if (fetched.status == FetchedResource::Failed) {
+                    QMutexLocker locker(&pipeline->mutex);
+                    pipeline->failed = true;
+                }
+                const bool missing = fetched.status == FetchedResource::Missing;
+                if (missing)
+                    session->markChunkMissing(QUrl(chunk.key));
+                schedule([=] {
+                    MemoryReservation decodedReservation;
+                    QByteArray decoded;
+                    QElapsedTimer timer;
+                    timer.start();
+                    if (!fetched.data.isEmpty() && slabs)
+                        decoded = zarr.readChunkSlices(fetched.data, chunk.zBegin, chunk.zEnd, &decodedReservation,
+                                                            [=](int zBegin, int zEnd, const char *slices) { previewSlab(chunk, zBegin, zEnd, slices); });
+                    else if (!fetched.data.isEmpty() && partial)
+                        decoded = zarr.readChunkSlices(fetched.data, chunk.zBegin, chunk.zEnd, &decodedReservation);
+                    else if (!fetched.data.isEmpty())
+                        decoded = zarr.readChunk(fetched.data, &decodedReservation);
+                    addStage(LoadTrace::Decode, timer);
+                    reorder(zarr, decoded, decodedReservation);
+                    decode(chunk, decoded, decodedReservation, missing);
+                });
+            }).onCanceled([=] { finishChunk(false); });
+        }
+    }
+    // Continuations of the fetches refer to the group, wait for them. A
+    // cancelled load aborts its fetches rather than waiting for their replies.
+    waitUntil([&] { return pipeline->inFlight == 0 || input.isCancelled(); });
+    if (input.isCancelled()) {
+        {
+            QMutexLocker locker(&pipeline->mutex);
+            for (QFuture<FetchedResource> &fetch : pipeline->fetches)
+                fetch.cancel();
+        }
+        waitUntil([&] { return pipeline->inFlight == 0; });
+    }
+    group.wait();
+    result.stages = pipeline->stages;
+    result.stages[LoadTrace::Metadata] += metadataUsecs;
+
+    if (pipeline->failed) {
+        qWarning() << "Chunks could not be fetched or decoded:" << input.source;
+    }
+    if (input.isCancelled() || pipeline->failed || pipeline->loaded == 0) {
+        result.success = false;
+        return result;
+    }
+    qDebug() << "Loaded" << pipeline->loaded << "of" << chunks.size() << "chunks," << pipeline->filled << "left out of the store";
+    if (pipeline->reorderNsecs > 0) {
+        qDebug() << "Reordered" << pipeline->reorderedBytes / (1024 * 1024) << "MiB of" << zarr.getOrder() << "order chunks at"
+                 << qRound64(pipeline->reorderedBytes * 1e3 / pipeline->reorderNsecs) << "MB/s per chunk";
+    }
+
+    result.volumeData = volume;
+    result.dataType = newDataType;
     result.globalFocusPoint = globalFocusPoint;
     result.localFocusPoint = localFocusPoint;
-    result.dataType = newDataType;
+    result.histogram = pipeline->histogram;
+    result.level = level;
+    result.chunkKey = rangeKey;
+    result.reservation = reservation;
     result.success = true;
-    std::tie(result.depth, result.height, result.width) = zarr.getChunks();
+    result.width = width;
+    result.height = height;
+    result.depth = depth;
+    result.chunkOrigin = QVector3D(startX * chunkWidth, startY * chunkHeight, startZ * chunkDepth);
+    result.spacing = QVector3D(factorX, factorY, factorZ);
+    if (pipeline->occupiedMax[0] >= 0) {
+        result.occupiedMin = QVector3D(pipeline->occupiedMin[0], pipeline->occupiedMin[1], pipeline->occupiedMin[2]) / regionChunks;
+        result.occupiedMax = QVector3D(pipeline->occupiedMax[0] + 1, pipeline->occupiedMax[1] + 1, pipeline->occupiedMax[2] + 1) / regionChunks;
+    } else {
+        result.occupiedMin = QVector3D(1, 1, 1); // Empty box, nothing to march through.
+        result.occupiedMax = QVector3D(0, 0, 0);
+    }
     return result;
 }
 
@@ -374,8 +1001,156 @@ static VolumeTextureData::AsyncLoaderData loadVolumeNrrd(const VolumeTextureData
     return result;
 }
 
+// Size of a voxel at the given pyramid level in full resolution voxels.
+static int levelScale(int level)
+{
+    return 1 << qMax(level, 0);
+}
+
+// Maps each texture voxel of the primary grid along one axis to the nearest
+// voxel of another store, or -1 when it falls outside the loaded chunk.
+// Spacings are the level voxels per texture voxel of downsampled volumes.
+static QList<qsizetype> resampleAxis(qsizetype size, float origin, int scale, float spacing,
+                                     qsizetype otherSize, float otherOrigin, int otherScale, float otherSpacing)
+{
+    QList<qsizetype> indices(size);
+    for (qsizetype i = 0; i < size; i++) {
+        const double global = (origin + (i + 0.5) * spacing) * scale; // Voxel centre in full resolution coordinates.
+        const qsizetype other = qsizetype(std::floor((global / otherScale - otherOrigin) / otherSpacing));
+        indices[i] = other >= 0 && other < otherSize ? other : -1;
+    }
+    return indices;
+}
+
+static VolumeTextureData::AsyncLoaderData loadVolume(const VolumeTextureData::AsyncLoaderData& input);
+
+// Load the primary store and its overlays around the same focus point and
+// pack them channel-interleaved into one RGBA8 volume on the primary grid.
+static VolumeTextureData::AsyncLoaderData loadVolumeOverlay(const VolumeTextureData::AsyncLoaderData& input)
+{
+    constexpr int kMaxChannels = 4;
+    const int channels = qMin<int>(1 + input.overlaySources.size(), kMaxChannels);
+
+    QList<VolumeTextureData::AsyncLoaderData> layers(channels, input);
+    for (int c = 0; c < channels; c++) {
+        auto &layer = layers[c];
+        layer.overlaySources.clear();
+        layer.progress = nullptr; // A single layer is not worth showing.
+        if (layer.byteBudget > 0)
+            layer.byteBudget /= kMaxChannels; // Packed into RGBA8 on the primary grid.
+        if (c == 0)
+            continue;
+        layer.source = input.overlaySources[c - 1];
+        layer.level = input.overlayLevels.value(c - 1, -1);
+        layer.order = input.overlayOrders.value(c - 1, "C");
+        layer.dataType = QString();
+        // Focus points are given in the primary store's level, move them to the overlay's level.
+        layer.globalFocusPoint = input.globalFocusPoint * levelScale(input.level) / levelScale(layer.level);
+    }
+
+    // The stores are independent, fetch and decode them side by side.
+    LoaderTaskGroup group(input.priority);
+    auto layerData = layers.data();
+    for (int c = 0; c < channels; c++) {
+        group.run([layerData, c] { layerData[c] = loadVolume(layerData[c]); });
+    }
+    group.wait();
+
+    auto result = layers[0];
+    for (int c = 1; c < channels; c++) {
+        for (int stage = 0; stage < LoadTrace::StageCount; stage++)
+            result.stages[stage] += layers[c].stages[stage];
+    }
+    if (!result.success) {
+        return result;
+    }
+
+    const qsizetype width = result.width;
+    const qsizetype height = result.height;
+    const qsizetype depth = result.depth;
+    const int scale = levelScale(result.level);
+    const QVector3D origin = result.chunkOrigin;
+
+    // Separable nearest-neighbour lookup tables from the primary grid into each overlay.
+    std::array<QList<qsizetype>, kMaxChannels> mapX, mapY, mapZ;
+    for (int c = 1; c < channels; c++) {
+        const auto &layer = layers[c];
+        const int otherScale = levelScale(layer.level);
+        mapX[c] = resampleAxis(width, origin.x(), scale, result.spacing.x(), layer.width, layer.chunkOrigin.x(), otherScale, layer.spacing.x());
+        mapY[c] = resampleAxis(height, origin.y(), scale, result.spacing.y(), layer.height, layer.chunkOrigin.y(), otherScale, layer.spacing.y());
+        mapZ[c] = resampleAxis(depth, origin.z(), scale, result.spacing.z(), layer.depth, layer.chunkOrigin.z(), otherScale, layer.spacing.z());
+    }
+
+    MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, width * height * depth * kMaxChannels);
+    if (!reservation.isValid()) {
+        result.success = false;
+        return result;
+    }
+    QByteArray packed(width * height * depth * kMaxChannels, 0);
+    auto packedPtr = reinterpret_cast<uint8_t *>(packed.data());
+    const auto primaryPtr = reinterpret_cast<const uint8_t *>(result.volumeData.constData());
+    QElapsedTimer packTimer;
+    packTimer.start();
+
+#pragma omp parallel for
+    for (int z = 0; z < depth; z++) {
+        for (qsizetype y = 0; y < height; y++) {
+            const qsizetype row = width * (y + height * z);
+            for (qsizetype x = 0; x < width; x++) {
+                packedPtr[kMaxChannels * (row + x)] = primaryPtr[row + x];
+            }
+            for (int c = 1; c < channels; c++) {
+                const qsizetype otherZ = mapZ[c][z];
+                const qsizetype otherY = mapY[c][y];
+                if (otherZ < 0 || otherY < 0 || !layers[c].success)
+                    continue;
+                const auto otherPtr = reinterpret_cast<const uint8_t *>(layers[c].volumeData.constData());
+                const qsizetype otherRow = layers[c].width * (otherY + layers[c].height * otherZ);
+                for (qsizetype x = 0; x < width; x++) {
+                    const qsizetype otherX = mapX[c][x];
+                    if (otherX >= 0)
+                        packedPtr[kMaxChannels * (row + x) + c] = otherPtr[otherRow + otherX];
+                }
+            }
+        }
+    }
+
+    result.stages[LoadTrace::Convert] += packTimer.nsecsElapsed() / 1000;
+
+    for (int c = 1; c < channels; c++) {
+        if (!layers[c].success)
+            qWarning() << "Failed to load overlay volume:" << layers[c].source;
+    }
+
+    result.overlaySources = input.overlaySources;
+    result.overlayLevels = input.overlayLevels;
+    result.overlayOrders = input.overlayOrders;
+    result.volumeData = packed;
+    result.reservation = reservation;
+    result.channels = channels;
+    result.occupiedMin = QVector3D(0, 0, 0); // Overlays may hold data where the primary store is empty.
+    result.occupiedMax = QVector3D(1, 1, 1);
+    return result;
+}
+
+// A local Zarr store is a directory, everything else on disk is read as a NRRD file.
+// Volumes generated in memory, they are cheaper to generate than to snapshot.
+static bool isBuiltinVolume(const QUrl &source)
+{
+    return source == QUrl("file:///default_helix") || source == QUrl("file:///default_box") || source == QUrl("file:///default_colormap");
+}
+
+static bool isLocalZarrStore(const QUrl &source)
+{
+    return source.isLocalFile() && QFileInfo(source.toLocalFile()).isDir();
+}
+
 static VolumeTextureData::AsyncLoaderData loadVolume(const VolumeTextureData::AsyncLoaderData& input)
 {
+    if (input.isCancelled()) {
+        return input; // Superseded before it started.
+    }
+
     QByteArray imageDataSource;
 
     QVector3D globalFocusPoint = input.globalFocusPoint; // Point to center the cursor on in global scroll coorindates.
@@ -386,27 +1161,26 @@ static VolumeTextureData::AsyncLoaderData loadVolume(const VolumeTextureData::As
     int depth = input.depth;
     int height = input.height;
     int width = input.width;
+    QString chunkKey = input.source.toString();
+
+    if (!input.overlaySources.isEmpty()) {
+        return loadVolumeOverlay(input);
+    }
 
+    QElapsedTimer timer;
+    timer.start();
     if (input.source == QUrl("file:///default_helix")) {
         imageDataSource = createBuiltinVolume(ExampleId::Helix);
     } else if (input.source == QUrl("file:///default_box")) {
         imageDataSource = createBuiltinVolume(ExampleId::Box);
     } else if (input.source == QUrl("file:///default_colormap")) {
         imageDataSource = createBuiltinVolume(ExampleId::Colormap);
-    } else if (input.source.scheme() == "http" || input.source.scheme() == "https") {
+    } else if (input.source.scheme() == "http" || input.source.scheme() == "https" || isLocalZarrStore(input.source)) {
         auto result = loadVolumeZarr(input);
-        if (result.success) { // Unpack on success.
-            imageDataSource = result.volumeData;
-            globalFocusPoint = result.globalFocusPoint;
-            localFocusPoint = result.localFocusPoint;
-            dataType = result.dataType;
-            depth = result.depth;
-            height = result.height;
-            width = result.width;
-        }
-        else {
+        if (!result.success) {
             qWarning() << "Failed to load Zarr volume:" << input.source;
         }
+        return result; // Converted chunk by chunk as they arrive.
     } else {
         auto result = loadVolumeNrrd(input);
         if (result.success) {
@@ -436,83 +1210,238 @@ static VolumeTextureData::AsyncLoaderData loadVolume(const VolumeTextureData::As
         }
     }
 
+    if (input.isCancelled()) {
+        return input;
+    }
+    LoadTrace::Stages stages = {};
+    stages[LoadTrace::Decode] = timer.nsecsElapsed() / 1000;
+    timer.restart();
+
     QByteArray imageData;
+    VolumeHistogram::Bins bins;
+    const qsizetype dataSize = depth * width * height;
+
+    // Volumes over the budget are downsampled as they are converted.
+    const std::array<int, 3> factors = downsampleFactors({ width, height, depth }, { 0, 0, 0 }, 1, input.voxelBudget, input.byteBudget,
+                                                           input.maxTextureSide);
+    const bool downsampled = factors != std::array<int, 3> { 1, 1, 1 };
+    const qsizetype outWidth = width / factors[0];
+    const qsizetype outHeight = height / factors[1];
+    const qsizetype outDepth = depth / factors[2];
+
+    MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted,
+                                                                      downsampled ? outWidth * outHeight * outDepth : qMax(dataSize, imageDataSource.size()));
+    if (!reservation.isValid()) {
+        auto result = input;
+        result.success = false;
+        return result;
+    }
 
-    // We scale the values to uint8_t data size
-    if (dataType == "uint8") {
+    QVector3D spacing(1, 1, 1);
+    if (downsampled) {
+        qCDebug(lcDownsampling) << "Downsampling" << width << "x" << height << "x" << depth << "by" << factors[0] << factors[1] << factors[2];
+        imageData = QByteArray(outWidth * outHeight * outDepth, Qt::Uninitialized);
+        visitDataType(dataType, [&](auto type) {
+            using T = decltype(type);
+            const qsizetype count = qsizetype(width) * height * depth;
+            if (imageDataSource.size() < count * qsizetype(sizeof(T)))
+                imageDataSource.resize(count * sizeof(T), '\0'); // Short files are padded, as below.
+            const auto sourcePtr = reinterpret_cast<const T *>(imageDataSource.constData());
+            const auto [min, max] = valueRange(sourcePtr, count);
+            bins = convertChunkDownsampled(reinterpret_cast<uint8_t *>(imageData.data()), outWidth, outHeight, 0, 0, 0,
+                                           sourcePtr, width, height, depth, factors[0], factors[1], factors[2], min, max);
+        });
+        width = int(outWidth);
+        height = int(outHeight);
+        depth = int(outDepth);
+        spacing = QVector3D(factors[0], factors[1], factors[2]);
+    } else if (dataType == "uint8") {
         imageData = imageDataSource;
+        bins = VolumeHistogram::compute(reinterpret_cast<const uint8_t *>(imageData.constData()), imageData.size());
     } else if (dataType == "uint16") {
-        convertData<uint16_t>(imageData, imageDataSource);
+        bins = convertData<uint16_t>(imageData, imageDataSource);
     } else if (dataType == "int16") {
-        convertData<int16_t>(imageData, imageDataSource);
+        bins = convertData<int16_t>(imageData, imageDataSource);
     } else if (dataType == "float32") {
-        convertData<float>(imageData, imageDataSource);
+        bins = convertData<float>(imageData, imageDataSource);
     } else if (dataType == "float64") {
-        convertData<double>(imageData, imageDataSource);
+        bins = convertData<double>(imageData, imageDataSource);
     } else {
         qWarning() << "Unknown data type, assuming uint8";
         imageData = imageDataSource;
+        bins = VolumeHistogram::compute(reinterpret_cast<const uint8_t *>(imageData.constData()), imageData.size());
     }
 
     // If our source data is smaller than expected we need to expand the texture
     // and fill with something
-    qsizetype dataSize = depth * width * height;
-    if (imageData.size() < dataSize) {
-        imageData.resize(dataSize, '0');
+    if (imageData.size() < qsizetype(width) * height * depth) {
+        imageData.resize(qsizetype(width) * height * depth, '\0');
     }
+    stages[LoadTrace::Convert] = timer.nsecsElapsed() / 1000;
 
     auto result = input;
+    result.stages = stages;
     result.volumeData = imageData;
     result.globalFocusPoint = globalFocusPoint;
     result.localFocusPoint = localFocusPoint;
+    result.histogram.addChunk(chunkKey, bins);
+    result.reservation = reservation;
     result.success = true;
     result.depth = depth;
     result.height = height;
     result.width = width;
+    result.spacing = spacing;
     return result;
 }
 
-class Worker : public QThread
+// Identifies the volume a load produces, so instances that show the same
+// store, level and region share it. Zarr regions are found from the cached
+// metadata, `localFocusPoint` is set to the load's focus point in the region.
+static QString residentKey(const VolumeTextureData::AsyncLoaderData &input, std::optional<QVector3D> *localFocusPoint)
 {
-    Q_OBJECT
-public:
-    Worker(VolumeTextureData *parent, const VolumeTextureData::AsyncLoaderData &loaderData)
-        : QThread(parent), m_loaderData(loaderData)
-    {
+    const auto vector = [](const QVector3D &v) { return QString("%1,%2,%3").arg(v.x()).arg(v.y()).arg(v.z()); };
+    QStringList parts { input.source.toString(), input.order, QString::number(input.regionChunks), vector(input.sliceMin), vector(input.sliceMax),
+                        QString("%1,%2,%3").arg(input.voxelBudget).arg(input.byteBudget).arg(input.maxTextureSide) };
+    const bool zarr = input.source.scheme() == "http" || input.source.scheme() == "https" || isLocalZarrStore(input.source);
+    if (!input.overlaySources.isEmpty()) {
+        // Overlays are resampled around the focus point itself.
+        parts << QString::number(input.level) << vector(input.globalFocusPoint);
+        for (qsizetype i = 0; i < input.overlaySources.size(); i++)
+            parts << input.overlaySources[i].toString() << QString::number(input.overlayLevels.value(i, -1)) << input.overlayOrders.value(i, "C");
+    } else if (zarr) {
+        auto session = ZarrSession::forStore(input.source);
+        const int level = session->resolveLevel(input.level);
+        StorageZarr storage = session->storage(level);
+        const ZarrRegion region = zarrRegion(storage, input.globalFocusPoint, qMax(input.regionChunks, 1));
+        parts << QString::number(level) << QString("%1,%2,%3").arg(region.startX).arg(region.startY).arg(region.startZ);
+        *localFocusPoint = region.localFocusPoint;
+    } else {
+        parts << QString("%1x%2x%3").arg(input.width).arg(input.height).arg(input.depth) << input.dataType;
+    }
+    return parts.join('|');
+}
+
+// Load the volume `input` asks for, or share it with the instances that already
+// hold or load it. `refresh` loads it from the source even when it is resident.
+// The future is unfinished while another instance loads it, see ResidentVolumes::acquire.
+static QFuture<VolumeTextureData::AsyncLoaderData> acquireVolume(const VolumeTextureData::AsyncLoaderData &input, bool refresh = false)
+{
+    using AsyncLoaderData = VolumeTextureData::AsyncLoaderData;
+    if (input.isCancelled()) {
+        QPromise<AsyncLoaderData> promise;
+        promise.start();
+        auto result = input; // Superseded while queued, before any metadata is fetched.
+        result.success = false;
+        promise.addResult(result);
+        promise.finish();
+        return promise.future();
     }
-    void run() override { emit resultReady(loadVolume(m_loaderData)); }
 
-signals:
-    void resultReady(const VolumeTextureData::AsyncLoaderData result);
+    QElapsedTimer timer;
+    timer.start();
+    std::optional<QVector3D> localFocusPoint;
+    const QString key = residentKey(input, &localFocusPoint); // Reads the store's metadata first.
+    const qint64 keyUsecs = timer.nsecsElapsed() / 1000;
+    return ResidentVolumes::instance()->acquire(key, input, loadVolume, refresh).then([keyUsecs, localFocusPoint](AsyncLoaderData result) {
+        result.stages[LoadTrace::Metadata] += keyUsecs;
+        if (localFocusPoint)
+            result.localFocusPoint = *localFocusPoint; // Loads that share a region differ in focus.
+        return result;
+    });
+}
 
-private:
-    VolumeTextureData::AsyncLoaderData m_loaderData;
-};
+// Continue with the volume `input` asks for in a task of `tasks`, called from
+// one. When another instance is loading the same volume, the calling task
+// ends and `done` runs in a new task once that load ends, so views sharing a
+// load do not hold a pool thread each.
+void VolumeTextureData::acquireVolumeAsync(LoaderTaskGroup &tasks, const AsyncLoaderData &input, bool refresh,
+                                           const std::function<void(AsyncLoaderData)> &done)
+{
+    QFuture<AsyncLoaderData> volume = acquireVolume(input, refresh);
+    if (volume.isFinished() && !volume.isCanceled()) {
+        done(volume.result());
+        return;
+    }
+    volume.then(this, [&tasks, done](const AsyncLoaderData &result) {
+        tasks.run([done, result] { done(result); });
+    }).onCanceled(this, [this, &tasks, input, refresh, done] {
+        // The instance that loaded it was superseded, load it here.
+        tasks.run([this, &tasks, input, refresh, done] { acquireVolumeAsync(tasks, input, refresh, done); });
+    });
+}
+
+// Add the gradient volume to a converted load, when enabled and the budget allows.
+static void addGradients(VolumeTextureData::AsyncLoaderData &result)
+{
+    if (!result.success || !result.gradientsEnabled || result.isCancelled())
+        return;
+    const qsizetype voxels = result.width * result.height * result.depth;
+    if (result.volumeData.size() < voxels * result.channels)
+        return;
+    result.gradientReservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, voxels * 4);
+    if (!result.gradientReservation.isValid())
+        return; // Rendered unshaded.
+    QElapsedTimer timer;
+    timer.start();
+    result.gradientData = VolumeGradients::compute(reinterpret_cast<const uint8_t *>(result.volumeData.constData()), result.channels,
+                                           result.width, result.height, result.depth);
+    result.stages[LoadTrace::Gradients] += timer.nsecsElapsed() / 1000;
+}
 
 ///////////////////////////////////////////////////////////////////////
 
+static constexpr int kSnapshotIdleMs = 10000; // Without a successful load before the snapshot is written.
+static VolumeTextureData *s_snapshotInstance = nullptr; // The one that resumes and writes the snapshot, GUI thread only.
+
 VolumeTextureData::VolumeTextureData()
+    : m_gradientTexture(new QQuick3DTextureData(this))
 {
-    // Load a volume by default so we have something to render to avoid crashes
+    // Placeholder until gradients are computed.
+    m_gradientTexture->setFormat(Format::RGBA8);
+    m_gradientTexture->setTextureData(QByteArray(4, 0));
+    m_gradientTexture->setSize(QSize(1, 1));
+    m_gradientTexture->setDepth(1);
+
+    // Render an empty single voxel placeholder so the first frame does not
+    // wait on the default volume, which is generated in the background.
+    setFormat(Format::R8);
+    setTextureData(QByteArray(1, 0));
+    setSize(QSize(1, 1));
+    QQuick3DTextureData::setDepth(1);
+
+    // Only the first instance keeps a snapshot, the others of a multi-view
+    // layout would all write and resume the same one.
+    if (!s_snapshotInstance) {
+        s_snapshotInstance = this;
+        m_snapshotTimer.setSingleShot(true);
+        m_snapshotTimer.setInterval(kSnapshotIdleMs);
+        connect(&m_snapshotTimer, &QTimer::timeout, this, [this] { writeSnapshot(false); });
+        if (QCoreApplication *app = QCoreApplication::instance())
+            connect(app, &QCoreApplication::aboutToQuit, this, [this] { writeSnapshot(true); });
+        if (resumeSnapshot())
+            return;
+    }
+
     m_source = QUrl("file:///default_colormap");
     m_width = 256;
     m_height = 256;
     m_depth = 256;
     m_dataType = "uint8";
-    auto result = loadVolume(AsyncLoaderData { m_source, m_width, m_height, m_depth, m_dataType });
-    setFormat(Format::R8);
-    setTextureData(result.volumeData);
-    setSize(QSize(m_width, m_height));
-    QQuick3DTextureData::setDepth(m_depth);
+    loadAsync(m_source, m_width, m_height, m_depth, m_dataType);
 }
 
 VolumeTextureData::~VolumeTextureData()
 {
-    if (m_worker) {
-        m_worker->quit();
-        m_worker->wait();
-        delete m_worker;
+    if (m_cancelled) {
+        *m_cancelled = true;
+        ResidentVolumes::instance()->cancelWaiting(m_cancelled); // No partial volumes of shared loads after this.
     }
+    if (s_snapshotInstance == this)
+        s_snapshotInstance = nullptr;
+    // Queued tasks are dropped rather than run here, they would fetch on the GUI thread.
+    // The running load aborts its fetches once it sees the flag, it does not wait for them.
+    m_tasks.cancel();
+    m_refinementTasks.cancel(); // Lets a snapshot being written finish.
 }
 
 QUrl VolumeTextureData::source() const
@@ -591,6 +1520,296 @@ void VolumeTextureData::setDataType(const QString &newDataType)
     emit dataTypeChanged();
 }
 
+int VolumeTextureData::regionChunks() const
+{
+    return m_regionChunks;
+}
+
+void VolumeTextureData::setRegionChunks(int newRegionChunks)
+{
+    newRegionChunks = qMax(newRegionChunks, 1);
+    if (m_regionChunks == newRegionChunks)
+        return;
+    m_regionChunks = newRegionChunks;
+    emit regionChunksChanged();
+}
+
+qint64 VolumeTextureData::voxelBudget() const
+{
+    return m_voxelBudget;
+}
+
+void VolumeTextureData::setVoxelBudget(qint64 newVoxelBudget)
+{
+    if (m_voxelBudget == newVoxelBudget)
+        return;
+    m_voxelBudget = newVoxelBudget;
+    emit budgetChanged();
+}
+
+qint64 VolumeTextureData::byteBudget() const
+{
+    return m_byteBudget;
+}
+
+void VolumeTextureData::setByteBudget(qint64 newByteBudget)
+{
+    if (m_byteBudget == newByteBudget)
+        return;
+    m_byteBudget = newByteBudget;
+    emit budgetChanged();
+}
+
+int VolumeTextureData::maxTextureSide() const
+{
+    return m_maxTextureSide;
+}
+
+void VolumeTextureData::setMaxTextureSide(int newMaxTextureSide)
+{
+    if (m_maxTextureSide == newMaxTextureSide)
+        return;
+    m_maxTextureSide = newMaxTextureSide;
+    emit budgetChanged();
+}
+
+QVector3D VolumeTextureData::sliceMin() const
+{
+    return m_sliceMin;
+}
+
+void VolumeTextureData::setSliceMin(const QVector3D &newSliceMin)
+{
+    if (m_sliceMin == newSliceMin)
+        return;
+    m_sliceMin = newSliceMin;
+    emit sliceMinChanged();
+}
+
+QVector3D VolumeTextureData::sliceMax() const
+{
+    return m_sliceMax;
+}
+
+void VolumeTextureData::setSliceMax(const QVector3D &newSliceMax)
+{
+    if (m_sliceMax == newSliceMax)
+        return;
+    m_sliceMax = newSliceMax;
+    emit sliceMaxChanged();
+}
+
+int VolumeTextureData::channels() const
+{
+    return m_channels;
+}
+
+void VolumeTextureData::setChannels(int newChannels)
+{
+    if (m_channels == newChannels)
+        return;
+    m_channels = newChannels;
+    emit channelsChanged();
+}
+
+QVector3D VolumeTextureData::occupiedMin() const
+{
+    return m_occupiedMin;
+}
+
+QVector3D VolumeTextureData::occupiedMax() const
+{
+    return m_occupiedMax;
+}
+
+void VolumeTextureData::setOccupied(const QVector3D &newOccupiedMin, const QVector3D &newOccupiedMax)
+{
+    if (m_occupiedMin == newOccupiedMin && m_occupiedMax == newOccupiedMax)
+        return;
+    m_occupiedMin = newOccupiedMin;
+    m_occupiedMax = newOccupiedMax;
+    emit occupiedChanged();
+}
+
+bool VolumeTextureData::gradientsEnabled() const
+{
+    return m_gradientsEnabled;
+}
+
+void VolumeTextureData::setGradientsEnabled(bool newGradientsEnabled)
+{
+    if (m_gradientsEnabled == newGradientsEnabled)
+        return;
+    m_gradientsEnabled = newGradientsEnabled;
+    emit gradientsEnabledChanged();
+
+    if (!m_gradientsEnabled)
+        setGradients(QByteArray(), MemoryReservation()); // Free the texture.
+    else if (!m_isLoading)
+        startGradients(); // The load in flight computes its own.
+}
+
+bool VolumeTextureData::gradientsReady() const
+{
+    return m_gradientsReady;
+}
+
+QQuick3DTextureData *VolumeTextureData::gradientTexture() const
+{
+    return m_gradientTexture;
+}
+
+// Compute gradients for the volume already in the texture.
+void VolumeTextureData::startGradients()
+{
+    const QByteArray volume = textureData();
+    const std::shared_ptr<QFile> mapping = m_textureMapping; // The bytes may outlive the texture's use of them.
+    const QSize size = this->size();
+    const qsizetype depth = QQuick3DTextureData::depth();
+    const int channels = m_channels;
+    if (volume.size() < qsizetype(size.width()) * size.height() * depth * channels)
+        return; // Nothing loaded yet.
+
+    const quint64 generation = m_generation;
+    m_tasks.run([this, volume, mapping, size, depth, channels, generation] {
+        MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted, qsizetype(size.width()) * size.height() * depth * 4);
+        if (!reservation.isValid())
+            return;
+        const QByteArray gradients = VolumeGradients::compute(reinterpret_cast<const uint8_t *>(volume.constData()), channels, size.width(), size.height(), depth);
+        QMetaObject::invokeMethod(this, [this, gradients, reservation, generation] {
+            if (generation == m_generation && m_gradientsEnabled) // Still the same volume.
+                setGradients(gradients, reservation);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void VolumeTextureData::setGradients(const QByteArray &data, const MemoryReservation &reservation)
+{
+    Q_UNUSED(reservation); // Converted bytes, replaced by the texture's own accounting.
+    const bool ready = !data.isEmpty();
+    m_gradientReservation = MemoryReservation();
+    if (ready) {
+        m_gradientReservation = MemoryBudget::instance()->track(MemoryBudget::Texture, data.size());
+        m_gradientTexture->setSize(size());
+        m_gradientTexture->setDepth(QQuick3DTextureData::depth());
+        m_gradientTexture->setTextureData(data);
+    } else {
+        m_gradientTexture->setSize(QSize(1, 1));
+        m_gradientTexture->setDepth(1);
+        m_gradientTexture->setTextureData(QByteArray(4, 0));
+    }
+
+    if (m_gradientsReady != ready) {
+        m_gradientsReady = ready;
+        emit gradientsReadyChanged();
+    }
+}
+
+QString VolumeTextureData::filter() const
+{
+    return m_filter.type;
+}
+
+void VolumeTextureData::setFilter(const QString &newFilter)
+{
+    VolumeFilter::Settings settings = m_filter;
+    settings.type = newFilter;
+    setFilterSettings(settings);
+}
+
+int VolumeTextureData::filterRadius() const
+{
+    return m_filter.radius;
+}
+
+void VolumeTextureData::setFilterRadius(int newFilterRadius)
+{
+    VolumeFilter::Settings settings = m_filter;
+    settings.radius = qMax(newFilterRadius, 1);
+    setFilterSettings(settings);
+}
+
+qreal VolumeTextureData::filterAmount() const
+{
+    return m_filter.amount;
+}
+
+void VolumeTextureData::setFilterAmount(qreal newFilterAmount)
+{
+    VolumeFilter::Settings settings = m_filter;
+    settings.amount = newFilterAmount;
+    setFilterSettings(settings);
+}
+
+void VolumeTextureData::setFilterSettings(const VolumeFilter::Settings &newFilter)
+{
+    if (m_filter == newFilter)
+        return;
+    m_filter = newFilter;
+    emit filterChanged();
+
+    if (!m_isLoading) // The load in flight is filtered once it is shown.
+        applyFilter();
+}
+
+// Show the loaded volume with the current filter, from the cache when the
+// volume was filtered with the same settings before.
+void VolumeTextureData::applyFilter()
+{
+    if (m_unfilteredData.isEmpty())
+        return;
+    if (m_filter.isNone()) {
+        showFiltered(m_unfilteredData);
+        return;
+    }
+    if (const QByteArray cached = m_filterCache.find(m_filter.key()); !cached.isEmpty()) {
+        showFiltered(cached);
+        return;
+    }
+
+    const QByteArray volume = m_unfilteredData;
+    const std::shared_ptr<QFile> mapping = m_unfilteredMapping;
+    const int channels = m_channels;
+    const QSize size = this->size();
+    const qsizetype depth = QQuick3DTextureData::depth();
+    const VolumeFilter::Settings settings = m_filter;
+    const quint64 generation = m_generation;
+    m_tasks.run([this, volume, mapping, channels, size, depth, settings, generation] {
+        const qsizetype voxels = qsizetype(size.width()) * size.height() * depth;
+        MemoryReservation reservation = MemoryBudget::instance()->reserve(MemoryBudget::Converted,
+                                                                          volume.size() + VolumeFilter::scratchBytes(settings, voxels, channels));
+        if (!reservation.isValid())
+            return; // Stays unfiltered.
+        const QByteArray filtered = VolumeFilter::apply(volume, channels, size.width(), size.height(), depth, settings);
+        QMetaObject::invokeMethod(this, [this, filtered, settings, generation] {
+            if (generation != m_generation)
+                return; // Filtered a volume that has been replaced.
+            m_filterCache.insert(settings.key(), filtered);
+            if (settings == m_filter)
+                showFiltered(filtered);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void VolumeTextureData::showFiltered(const QByteArray &volume)
+{
+    if (textureData().constData() == volume.constData())
+        return; // Already shown.
+    setTextureData(volume); // Filtered bytes are accounted by the cache.
+    if (m_gradientsEnabled)
+        startGradients(); // Shading follows what is shown.
+}
+
+QList<qreal> VolumeTextureData::histogram() const
+{
+    return m_histogram.normalized();
+}
+
+qreal VolumeTextureData::histogramPercentile(qreal fraction) const
+{
+    return m_histogram.percentile(fraction);
+}
+
 void VolumeTextureData::updateTextureDimensions()
 {
     if (m_width * m_height * m_depth > m_currentDataSize)
@@ -611,47 +1830,268 @@ void VolumeTextureData::loadAsync(QUrl source, qsizetype width, qsizetype height
     loaderData.level = level;
     loaderData.order = order;
 
-    if (m_isLoading) {
-        m_isAborting = true;
+    loaderData.overlaySources.clear();
+    loaderData.overlayLevels.clear();
+    loaderData.overlayOrders.clear();
+
+    startLoad();
+}
+
+void VolumeTextureData::loadOverlayAsync(QUrl source, QList<QUrl> overlaySources, QVector3D globalFocusPoint, int level, QString order, QList<int> overlayLevels, QStringList overlayOrders)
+{
+    loaderData.source = source;
+    loaderData.width = -1; // Read from Zarr metadata.
+    loaderData.height = -1;
+    loaderData.depth = -1;
+    loaderData.dataType = QString();
+    loaderData.globalFocusPoint = globalFocusPoint;
+    loaderData.level = level;
+    loaderData.order = order;
+    loaderData.overlaySources = overlaySources;
+    loaderData.overlayLevels = overlayLevels;
+    loaderData.overlayOrders = overlayOrders;
+
+    startLoad();
+}
+
+void VolumeTextureData::startLoad()
+{
+    // Supersede the load in flight, it stops at its next stage boundary.
+    if (m_cancelled) {
+        *m_cancelled = true;
+        ResidentVolumes::instance()->cancelWaiting(m_cancelled);
+    }
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    loaderData.cancelled = m_cancelled;
+    loaderData.regionChunks = m_regionChunks;
+    loaderData.voxelBudget = m_voxelBudget;
+    loaderData.byteBudget = m_byteBudget;
+    loaderData.maxTextureSide = m_maxTextureSide;
+    loaderData.sliceMin = m_sliceMin;
+    loaderData.sliceMax = m_sliceMax;
+    loaderData.gradientsEnabled = m_gradientsEnabled;
+
+    const quint64 generation = ++m_generation;
+    m_isLoading = true;
+    auto data = loaderData;
+    data.traceId = recordCall();
+    data.progress = [this, generation](const AsyncLoaderData &partial) {
+        QMetaObject::invokeMethod(this, [this, partial, generation] { handlePartialResults(partial, generation); }, Qt::QueuedConnection);
+    };
+    m_tasks.run([this, data, generation] {
+        acquireVolumeAsync(m_tasks, data, false, [this, generation](AsyncLoaderData result) {
+            addGradients(result);
+            QMetaObject::invokeMethod(this, [this, result, generation] { handleResults(result, generation); }, Qt::QueuedConnection);
+        });
+    });
+}
+
+// Keep a shown volume as the snapshot the next session resumes from. It is
+// written once no load has succeeded for kSnapshotIdleMs, or when the app
+// quits, rather than after every load.
+void VolumeTextureData::saveSnapshot(const AsyncLoaderData &result)
+{
+    if (s_snapshotInstance != this)
+        return;
+    if (result.mapping || isBuiltinVolume(result.source))
+        return; // Resumed from the snapshot itself, or generated.
+    m_pendingSnapshot = result; // Shares the bytes with the texture.
+    m_pendingSnapshot.progress = nullptr;
+    m_pendingSnapshot.cancelled = nullptr; // Shown, so written even when a newer load has started.
+    m_pendingSnapshot.gradientData = QByteArray(); // Recomputed on resume.
+    m_pendingSnapshot.gradientReservation = MemoryReservation();
+    m_snapshotPending = true;
+    m_snapshotTimer.start();
+}
+
+// Write the pending snapshot, in the background unless the app is quitting.
+void VolumeTextureData::writeSnapshot(bool blocking)
+{
+    if (!m_snapshotPending)
+        return;
+    if (!blocking && m_isLoading) {
+        m_snapshotTimer.start(); // Not idle yet.
         return;
     }
+    const AsyncLoaderData snapshot = m_pendingSnapshot;
+    m_pendingSnapshot = AsyncLoaderData();
+    m_snapshotPending = false;
+    m_snapshotTimer.stop();
+    if (blocking)
+        VolumeSnapshot::save(snapshot);
+    else
+        m_refinementTasks.run([snapshot] { VolumeSnapshot::save(snapshot); });
+}
 
+// Record the load about to start when loads are traced, returns its trace id.
+quint64 VolumeTextureData::recordCall() const
+{
+    LoadTrace *trace = LoadTrace::instance();
+    if (!trace)
+        return 0;
+    LoadTrace::Call call;
+    call.source = loaderData.source;
+    call.width = loaderData.width;
+    call.height = loaderData.height;
+    call.depth = loaderData.depth;
+    call.dataType = loaderData.dataType;
+    call.globalFocusPoint = loaderData.globalFocusPoint;
+    call.level = loaderData.level;
+    call.order = loaderData.order;
+    call.overlaySources = loaderData.overlaySources;
+    call.overlayLevels = loaderData.overlayLevels;
+    call.overlayOrders = loaderData.overlayOrders;
+    call.regionChunks = loaderData.regionChunks;
+    call.voxelBudget = loaderData.voxelBudget;
+    call.byteBudget = loaderData.byteBudget;
+    call.maxTextureSide = loaderData.maxTextureSide;
+    call.sliceMin = loaderData.sliceMin;
+    call.sliceMax = loaderData.sliceMax;
+    call.gradientsEnabled = loaderData.gradientsEnabled;
+    return trace->recordCall(call);
+}
+
+// Show the volume of the last session from its snapshot, then reload it from
+// the source in the background. Returns false when there is no usable snapshot.
+bool VolumeTextureData::resumeSnapshot()
+{
+    AsyncLoaderData snapshot;
+    if (!VolumeSnapshot::load(snapshot))
+        return false;
+    qDebug() << "Resuming from volume snapshot:" << snapshot.source;
+
+    // Later loads continue from the inputs that produced the snapshot.
+    loaderData = snapshot;
+    loaderData.volumeData = QByteArray();
+    loaderData.mapping.reset();
+    loaderData.histogram.clear();
+    loaderData.success = false;
+    m_regionChunks = snapshot.regionChunks;
+    m_sliceMin = snapshot.sliceMin;
+    m_sliceMax = snapshot.sliceMax;
+    m_width = snapshot.width;
+    m_height = snapshot.height;
+    m_depth = snapshot.depth;
+
+    m_cancelled = std::make_shared<std::atomic_bool>(false);
+    loaderData.cancelled = m_cancelled;
+    snapshot.cancelled = m_cancelled;
+    const quint64 generation = ++m_generation;
     m_isLoading = true;
-    initWorker();
+    // Queued, so QML has connected to loadSucceeded by the time it is shown.
+    QMetaObject::invokeMethod(this, [this, snapshot, generation] {
+        handleResults(snapshot, generation);
+        revalidateSnapshot(snapshot, generation);
+    }, Qt::QueuedConnection);
+    return true;
 }
 
-void VolumeTextureData::initWorker()
+// Reload the snapshot's volume from its source at refinement priority, so it
+// yields to anything the user asks for. The texture is only replaced when the
+// source has changed since the snapshot was written.
+void VolumeTextureData::revalidateSnapshot(const AsyncLoaderData &snapshot, quint64 generation)
 {
-    Q_ASSERT(!m_worker || !m_worker->isRunning());
-    delete m_worker;
-    m_worker = new Worker(this, loaderData);
-    connect(m_worker, &Worker::resultReady, this, &VolumeTextureData::handleResults);
-    m_worker->start();
-    Q_ASSERT(m_worker->isRunning());
+    if (generation != m_generation)
+        return; // Already replaced by a newer load.
+
+    AsyncLoaderData input = loaderData;
+    input.priority = LoaderPool::Refinement;
+    // The snapshot does not store the limits, they come from the properties.
+    // Left at 0 they would mean unlimited, and a downsampled snapshot would
+    // always look stale.
+    input.voxelBudget = m_voxelBudget;
+    input.byteBudget = m_byteBudget;
+    input.maxTextureSide = m_maxTextureSide;
+    input.gradientsEnabled = m_gradientsEnabled;
+    m_refinementTasks.run([this, input, snapshot, generation] {
+        QElapsedTimer timer;
+        timer.start();
+        // A resident copy may be as old as the snapshot.
+        acquireVolumeAsync(m_refinementTasks, input, true, [this, input, snapshot, generation, timer](AsyncLoaderData result) {
+            if (result.isCancelled())
+                return;
+            if (!result.success) {
+                qWarning() << "Could not revalidate volume snapshot, keeping it:" << input.source;
+                return;
+            }
+            if (result.width == snapshot.width && result.height == snapshot.height && result.depth == snapshot.depth
+                    && result.channels == snapshot.channels && result.volumeData == snapshot.volumeData) {
+                qDebug() << "Volume snapshot is up to date, revalidated in" << timer.elapsed() << "ms";
+                return;
+            }
+
+            qDebug() << "Volume snapshot is stale, replacing it:" << input.source;
+            addGradients(result);
+            // Shown and saved like any other load, unless a newer one superseded it meanwhile.
+            QMetaObject::invokeMethod(this, [this, result, generation] { handleResults(result, generation); }, Qt::QueuedConnection);
+        });
+    });
 }
 
-void VolumeTextureData::handleResults(AsyncLoaderData result)
+// Show a volume that is still loading, the texture fills in as chunks arrive.
+void VolumeTextureData::handlePartialResults(AsyncLoaderData partial, quint64 generation)
 {
-    m_worker->quit();
-    m_worker->wait();
+    if (generation != m_generation || !m_isLoading)
+        return; // Superseded, or the full volume is already shown.
+    if (LoadTrace *trace = LoadTrace::instance())
+        trace->recordProgress(partial.traceId);
+
+    m_currentDataSize = partial.volumeData.size();
+    m_textureReservation = MemoryReservation();
+    m_textureReservation = MemoryBudget::instance()->track(MemoryBudget::Texture, partial.volumeData.size());
+
+    setSize(QSize(partial.width, partial.height));
+    QQuick3DTextureData::setDepth(partial.depth);
+    setFormat(Format::R8);
+    setTextureData(partial.volumeData);
+    m_textureMapping.reset();
+    setChannels(1);
+    setOccupied(QVector3D(0, 0, 0), QVector3D(1, 1, 1));
+    if (m_gradientsReady)
+        setGradients(QByteArray(), MemoryReservation()); // They belong to the previous volume.
+
+    emit loadProgressed(partial.source);
+}
 
-    if (m_isAborting) {
-        m_isAborting = false;
-        initWorker();
+void VolumeTextureData::handleResults(AsyncLoaderData result, quint64 generation)
+{
+    LoadTrace *trace = LoadTrace::instance();
+    if (generation != m_generation) { // A newer load has been requested.
+        if (trace)
+            trace->recordOutcome(result.traceId, LoadTrace::Superseded, result.stages);
         return;
     }
 
     if (!result.success) {
+        if (trace)
+            trace->recordOutcome(result.traceId, LoadTrace::Failed, result.stages);
         emit loadFailed(result.source, result.width, result.height, result.depth, result.dataType, result.localFocusPoint, result.globalFocusPoint);
+        m_isLoading = false;
+        return;
     }
 
     m_currentDataSize = result.volumeData.size();
+    // The texture keeps its own reference to the bytes, account for them until they are replaced.
+    // Bytes shared with other instances are accounted for once.
+    m_textureReservation = MemoryReservation();
+    m_resident = result.resident;
+    m_textureReservation = m_resident ? m_resident->textureReservation()
+                                      : MemoryBudget::instance()->track(MemoryBudget::Texture, result.volumeData.size());
 
     setSize(QSize(m_width, m_height));
     QQuick3DTextureData::setDepth(m_depth);
-    setFormat(Format::R8);
+    setFormat(result.channels > 1 ? Format::RGBA8 : Format::R8);
     setTextureData(result.volumeData);
+    m_textureMapping = result.mapping; // Released once the texture holds other bytes.
+    m_unfilteredData = result.volumeData;
+    m_unfilteredMapping = result.mapping;
+    m_filterCache.clear();
     updateTextureDimensions();
+    setChannels(result.channels);
+    setOccupied(result.occupiedMin, result.occupiedMax);
+
+    m_histogram.syncChunks(result.histogram);
+    emit histogramChanged();
 
     setWidth(result.width);
     setHeight(result.height);
@@ -659,10 +2099,19 @@ void VolumeTextureData::handleResults(AsyncLoaderData result)
     setDataType(result.dataType);
     setSource(result.source);
 
-    emit loadSucceeded(result.source, result.width, result.height, result.depth, result.dataType, result.localFocusPoint, result.globalFocusPoint);
+    // After the texture has its final size, the gradient texture follows it.
+    setGradients(result.gradientData, result.gradientReservation);
+    if (m_gradientsEnabled && !result.gradientsEnabled)
+        startGradients(); // Enabled while this load was in flight.
+    applyFilter();
+
+    saveSnapshot(result);
+
+    if (trace)
+        trace->recordOutcome(result.traceId, LoadTrace::Succeeded, result.stages);
+    emit loadSucceeded(result.source, result.width, result.height, result.depth, result.dataType, result.localFocusPoint, result.globalFocusPoint, result.spacing);
     m_isLoading = false;
 }
 
 QT_END_NAMESPACE
 
-#include "volumetexturedata.moc"
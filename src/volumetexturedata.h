@@ -4,18 +4,31 @@
 #ifndef VOLUMETEXTUREDATA_H
 #define VOLUMETEXTUREDATA_H
 
+#include <QFile>
 #include <QMutex>
 #include <QtQuick3D/QQuick3DTextureData>
 #include <QtQml/QQmlEngine>
 
 #include <QtGui/QColor>
 #include <QtCore/QByteArray>
+#include <QStringList>
+#include <QTimer>
 #include <QUrl>
 #include <QVector3D>
 
+#include <src/loaderpool.h>
+#include <src/loadtrace.h>
+#include <src/memorybudget.h>
+#include <src/volumefilter.h>
+#include <src/volumehistogram.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
 QT_BEGIN_NAMESPACE
 
-class Worker;
+class ResidentVolume;
 
 class VolumeTextureData : public QQuick3DTextureData
 {
@@ -23,6 +36,8 @@ class VolumeTextureData : public QQuick3DTextureData
     QML_ELEMENT
 
 public:
+    static constexpr int kDefaultMaxTextureSide = 2048; // Common limit of 3D textures.
+
     struct AsyncLoaderData
     {
         QUrl source;
@@ -35,7 +50,36 @@ public:
         QVector3D globalFocusPoint = {};
         int level = -1;
         QString order = "C";
+        QString chunkKey; // Identifies the chunk held in volumeData.
+        QVector3D chunkOrigin = {}; // Voxel offset of volumeData in the store (x, y, z).
+        QList<QUrl> overlaySources; // Stores packed into the remaining channels.
+        QList<int> overlayLevels;
+        QStringList overlayOrders;
+        int regionChunks = 1; // Zarr chunks per axis loaded around the focus point.
+        qint64 voxelBudget = 0; // Volumes over a budget are downsampled, 0 is unlimited.
+        qint64 byteBudget = 0;
+        int maxTextureSide = kDefaultMaxTextureSide; // Volumes longer along an axis are downsampled, 0 is unlimited.
+        QVector3D spacing = { 1, 1, 1 }; // Source voxels per texture voxel along x, y and z.
+        QVector3D sliceMin = { 0, 0, 0 }; // Box of the volume to load as fractions, the rest stays empty.
+        QVector3D sliceMax = { 1, 1, 1 };
+        int channels = 1; // Interleaved uint8 channels per voxel, 1 (R8) or 4 (RGBA8).
+        QVector3D occupiedMin = { 0, 0, 0 }; // Box around the chunks that are not empty, as fractions.
+        QVector3D occupiedMax = { 1, 1, 1 };
+        VolumeHistogram histogram;
+        bool gradientsEnabled = false;
+        QByteArray gradientData; // RGBA8 Sobel gradients of the density, when enabled.
+        MemoryReservation gradientReservation;
+        std::shared_ptr<std::atomic_bool> cancelled; // Set when a newer load supersedes this one.
+        LoaderPool::Priority priority = LoaderPool::Interactive; // Of the tasks the load splits into.
+        std::shared_ptr<QFile> mapping; // Keeps volumeData valid when it is mapped from a snapshot.
+        std::function<void(const AsyncLoaderData &partial)> progress; // Takes partly loaded volumes, may be empty.
+        MemoryReservation reservation; // Accounts for volumeData.
+        quint64 traceId = 0; // Of the call in LoadTrace, 0 when not recorded.
+        LoadTrace::Stages stages = {};
+        std::shared_ptr<ResidentVolume> resident; // Shares volumeData with other instances, see ResidentVolumes.
         bool success = false;
+
+        bool isCancelled() const { return cancelled && *cancelled; }
     };
 
     VolumeTextureData();
@@ -46,6 +90,22 @@ public:
     Q_PROPERTY(qsizetype height READ height WRITE setHeight NOTIFY heightChanged FINAL)
     Q_PROPERTY(qsizetype depth READ depth WRITE setDepth NOTIFY depthChanged FINAL)
     Q_PROPERTY(QString dataType READ dataType WRITE setDataType NOTIFY dataTypeChanged FINAL)
+    Q_PROPERTY(int regionChunks READ regionChunks WRITE setRegionChunks NOTIFY regionChunksChanged FINAL)
+    Q_PROPERTY(qint64 voxelBudget READ voxelBudget WRITE setVoxelBudget NOTIFY budgetChanged FINAL)
+    Q_PROPERTY(qint64 byteBudget READ byteBudget WRITE setByteBudget NOTIFY budgetChanged FINAL)
+    Q_PROPERTY(int maxTextureSide READ maxTextureSide WRITE setMaxTextureSide NOTIFY budgetChanged FINAL)
+    Q_PROPERTY(QVector3D sliceMin READ sliceMin WRITE setSliceMin NOTIFY sliceMinChanged FINAL)
+    Q_PROPERTY(QVector3D sliceMax READ sliceMax WRITE setSliceMax NOTIFY sliceMaxChanged FINAL)
+    Q_PROPERTY(int channels READ channels NOTIFY channelsChanged FINAL)
+    Q_PROPERTY(QVector3D occupiedMin READ occupiedMin NOTIFY occupiedChanged FINAL)
+    Q_PROPERTY(QVector3D occupiedMax READ occupiedMax NOTIFY occupiedChanged FINAL)
+    Q_PROPERTY(QList<qreal> histogram READ histogram NOTIFY histogramChanged FINAL)
+    Q_PROPERTY(bool gradientsEnabled READ gradientsEnabled WRITE setGradientsEnabled NOTIFY gradientsEnabledChanged FINAL)
+    Q_PROPERTY(bool gradientsReady READ gradientsReady NOTIFY gradientsReadyChanged FINAL)
+    Q_PROPERTY(QQuick3DTextureData *gradientTexture READ gradientTexture CONSTANT FINAL)
+    Q_PROPERTY(QString filter READ filter WRITE setFilter NOTIFY filterChanged FINAL)
+    Q_PROPERTY(int filterRadius READ filterRadius WRITE setFilterRadius NOTIFY filterChanged FINAL)
+    Q_PROPERTY(qreal filterAmount READ filterAmount WRITE setFilterAmount NOTIFY filterChanged FINAL)
 
     QUrl source() const;
     void setSource(const QUrl &newSource);
@@ -62,7 +122,62 @@ public:
     QString dataType() const;
     void setDataType(const QString &newDataType);
 
+    // Zarr loads fetch a block of regionChunks^3 chunks around the focus chunk.
+    int regionChunks() const;
+    void setRegionChunks(int newRegionChunks);
+
+    // Loads that exceed these, or the 3D texture size limit, are downsampled
+    // by a whole factor per axis as they are converted, each texture voxel
+    // the mean of a block. The factors are reported through loadSucceeded.
+    // 0 is unlimited.
+    qint64 voxelBudget() const;
+    void setVoxelBudget(qint64 newVoxelBudget);
+    qint64 byteBudget() const;
+    void setByteBudget(qint64 newByteBudget);
+    // Largest 3D texture side the renderer takes, e.g. GL_MAX_3D_TEXTURE_SIZE.
+    // Volumes longer along an axis are downsampled like volumes over budget.
+    int maxTextureSide() const;
+    void setMaxTextureSide(int newMaxTextureSide);
+
+    // Zarr loads skip chunks outside this box, and decode only the z slices
+    // inside it where the chunk format allows. Fractions of the loaded volume.
+    QVector3D sliceMin() const;
+    void setSliceMin(const QVector3D &newSliceMin);
+    QVector3D sliceMax() const;
+    void setSliceMax(const QVector3D &newSliceMax);
+
+    int channels() const;
+
+    // Box around the loaded chunks that hold data. Chunks outside it were left
+    // out of a sparse store and are empty, rays need not march through them.
+    QVector3D occupiedMin() const;
+    QVector3D occupiedMax() const;
+
+    // Gradients of the density for shading, computed after conversion into a
+    // second texture of the same size. Enabling them computes them for the
+    // current volume too; gradientsReady is set while they match it.
+    bool gradientsEnabled() const;
+    void setGradientsEnabled(bool newGradientsEnabled);
+    bool gradientsReady() const;
+    QQuick3DTextureData *gradientTexture() const;
+
+    // Noise filter applied to loaded volumes: "none", "median", "gaussian",
+    // "unsharp" or "contrast". Filtered volumes are kept, changing back to
+    // settings used before for the same volume does not filter again.
+    QString filter() const;
+    void setFilter(const QString &newFilter);
+    int filterRadius() const;
+    void setFilterRadius(int newFilterRadius);
+    qreal filterAmount() const;
+    void setFilterAmount(qreal newFilterAmount);
+
+    QList<qreal> histogram() const;
+    // Texture value in [0..1] below which the given fraction of non-empty voxels fall.
+    Q_INVOKABLE qreal histogramPercentile(qreal fraction) const;
+
     Q_INVOKABLE void loadAsync(QUrl source, qsizetype width, qsizetype height, qsizetype depth, QString dataType, QVector3D globalFocusPoint=QVector3D(0,0,0), int level = -1, QString order = "C");
+    // Load Zarr stores aligned with the source into the g, b and a channels of the texture.
+    Q_INVOKABLE void loadOverlayAsync(QUrl source, QList<QUrl> overlaySources, QVector3D globalFocusPoint, int level, QString order, QList<int> overlayLevels, QStringList overlayOrders);
 
 signals:
     void sourceChanged();
@@ -70,13 +185,40 @@ signals:
     void heightChanged();
     void depthChanged();
     void dataTypeChanged();
-    void loadSucceeded(QUrl source, qsizetype width, qsizetype height, qsizetype depth, QString dataType, QVector3D localFocusPoint, QVector3D globalFocusPoint);
+    void regionChunksChanged();
+    void budgetChanged();
+    void sliceMinChanged();
+    void sliceMaxChanged();
+    void channelsChanged();
+    void occupiedChanged();
+    void histogramChanged();
+    void gradientsEnabledChanged();
+    void gradientsReadyChanged();
+    void filterChanged();
+    // Part of a volume that is still loading is shown.
+    void loadProgressed(QUrl source);
+    // `spacing` is the source voxels per texture voxel, above 1 along downsampled axes.
+    void loadSucceeded(QUrl source, qsizetype width, qsizetype height, qsizetype depth, QString dataType, QVector3D localFocusPoint, QVector3D globalFocusPoint, QVector3D spacing);
     void loadFailed(QUrl source, qsizetype width, qsizetype height, qsizetype depth, QString dataType, QVector3D localFocusPoint, QVector3D globalFocusPoint);
 
 private:
-    void handleResults(VolumeTextureData::AsyncLoaderData result);
+    void startLoad();
+    void acquireVolumeAsync(LoaderTaskGroup &tasks, const AsyncLoaderData &input, bool refresh, const std::function<void(AsyncLoaderData)> &done);
+    quint64 recordCall() const;
+    bool resumeSnapshot();
+    void revalidateSnapshot(const AsyncLoaderData &snapshot, quint64 generation);
+    void saveSnapshot(const AsyncLoaderData &result);
+    void writeSnapshot(bool blocking);
+    void handleResults(VolumeTextureData::AsyncLoaderData result, quint64 generation);
+    void handlePartialResults(VolumeTextureData::AsyncLoaderData partial, quint64 generation);
     void updateTextureDimensions();
-    void initWorker();
+    void setChannels(int newChannels);
+    void startGradients();
+    void setGradients(const QByteArray &data, const MemoryReservation &reservation);
+    void setOccupied(const QVector3D &newOccupiedMin, const QVector3D &newOccupiedMax);
+    void setFilterSettings(const VolumeFilter::Settings &newFilter);
+    void applyFilter();
+    void showFiltered(const QByteArray &volume);
 
     QUrl m_source;
     qsizetype m_width = 0;
@@ -84,12 +226,39 @@ private:
     qsizetype m_depth = 0;
     qsizetype m_currentDataSize = 0;
     QString m_dataType;
+    int m_regionChunks = 1;
+    qint64 m_voxelBudget = qint64(1) << 30;
+    qint64 m_byteBudget = qint64(1) << 30;
+    int m_maxTextureSide = kDefaultMaxTextureSide;
+    QVector3D m_sliceMin = { 0, 0, 0 };
+    QVector3D m_sliceMax = { 1, 1, 1 };
+    int m_channels = 1;
+    QVector3D m_occupiedMin = { 0, 0, 0 };
+    QVector3D m_occupiedMax = { 1, 1, 1 };
+    VolumeHistogram m_histogram;
+    MemoryReservation m_textureReservation;
+    std::shared_ptr<QFile> m_textureMapping; // Snapshot file the texture bytes are mapped from.
+    std::shared_ptr<ResidentVolume> m_resident; // Keeps the texture bytes shared with other instances.
+    bool m_gradientsEnabled = false;
+    bool m_gradientsReady = false;
+    QQuick3DTextureData *m_gradientTexture = nullptr;
+    MemoryReservation m_gradientReservation;
+    VolumeFilter::Settings m_filter;
+    QByteArray m_unfilteredData; // The loaded volume, shown while no filter is set.
+    std::shared_ptr<QFile> m_unfilteredMapping; // Snapshot file m_unfilteredData is mapped from.
+    VolumeFilterCache m_filterCache; // Filtered versions of m_unfilteredData.
 
     // Async variables
     AsyncLoaderData loaderData;
     bool m_isLoading = false;
-    bool m_isAborting = false;
-    Worker *m_worker = nullptr;
+    quint64 m_generation = 0;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    LoaderTaskGroup m_tasks;
+    LoaderTaskGroup m_refinementTasks { LoaderPool::Refinement }; // Snapshot writes and revalidation.
+    // The volume shown last, written as the snapshot once loads have been idle for a while or the app quits.
+    AsyncLoaderData m_pendingSnapshot;
+    bool m_snapshotPending = false;
+    QTimer m_snapshotTimer;
 };
 
 QT_END_NAMESPACE
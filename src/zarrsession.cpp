@@ -0,0 +1,152 @@
+#include <QDebug>
+#include <QJsonDocument>
+
+#include <src/resourcefetcher.h>
+#include <src/zarrsession.h>
+
+std::shared_ptr<ZarrSession> ZarrSession::forStore(const QUrl &url)
+{
+    static QMutex mutex;
+    static QHash<QUrl, std::shared_ptr<ZarrSession>> sessions;
+
+    // "store.zarr" and "store.zarr/" are the same store.
+    const QUrl key = url.adjusted(QUrl::StripTrailingSlash);
+
+    QMutexLocker locker(&mutex);
+    auto &session = sessions[key];
+    if (!session) {
+        session = std::make_shared<ZarrSession>(url);
+    }
+    return session;
+}
+
+ZarrSession::ZarrSession(const QUrl &url)
+    : m_url(url)
+{
+}
+
+StorageZarr::Metadata ZarrSession::metadata(int level)
+{
+    QMutexLocker locker(&m_mutex);
+    bool waited = false;
+    for (;;) {
+        auto it = m_levels.constFind(level);
+        if (it == m_levels.constEnd()) {
+            break;
+        }
+        if (it->loading) {
+            m_loaded.wait(&m_mutex); // Another caller fetches it.
+            waited = true;
+            continue;
+        }
+        if (!it->failed || waited) { // A failure is shared with the callers that waited for it.
+            return it->meta;
+        }
+        break; // A network failure is worth another try on the next load.
+    }
+    m_levels.insert(level, Level());
+    locker.unlock();
+
+    StorageZarr::Metadata meta;
+    bool failed = false;
+    const QByteArray jsonData = readMetadata(level, &failed);
+    if (!jsonData.isEmpty()) {
+        meta = StorageZarr::Metadata::fromByteArray(jsonData);
+    }
+
+    locker.relock();
+    Level &entry = m_levels[level];
+    entry.meta = meta;
+    entry.loading = false;
+    entry.failed = failed;
+    m_loaded.wakeAll();
+    return meta;
+}
+
+int ZarrSession::resolveLevel(int level)
+{
+    if (level >= 0 || metadata(level).isValid()) {
+        return level;
+    }
+    // Multiscale stores keep the arrays in level directories.
+    return metadata(0).isValid() ? 0 : level;
+}
+
+StorageZarr ZarrSession::storage(int level)
+{
+    StorageZarr zarr(m_url);
+    zarr.setMetadata(metadata(level));
+    return zarr;
+}
+
+bool ZarrSession::isChunkMissing(const QUrl &chunkUrl) const
+{
+    QMutexLocker locker(&m_missingMutex);
+    return m_missingChunks.contains(chunkUrl);
+}
+
+void ZarrSession::markChunkMissing(const QUrl &chunkUrl)
+{
+    QMutexLocker locker(&m_missingMutex);
+    m_missingChunks.insert(chunkUrl);
+}
+
+QByteArray ZarrSession::readMetadata(int level, bool *failed)
+{
+    loadConsolidatedMetadata();
+
+    const QString key = StorageZarr::getConsolidatedMetadataKey(level);
+    QJsonValue array;
+    {
+        QMutexLocker locker(&m_mutex);
+        array = m_consolidated.value(key);
+    }
+    if (array.isObject()) {
+        return QJsonDocument(array.toObject()).toJson(QJsonDocument::Compact);
+    }
+
+    StorageZarr zarr(m_url);
+    if (zarr.isLocal()) {
+        return zarr.readLocalMetadata(level);
+    }
+    const FetchedResource fetched = fetchResourceAsync(zarr.getMetadataUrl(level)).result();
+    *failed = fetched.status == FetchedResource::Failed;
+    return fetched.data;
+}
+
+void ZarrSession::loadConsolidatedMetadata()
+{
+    QMutexLocker locker(&m_mutex);
+    bool waited = false;
+    while (m_consolidatedLoading) {
+        m_loaded.wait(&m_mutex);
+        waited = true;
+    }
+    if (m_consolidatedLoaded || waited) {
+        return; // Loaded, or failed for the caller that was waited for as well.
+    }
+    m_consolidatedLoading = true;
+    locker.unlock();
+
+    StorageZarr zarr(m_url);
+    QByteArray jsonData;
+    bool failed = false;
+    if (zarr.isLocal()) {
+        jsonData = zarr.readLocalConsolidatedMetadata();
+    } else {
+        const FetchedResource fetched = fetchResourceAsync(zarr.getConsolidatedMetadataUrl()).result();
+        failed = fetched.status == FetchedResource::Failed; // Try again on the next load.
+        jsonData = fetched.data;
+    }
+    QJsonObject consolidated;
+    if (const QJsonValue metadata = QJsonDocument::fromJson(jsonData).object()["metadata"]; metadata.isObject()) {
+        consolidated = metadata.toObject();
+        qDebug() << "Consolidated metadata:" << consolidated.size() << "entries";
+    }
+
+    locker.relock();
+    m_consolidatedLoading = false;
+    m_consolidatedLoaded = !failed;
+    m_consolidated = consolidated;
+    m_loaded.wakeAll();
+}
@@ -0,0 +1,69 @@
+#ifndef ZARRSESSION_H
+#define ZARRSESSION_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSet>
+#include <QUrl>
+#include <QWaitCondition>
+
+#include <memory>
+
+#include <src/storagezarr.h>
+
+// Long-lived state of one Zarr store, shared by every load from it. Parsed
+// metadata is cached per level, so only the first load from a store pays
+// for metadata round trips. Metadata is fetched without holding the
+// session's lock: the first caller for a level fetches it and later callers
+// for the same level wait for that fetch, loads of other levels go on.
+class ZarrSession
+{
+public:
+    // The session for a store, created on first use and kept for the process.
+    static std::shared_ptr<ZarrSession> forStore(const QUrl &url);
+
+    explicit ZarrSession(const QUrl &url);
+
+    QUrl url() const { return m_url; }
+
+    // Metadata of a level, invalid when the store has no array at that level.
+    StorageZarr::Metadata metadata(int level);
+
+    // The level to load when none is given: the root array, or the first
+    // level of a multiscale store.
+    int resolveLevel(int level);
+
+    // A storage accessor for the level with its metadata already set.
+    StorageZarr storage(int level);
+
+    // Chunks the store answered with 404. Sparse stores leave out chunks
+    // that hold only the fill value, these are not requested again.
+    bool isChunkMissing(const QUrl &chunkUrl) const;
+    void markChunkMissing(const QUrl &chunkUrl);
+
+private:
+    QByteArray readMetadata(int level, bool *failed);
+    void loadConsolidatedMetadata();
+
+    QUrl m_url;
+
+    struct Level
+    {
+        StorageZarr::Metadata meta; // Invalid for missing levels, which are not retried.
+        bool loading = true; // Being fetched, callers wait on m_loaded.
+        bool failed = false; // A network failure, retried by the next caller.
+    };
+
+    QMutex m_mutex; // Guards the metadata state, never held across a fetch.
+    QWaitCondition m_loaded;
+    QHash<int, Level> m_levels;
+    bool m_consolidatedLoading = false;
+    bool m_consolidatedLoaded = false;
+    QJsonObject m_consolidated; // The "metadata" object of .zmetadata, empty when not available.
+
+    mutable QMutex m_missingMutex;
+    QSet<QUrl> m_missingChunks;
+};
+
+#endif // ZARRSESSION_H
@@ -0,0 +1,266 @@
+// Measures Zarr loads end to end, from loadAsync to loadSucceeded, against
+// stores of several data types, orders and chunk sizes served by a
+// FakeZarrServer. Runs without a window and without network access, `--help`
+// lists the options.
+//
+// Prints the 50th, 95th and 99th percentile of the time to the first shown
+// image and of the time to the complete volume per store, then times the
+// CPU kernels of a load on their own. Exits non-zero when a load failed or a
+// store's 95th percentile time to complete exceeded --max-p95.
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QGuiApplication>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QtMath>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#include <src/fakezarrserver.h>
+#include <src/memorybudget.h>
+#include <src/residentvolumes.h>
+#include <src/storagezarr.h>
+#include <src/volumegradients.h>
+#include <src/volumetexturedata.h>
+
+static constexpr int kLoadTimeoutMs = 60000;
+
+namespace {
+
+struct BenchmarkCase
+{
+    FakeZarrServer::Array array;
+    int regionChunks;
+};
+
+struct KernelCase
+{
+    QString name;
+    qint64 voxels;
+    std::function<void()> run;
+};
+
+struct LoadTiming
+{
+    bool succeeded = false;
+    qint64 firstImageMs = -1;
+    qint64 completeMs = -1;
+};
+
+}
+
+// Layouts the loader handles differently: data types that are converted,
+// orders that are transposed, uncompressed chunks, and a single chunk that
+// is shown in slabs as it decodes.
+static QList<BenchmarkCase> benchmarkCases()
+{
+    return {
+        { { "uint8-c", { 256, 256, 256 }, { 128, 128, 128 } }, 2 },
+        { { "uint16-c", { 256, 256, 256 }, { 128, 128, 128 }, "<u2" }, 2 },
+        { { "float32-f", { 128, 128, 128 }, { 64, 64, 64 }, "<f4", "F" }, 2 },
+        { { "uint8-yxz-raw", { 256, 256, 256 }, { 128, 128, 128 }, "|u1", "yxz", false }, 2 },
+        { { "uint8-c-single", { 256, 256, 256 }, { 256, 256, 256 } }, 1 },
+    };
+}
+
+// Nearest rank percentile of sorted samples.
+static qint64 percentile(const QList<qint64> &sorted, qreal fraction)
+{
+    if (sorted.isEmpty())
+        return -1;
+    const qsizetype rank = qCeil(fraction * sorted.size());
+    return sorted[qBound<qsizetype>(0, rank - 1, sorted.size() - 1)];
+}
+
+// A store with chunks of `side` cubed voxels in `order`, to reorder chunks with.
+static std::shared_ptr<StorageZarr> orderedStore(const QString &order, int side)
+{
+    StorageZarr::Metadata meta;
+    meta.version = 2;
+    meta.chunks = { side, side, side };
+    meta.shape = meta.chunks;
+    meta.order = order;
+    meta.dtype = "|u1";
+    auto zarr = std::make_shared<StorageZarr>(QUrl());
+    zarr->setMetadata(meta);
+    return zarr;
+}
+
+// Kernels that run on loads, timed apart from fetching and decoding. A copy
+// of the volume is the bound for the reorders.
+static QList<KernelCase> kernelCases(const QByteArray &volume, qsizetype side)
+{
+    const auto voxels = reinterpret_cast<const uint8_t *>(volume.constData());
+    const qsizetype count = side * side * side;
+    const auto fOrder = orderedStore("F", side);
+    const auto yxzOrder = orderedStore("yxz", side);
+    return {
+        { "gradients", count, [=] { VolumeGradients::compute(voxels, 1, side, side, side); } },
+        { "copy", count, [=] {
+             QByteArray copy(volume.size(), Qt::Uninitialized);
+             std::memcpy(copy.data(), volume.constData(), volume.size());
+         } },
+        { "reorder F", count, [=] { fOrder->reorderChunk(volume); } },
+        { "reorder yxz", count, [=] { yxzOrder->reorderChunk(volume); } },
+    };
+}
+
+// Wait for the load in flight. Its signals are queued to this thread, so
+// nothing is missed between starting the load and waiting.
+static LoadTiming waitForLoad(VolumeTextureData &volume, const QElapsedTimer &started)
+{
+    LoadTiming timing;
+    QEventLoop loop;
+    QObject context;
+    QObject::connect(&volume, &VolumeTextureData::loadProgressed, &context, [&] {
+        if (timing.firstImageMs < 0)
+            timing.firstImageMs = started.elapsed();
+    });
+    QObject::connect(&volume, &VolumeTextureData::loadSucceeded, &context, [&] {
+        timing.succeeded = true;
+        timing.completeMs = started.elapsed();
+        if (timing.firstImageMs < 0)
+            timing.firstImageMs = timing.completeMs; // Shown all at once.
+        loop.quit();
+    });
+    QObject::connect(&volume, &VolumeTextureData::loadFailed, &loop, &QEventLoop::quit);
+    QTimer::singleShot(kLoadTimeoutMs, &loop, &QEventLoop::quit);
+    loop.exec();
+    return timing;
+}
+
+int main(int argc, char *argv[])
+{
+    // Opens no window and also runs on machines without a display.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+
+    // Loader threads reserve memory, create the budget on the GUI thread first.
+    MemoryBudget::instance();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measure Zarr loads against a local fake store and exit.");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "runs", "Loads per store.", "count", "10" },
+        { "latency", "Delay before every reply.", "ms", "20" },
+        { "bandwidth", "Bandwidth shared by all replies, 0 is unlimited.", "MB/s", "200" },
+        { "error-rate", "Fraction of chunk requests answered with 503.", "fraction", "0.02" },
+        { "max-p95", "Fail when a store's 95th percentile time to complete is longer.", "ms" },
+    });
+    parser.process(app);
+
+    FakeZarrServer::Conditions conditions;
+    conditions.latencyMs = parser.value("latency").toInt();
+    conditions.bytesPerSecond = qint64(parser.value("bandwidth").toDouble() * 1e6);
+    conditions.errorRate = parser.value("error-rate").toDouble();
+    const int runs = qMax(1, parser.value("runs").toInt());
+    const qint64 maxP95 = parser.isSet("max-p95") ? parser.value("max-p95").toLongLong() : -1;
+
+    // Keep the snapshot of the user's last session out of the measurement.
+    QStandardPaths::setTestModeEnabled(true);
+
+    const QList<BenchmarkCase> cases = benchmarkCases();
+    auto server = new FakeZarrServer;
+    server->setConditions(conditions);
+    for (const BenchmarkCase &benchmarkCase : cases)
+        server->addArray(benchmarkCase.array);
+
+    // The server answers on its own thread, the GUI thread is busy with results.
+    QThread serverThread;
+    serverThread.setObjectName("FakeZarrServer");
+    server->moveToThread(&serverThread);
+    QObject::connect(&serverThread, &QThread::finished, server, &QObject::deleteLater);
+    serverThread.start();
+    bool listening = false;
+    QMetaObject::invokeMethod(server, [server] { return server->listen(); }, Qt::BlockingQueuedConnection, &listening);
+    if (!listening) {
+        serverThread.quit();
+        serverThread.wait();
+        return 1;
+    }
+
+    // Let the built-in volume the texture starts with finish first.
+    VolumeTextureData volume;
+    QElapsedTimer started;
+    started.start();
+    waitForLoad(volume, started);
+
+    QTextStream out(stdout);
+    out << runs << " runs per store, " << conditions.latencyMs << " ms latency, "
+        << parser.value("bandwidth") << " MB/s, " << conditions.errorRate * 100 << "% errors\n";
+    out << qSetFieldWidth(16) << Qt::left << "store" << Qt::right
+        << "first p50" << "p95" << "p99" << "complete p50" << "p95" << "p99" << qSetFieldWidth(0) << " ms\n";
+
+    bool passed = true;
+    for (const BenchmarkCase &benchmarkCase : cases) {
+        const auto [depth, height, width] = benchmarkCase.array.shape;
+        const QVector3D center(width / 2, height / 2, depth / 2);
+        volume.setRegionChunks(benchmarkCase.regionChunks);
+
+        QList<qint64> firstImage;
+        QList<qint64> complete;
+        int failures = 0;
+        for (int run = 0; run < runs; run++) {
+            // A new URL every run and nothing resident, so every load fetches metadata and chunks anew.
+            const QUrl url = server->url(benchmarkCase.array, QString("run%1").arg(run));
+            ResidentVolumes::instance()->clear();
+            started.restart();
+            volume.loadAsync(url, -1, -1, -1, QString(), center, -1, benchmarkCase.array.order);
+            const LoadTiming timing = waitForLoad(volume, started);
+            if (!timing.succeeded) {
+                failures++;
+                continue;
+            }
+            firstImage.append(timing.firstImageMs);
+            complete.append(timing.completeMs);
+        }
+        std::sort(firstImage.begin(), firstImage.end());
+        std::sort(complete.begin(), complete.end());
+
+        out << qSetFieldWidth(16) << Qt::left << benchmarkCase.array.name << Qt::right
+            << percentile(firstImage, 0.5) << percentile(firstImage, 0.95) << percentile(firstImage, 0.99)
+            << percentile(complete, 0.5) << percentile(complete, 0.95) << percentile(complete, 0.99) << qSetFieldWidth(0);
+        if (failures > 0)
+            out << "  " << failures << " failed";
+        out << "\n";
+        out.flush();
+
+        if (failures > 0 || (maxP95 >= 0 && percentile(complete, 0.95) > maxP95))
+            passed = false;
+    }
+    out << server->requestCount() << " requests, " << server->failedCount() << " answered with 503\n";
+
+    constexpr qsizetype kKernelSide = 256;
+    QByteArray kernelVolume(kKernelSide * kKernelSide * kKernelSide, Qt::Uninitialized);
+    for (qsizetype i = 0; i < kernelVolume.size(); i++)
+        kernelVolume[i] = char((i * 2654435761u) >> 24);
+    out << "\n" << qSetFieldWidth(16) << Qt::left << "kernel" << Qt::right
+        << "p50" << "p95" << qSetFieldWidth(0) << " ms, " << kKernelSide << "^3 voxels\n";
+    for (const KernelCase &kernel : kernelCases(kernelVolume, kKernelSide)) {
+        QList<qint64> times;
+        QElapsedTimer timer;
+        for (int run = 0; run < runs; run++) {
+            timer.start();
+            kernel.run();
+            times.append(timer.nsecsElapsed());
+        }
+        std::sort(times.begin(), times.end());
+        const qint64 p50 = percentile(times, 0.5);
+        out << qSetFieldWidth(16) << Qt::left << kernel.name << Qt::right
+            << QString::number(p50 / 1e6, 'f', 1) << QString::number(percentile(times, 0.95) / 1e6, 'f', 1)
+            << qSetFieldWidth(0) << "  " << qRound64(kernel.voxels * 1e3 / qMax<qint64>(1, p50)) << " MVoxel/s\n";
+    }
+
+    serverThread.quit();
+    serverThread.wait();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFutureWatcher>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTest>
+#include <QTimer>
+
+#include <src/fakezarrserver.h>
+#include <src/memorybudget.h>
+#include <src/resourcefetcher.h>
+#include <src/volumetexturedata.h>
+
+// Short enough to time out a stalled request within the test, long enough
+// that a hedged reply arrives well before.
+static constexpr int kTimeoutMs = 1000;
+static constexpr int kRetries = 2;
+static constexpr int kWaitMs = 30000;
+
+// Finish the fetch while the server answers on this thread. False when it did not finish in time.
+static bool waitForFetch(const QFuture<FetchedResource> &future)
+{
+    QEventLoop loop;
+    QFutureWatcher<FetchedResource> watcher;
+    QObject::connect(&watcher, &QFutureWatcherBase::finished, &loop, &QEventLoop::quit);
+    QTimer::singleShot(kWaitMs, &loop, &QEventLoop::quit);
+    watcher.setFuture(future);
+    if (!future.isFinished())
+        loop.exec();
+    return future.isFinished();
+}
+
+class tst_ResourceFetcher : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    // Runs first: with too few latency samples nothing is hedged, so only
+    // the timeout can rescue the stalled request.
+    void stalledRequestTimesOutAndRetries();
+    void slowRequestIsHedged();
+    void persistentFailureFailsLoad();
+
+private:
+    QUrl chunkUrl(const QString &prefix) const;
+
+    FakeZarrServer m_server;
+    const FakeZarrServer::Array m_array { "uint8", { 64, 64, 64 }, { 32, 32, 32 } };
+};
+
+QUrl tst_ResourceFetcher::chunkUrl(const QString &prefix) const
+{
+    QUrl url = m_server.url(m_array, prefix);
+    url.setPath(url.path() + "/0.0.0");
+    return url;
+}
+
+void tst_ResourceFetcher::initTestCase()
+{
+    // Read once, before the first fetch.
+    qputenv("VOLUMERAYCASTER_FETCH_TIMEOUT_MS", QByteArray::number(kTimeoutMs));
+    qputenv("VOLUMERAYCASTER_FETCH_RETRIES", QByteArray::number(kRetries));
+    // Keep the snapshot of the user's last session out of the loads.
+    QStandardPaths::setTestModeEnabled(true);
+    // Loader threads reserve memory, create the budget on this thread first.
+    MemoryBudget::instance();
+
+    m_server.addArray(m_array);
+    QVERIFY(m_server.listen());
+}
+
+void tst_ResourceFetcher::stalledRequestTimesOutAndRetries()
+{
+    FakeZarrServer::Conditions conditions;
+    conditions.stalledRequests = 1;
+    m_server.setConditions(conditions);
+
+    const qint64 requests = m_server.requestCount();
+    QElapsedTimer timer;
+    timer.start();
+    const QFuture<FetchedResource> future = fetchResourceAsync(chunkUrl("stalled"));
+    QVERIFY(waitForFetch(future));
+
+    QCOMPARE(future.result().status, FetchedResource::Ok);
+    QVERIFY(timer.elapsed() >= kTimeoutMs);
+    QCOMPARE(m_server.requestCount() - requests, qint64(2)); // The stalled request and its retry.
+}
+
+void tst_ResourceFetcher::slowRequestIsHedged()
+{
+    m_server.setConditions(FakeZarrServer::Conditions());
+    // More fast chunk fetches than the fetcher wants before it hedges.
+    for (int i = 0; i < 20; i++) {
+        const QFuture<FetchedResource> future = fetchResourceAsync(chunkUrl(QString("warmup%1").arg(i)));
+        QVERIFY(waitForFetch(future));
+        QCOMPARE(future.result().status, FetchedResource::Ok);
+    }
+
+    FakeZarrServer::Conditions conditions;
+    conditions.slowRequests = 1;
+    conditions.slowLatencyMs = kWaitMs;
+    m_server.setConditions(conditions);
+
+    const qint64 requests = m_server.requestCount();
+    QElapsedTimer timer;
+    timer.start();
+    const QFuture<FetchedResource> future = fetchResourceAsync(chunkUrl("slow"));
+    QVERIFY(waitForFetch(future));
+
+    QCOMPARE(future.result().status, FetchedResource::Ok);
+    QVERIFY(timer.elapsed() < kTimeoutMs); // Neither waited out nor retried.
+    QCOMPARE(m_server.requestCount() - requests, qint64(2)); // The slow request and its hedge.
+}
+
+void tst_ResourceFetcher::persistentFailureFailsLoad()
+{
+    m_server.setConditions(FakeZarrServer::Conditions());
+    VolumeTextureData volume;
+    QSignalSpy succeeded(&volume, &VolumeTextureData::loadSucceeded);
+    QSignalSpy failed(&volume, &VolumeTextureData::loadFailed);
+    // Let the built-in volume the texture starts with finish first.
+    QTRY_VERIFY_WITH_TIMEOUT(succeeded.count() + failed.count() > 0, kWaitMs);
+    failed.clear();
+
+    FakeZarrServer::Conditions conditions;
+    conditions.errorRate = 1; // Metadata is still served, every chunk fails.
+    m_server.setConditions(conditions);
+
+    const qint64 failedRequests = m_server.failedCount();
+    volume.loadAsync(m_server.url(m_array, "failing"), -1, -1, -1, QString(), QVector3D(32, 32, 32));
+    QTRY_COMPARE_WITH_TIMEOUT(failed.count(), 1, kWaitMs);
+    QCOMPARE(succeeded.count(), 1); // Only the built-in volume.
+    QVERIFY(m_server.failedCount() - failedRequests > kRetries); // Retried before giving up.
+}
+
+QTEST_MAIN(tst_ResourceFetcher)
+
+#include "tst_resourcefetcher.moc"
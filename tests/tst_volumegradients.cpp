@@ -0,0 +1,103 @@
+#include <QRandomGenerator>
+#include <QTest>
+
+#include <cmath>
+
+#include <src/volumegradients.h>
+
+// Straightforward 3x3x3 Sobel over the density channel, with edge voxels
+// repeated, packed like VolumeGradients::compute.
+static QByteArray referenceGradients(const QByteArray &volume, int channels, qsizetype width, qsizetype height, qsizetype depth)
+{
+    const auto at = [&](qsizetype x, qsizetype y, qsizetype z) {
+        x = qBound<qsizetype>(0, x, width - 1);
+        y = qBound<qsizetype>(0, y, height - 1);
+        z = qBound<qsizetype>(0, z, depth - 1);
+        return int(uint8_t(volume[channels * (x + width * (y + height * z))]));
+    };
+    const auto weight = [](int offset) { return offset == 0 ? 2 : 1; };
+
+    QByteArray result(width * height * depth * 4, 0);
+    for (qsizetype z = 0; z < depth; z++) {
+        for (qsizetype y = 0; y < height; y++) {
+            for (qsizetype x = 0; x < width; x++) {
+                int gx = 0, gy = 0, gz = 0;
+                for (int dz = -1; dz <= 1; dz++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            const int value = at(x + dx, y + dy, z + dz);
+                            gx += dx * weight(dy) * weight(dz) * value;
+                            gy += dy * weight(dx) * weight(dz) * value;
+                            gz += dz * weight(dx) * weight(dy) * value;
+                        }
+                    }
+                }
+                const float magnitude = std::sqrt(float(gx) * gx + float(gy) * gy + float(gz) * gz);
+                const float inverse = magnitude > 0 ? 127.5f / magnitude : 0.0f;
+                char *out = result.data() + 4 * (x + width * (y + height * z));
+                out[0] = char(uint8_t(127.5f + gx * inverse));
+                out[1] = char(uint8_t(127.5f + gy * inverse));
+                out[2] = char(uint8_t(127.5f + gz * inverse));
+                out[3] = char(uint8_t(qMin(255.0f, magnitude / 16)));
+            }
+        }
+    }
+    return result;
+}
+
+class tst_VolumeGradients : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void matchesReference_data();
+    void matchesReference();
+};
+
+void tst_VolumeGradients::matchesReference_data()
+{
+    QTest::addColumn<int>("channels");
+    QTest::addColumn<int>("width");
+    QTest::addColumn<int>("height");
+    QTest::addColumn<int>("depth");
+
+    // Sizes off the kernel's 16 x 16 blocks, so partial blocks and every border are covered.
+    QTest::newRow("r8") << 1 << 37 << 21 << 19;
+    QTest::newRow("rgba8") << 4 << 23 << 18 << 33;
+    QTest::newRow("one block") << 1 << 16 << 16 << 16;
+    QTest::newRow("single column") << 1 << 1 << 5 << 7;
+    QTest::newRow("single slice") << 1 << 9 << 6 << 1;
+    QTest::newRow("single voxel") << 1 << 1 << 1 << 1;
+}
+
+void tst_VolumeGradients::matchesReference()
+{
+    QFETCH(int, channels);
+    QFETCH(int, width);
+    QFETCH(int, height);
+    QFETCH(int, depth);
+
+    QRandomGenerator random(width * 131 + height * 17 + depth);
+    QByteArray volume(qsizetype(width) * height * depth * channels, 0);
+    for (char &value : volume)
+        value = char(random.bounded(256));
+
+    const QByteArray expected = referenceGradients(volume, channels, width, height, depth);
+    const QByteArray actual = VolumeGradients::compute(reinterpret_cast<const uint8_t *>(volume.constData()), channels, width, height, depth);
+    QCOMPARE(actual.size(), expected.size());
+
+    // Allow for the vectorised loop rounding directions differently, e.g. with fused multiply-adds.
+    for (qsizetype i = 0; i < expected.size(); i++) {
+        const int difference = qAbs(int(uint8_t(actual[i])) - int(uint8_t(expected[i])));
+        if (difference > 1) {
+            const qsizetype voxel = i / 4;
+            QFAIL(qPrintable(QString("Channel %1 of voxel (%2, %3, %4) is %5, expected %6")
+                                     .arg(i % 4).arg(voxel % width).arg(voxel / width % height).arg(voxel / (qsizetype(width) * height))
+                                     .arg(uint8_t(actual[i])).arg(uint8_t(expected[i]))));
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(tst_VolumeGradients)
+
+#include "tst_volumegradients.moc"